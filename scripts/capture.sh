@@ -19,6 +19,15 @@ export GLC_AUDIO=1
 # install custom signal handler
 export GLC_SIGHANDLER=0
 
+# profile capture overhead, report at exit and on SIGUSR1
+export GLC_PROFILE=0
+
+# record timing of every swap into stream, N swaps per message
+export GLC_FRAME_TIMES=0
+
+# lower fps and scale when buffer has no room for N frames
+export GLC_GOVERNOR=0
+
 # captured pictures and audio buffer size, in MiB
 export GLC_UNCOMPRESSED_BUFFER_SIZE=25
 
@@ -34,9 +43,41 @@ export GLC_CAPTURE_GLFINISH=0
 # take picture from front or back buffer
 export GLC_CAPTURE=front
 
-# compress stream using 'lzo', 'quicklz' or 'none'
+# compress stream using 'lzo', 'quicklz', 'lzjb', 'lz4', 'adaptive' or 'none'
 export GLC_COMPRESS=quicklz
 
+# adaptive compression throughput target, in MiB/s
+export GLC_COMPRESS_TARGET=200
+
+# store streams that don't compress uncompressed
+export GLC_COMPRESS_PROBE=0
+
+# split BGR(A) video into colour planes before compression
+export GLC_COMPRESS_LAYOUT=0
+
+# lossless YCoCg-R colour transform for BGR(A) video, implies layout
+export GLC_COMPRESS_YCOCG=0
+
+# code audio losslessly with linear prediction and Rice codes
+export GLC_COMPRESS_LPC=0
+
+# delta code video frames, key frame every N frames
+export GLC_DELTA=0
+
+# compress large packets in parallel blocks of N KiB
+export GLC_COMPRESS_BLOCK=0
+
+# sync stream to disk after every N MiB and/or every N ms
+# from a side thread, cheaper than synchronous writes
+export GLC_SYNC_SIZE=0
+export GLC_SYNC_INTERVAL=0
+
+# preallocate stream file in N MiB chunks to avoid fragmentation
+export GLC_PREALLOC_MB=0
+
+# write stream with io_uring and O_DIRECT, bypassing page cache
+export GLC_DIRECT_IO=0
+
 # try GL_ARB_pixel_buffer_object to speed up readback
 export GLC_TRY_PBO=1
 
@@ -55,14 +55,32 @@ int main(int argc, char *argv[])
 		{'n', "lock-fps",		"GLC_LOCK_FPS",			 "1"},
 		{ 0 , "pbo",			"GLC_TRY_PBO",			 "1"},
 		{'z', "compression",		"GLC_COMPRESS",			NULL},
+		{ 0 , "compress-target",	"GLC_COMPRESS_TARGET",		NULL},
+		{ 0 , "compress-probe",		"GLC_COMPRESS_PROBE",		 "1"},
+		{ 0 , "compress-layout",	"GLC_COMPRESS_LAYOUT",		 "1"},
+		{ 0 , "compress-ycocg",		"GLC_COMPRESS_YCOCG",		 "1"},
+		{ 0 , "compress-lpc",		"GLC_COMPRESS_LPC",		 "1"},
+		{ 0 , "delta",			"GLC_DELTA",			NULL},
+		{ 0 , "compress-block",		"GLC_COMPRESS_BLOCK",		NULL},
 		{ 0 , "sync",			"GLC_SYNC",			 "1"},
+		{ 0 , "sync-size",		"GLC_SYNC_SIZE",		NULL},
+		{ 0 , "sync-interval",		"GLC_SYNC_INTERVAL",		NULL},
+		{ 0 , "resync",			"GLC_RESYNC",			NULL},
+		{ 0 , "segment-size",		"GLC_SEGMENT_SIZE",		NULL},
+		{ 0 , "segment-time",		"GLC_SEGMENT_TIME",		NULL},
+		{ 0 , "prealloc",		"GLC_PREALLOC_MB",		NULL},
+		{ 0 , "direct-io",		"GLC_DIRECT_IO",		 "1"},
 		{ 0 , "byte-aligned",		"GLC_CAPTURE_DWORD_ALIGNED",	 "0"},
+		{ 0 , "cacheline-aligned",	"GLC_CAPTURE_CACHELINE_ALIGNED", "1"},
 		{'i', "draw-indicator",		"GLC_INDICATOR",		 "1"},
 		{'v', "log",			"GLC_LOG",			NULL},
 		{'l', "log-file",		"GLC_LOG_FILE",			NULL},
 		{ 0 , "audio-skip",		"GLC_AUDIO_SKIP",		 "1"},
 		{ 0 , "disable-audio",		"GLC_AUDIO",			 "0"},
 		{ 0 , "sighandler",		"GLC_SIGHANDLER",		 "1"},
+		{ 0 , "profile",		"GLC_PROFILE",			 "1"},
+		{ 0 , "frame-times",		"GLC_FRAME_TIMES",		NULL},
+		{ 0 , "governor",		"GLC_GOVERNOR",			NULL},
 		{'g', "glfinish",		"GLC_CAPTURE_GLFINISH",		 "1"},
 		{'j', "force-sdl-alsa-drv",	"SDL_AUDIODRIVER",	      "alsa"},
 		{'b', "capture",		"GLC_CAPTURE",			NULL},
@@ -166,10 +184,42 @@ usage:
 	       "  -n, --lock-fps             lock fps when capturing\n"
 	       "      --pbo                  use GL_ARB_pixel_buffer_object if available\n"
 	       "  -z, --compression=METHOD   compress stream using METHOD\n"
-	       "                               'none', 'quicklz' and 'lzo' are supported\n"
+	       "                               'none', 'quicklz', 'lzo', 'lzjb' and 'lz4'\n"
+	       "                               are supported, 'adaptive' selects one\n"
+	       "                               per packet\n"
 	       "                               'quicklz' is used by default\n"
+	       "      --compress-target=N    adaptive compression throughput target\n"
+	       "                               in MiB/s, default is 200\n"
+	       "      --compress-probe       don't compress streams that don't compress\n"
+	       "      --compress-layout      split BGR(A) video into planes before\n"
+	       "                               compressing\n"
+	       "      --compress-ycocg       apply lossless YCoCg-R colour transform to\n"
+	       "                               BGR(A) video before compressing\n"
+	       "      --compress-lpc         code audio losslessly with linear prediction\n"
+	       "                               instead of compressing it\n"
+	       "      --delta=N              delta code video against previous frame,\n"
+	       "                               key frame every N frames, 0 disables\n"
+	       "      --compress-block=SIZE  compress large packets in parallel SIZE KiB\n"
+	       "                               blocks, 0 disables\n"
 	       "      --sync                 force synchronized write mode\n"
+	       "      --sync-size=SIZE       sync stream to disk after every SIZE MiB,\n"
+	       "                               0 disables\n"
+	       "      --sync-interval=MS     sync stream to disk every MS milliseconds,\n"
+	       "                               0 disables\n"
+	       "      --resync=SIZE          write checksummed sync marker after every\n"
+	       "                               SIZE KiB, 0 disables\n"
+	       "      --segment-size=SIZE    continue in next file after every SIZE MiB,\n"
+	       "                               0 disables\n"
+	       "      --segment-time=SECONDS continue in next file after every SECONDS\n"
+	       "                               of stream, 0 disables\n"
+	       "                               next files of out.glc are named\n"
+	       "                               out-1.glc, out-2.glc and so on\n"
+	       "      --prealloc=SIZE        preallocate stream file in SIZE MiB chunks,\n"
+	       "                               0 disables\n"
+	       "      --direct-io            write stream with io_uring and O_DIRECT,\n"
+	       "                               bypassing page cache\n"
 	       "      --byte-aligned         use GL_PACK_ALIGNMENT 1 instead of 8\n"
+	       "      --cacheline-aligned    align captured rows to 64 bytes\n"
 	       "  -i, --draw-indicator       draw indicator when capturing\n"
 	       "                               indicator does not work with -b 'front'\n"
 	       "  -v, --log=LEVEL            log >=LEVEL messages\n"
@@ -183,6 +233,12 @@ usage:
 	       "                               or capture thread is busy\n"
 	       "      --disable-audio        don't capture audio\n"
 	       "      --sighandler           use custom signal handler\n"
+	       "      --profile              profile capture overhead, histograms are\n"
+	       "                               logged at exit and on SIGUSR1 (-v 2)\n"
+	       "      --frame-times=N        record timing of every swap into stream,\n"
+	       "                               N swaps per message, 0 disables\n"
+	       "      --governor=N           lower fps and scale when buffer has no room\n"
+	       "                               for N frames, 0 disables\n"
 	       "  -g, --glfinish             capture at glFinish()\n"
 	       "  -j, --force-sdl-alsa-drv   force SDL to use ALSA audio driver\n"
 	       "  -b, --capture=BUFFER       capture 'front' or 'back' buffer\n"
@@ -41,6 +41,36 @@
 #define GL_CAPTURE_CROP            0x10
 #define GL_CAPTURE_LOCK_FPS        0x20
 #define GL_CAPTURE_IGNORE_TIME     0x40
+#define GL_CAPTURE_PROFILE         0x80
+#define GL_CAPTURE_GOVERNOR       0x100
+
+/* pending dropped frame markers per video stream */
+#define GL_CAPTURE_MAX_DROPS         64
+
+/* governor evaluates pressure once per interval (usec) */
+#define GL_CAPTURE_GOVERNOR_INTERVAL     500000
+/* clean intervals before stepping quality back up */
+#define GL_CAPTURE_GOVERNOR_UP_DELAY         10
+#define GL_CAPTURE_GOVERNOR_MAX_UP_DELAY    120
+/* buffers watched by governor */
+#define GL_CAPTURE_GOVERNOR_BUFFERS           4
+
+/* log2 buckets, last one collects everything above ~1 second */
+#define GL_CAPTURE_PROFILE_BUCKETS   22
+
+/* governor levels, fps and scale relative to configured values */
+static const struct {
+	double fps, scale;
+} gl_capture_governor_levels[] = {
+	{1.0,  1.0},
+	{0.75, 1.0},
+	{0.75, 0.75},
+	{0.5,  0.75},
+	{0.5,  0.5},
+	{0.33, 0.5}
+};
+#define GL_CAPTURE_GOVERNOR_LEVELS \
+	(sizeof(gl_capture_governor_levels) / sizeof(gl_capture_governor_levels[0]))
 
 typedef void (*FuncPtr)(void);
 typedef FuncPtr (*GLXGetProcAddressProc)(const GLubyte *procName);
@@ -58,6 +88,18 @@ typedef GLvoid *(*glMapBufferProc)(GLenum target,
                                    GLenum access);
 typedef GLboolean (*glUnmapBufferProc)(GLenum target);
 
+struct gl_capture_histogram_s {
+	const char *name;
+	u_int64_t count, sum, max;
+	u_int64_t bucket[GL_CAPTURE_PROFILE_BUCKETS];
+};
+
+struct gl_capture_governor_buffer_s {
+	ps_buffer_t *buffer;
+	size_t size;
+	ps_packet_t packet;
+};
+
 struct gl_capture_video_stream_s {
 	glc_state_video_t state_video;
 	glc_stream_id_t id;
@@ -83,6 +125,19 @@ struct gl_capture_video_stream_s {
 
 	GLuint pbo;
 	int pbo_active;
+
+	ps_packet_t times_packet;
+	glc_frame_time_t *times;
+	unsigned int times_count, times_size, times_lost;
+
+	ps_packet_t drop_packet;
+	glc_frame_drop_message_t drops[GL_CAPTURE_MAX_DROPS];
+	unsigned int drop_count, drops_lost;
+	int drop_pending;
+	glc_utime_t drop_time;
+	glc_frame_drop_reason_t drop_reason;
+
+	int refresh_format;
 };
 
 struct gl_capture_s {
@@ -90,7 +145,7 @@ struct gl_capture_s {
 	glc_flags_t flags;
 
 	GLenum capture_buffer;
-	glc_utime_t fps;
+	glc_utime_t fps, base_fps;
 
 	pthread_rwlock_t videolist_lock;
 	struct gl_capture_video_stream_s *video;
@@ -102,6 +157,7 @@ struct gl_capture_s {
 	unsigned int bpp;
 	GLenum format;
 	GLint pack_alignment;
+	unsigned int frame_times;
 
 	unsigned int crop_x, crop_y;
 	unsigned int crop_w, crop_h;
@@ -114,6 +170,25 @@ struct gl_capture_s {
 	glBindBufferProc glBindBuffer;
 	glMapBufferProc glMapBuffer;
 	glUnmapBufferProc glUnmapBuffer;
+
+	/*
+	 Profiling counters are updated without locking. Swaps from
+	 different threads may race but that only skews statistics.
+	*/
+	struct gl_capture_histogram_s prof_call, prof_interval;
+	struct gl_capture_histogram_s prof_readback, prof_map;
+	struct gl_capture_histogram_s prof_open, prof_copy;
+	glc_utime_t prof_last_swap;
+
+	pthread_mutex_t governor_mutex;
+	struct gl_capture_governor_buffer_s governor_buffer[GL_CAPTURE_GOVERNOR_BUFFERS];
+	unsigned int governor_buffers;
+	unsigned int governor_headroom;
+	gl_capture_scale_callback_t governor_scale_callback;
+	void *governor_scale_arg;
+	unsigned int governor_level, governor_drops;
+	unsigned int governor_clean, governor_up_delay;
+	glc_utime_t governor_time, governor_up_time;
 };
 
 int gl_capture_get_video_stream(gl_capture_t gl_capture,
@@ -131,6 +206,10 @@ int gl_capture_calc_geometry(gl_capture_t gl_capture, struct gl_capture_video_st
 int gl_capture_update_screen(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
 int gl_capture_update_color(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
 
+int gl_capture_write_video_format(gl_capture_t gl_capture,
+				  struct gl_capture_video_stream_s *video);
+
+void gl_capture_set_pixel_store(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
 int gl_capture_get_pixels(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video, char *to);
 int gl_capture_gen_indicator_list(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
 
@@ -140,6 +219,29 @@ int gl_capture_destroy_pbo(gl_capture_t gl_capture, struct gl_capture_video_stre
 int gl_capture_start_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
 int gl_capture_read_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
 
+void gl_capture_frame_time(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			   glc_utime_t time, glc_flags_t flags);
+void gl_capture_frame_drop(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			   glc_utime_t time, glc_frame_drop_reason_t reason);
+void gl_capture_frame_captured(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			       glc_utime_t time);
+void gl_capture_queue_drop(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_write_drops(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+
+int gl_capture_governor(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			glc_utime_t now);
+int gl_capture_governor_probe(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_governor_set_level(gl_capture_t gl_capture, unsigned int level);
+int gl_capture_write_frame_times(gl_capture_t gl_capture,
+				 struct gl_capture_video_stream_s *video);
+
+glc_utime_t gl_capture_profile_time(gl_capture_t gl_capture);
+void gl_capture_profile_add(gl_capture_t gl_capture, struct gl_capture_histogram_s *hist,
+			    glc_utime_t start);
+void gl_capture_profile_record(struct gl_capture_histogram_s *hist, glc_utime_t usec);
+void gl_capture_profile_report_histogram(gl_capture_t gl_capture,
+					 struct gl_capture_histogram_s *hist);
+
 int gl_capture_init(gl_capture_t *gl_capture, glc_t *glc)
 {
 	*gl_capture = (gl_capture_t) malloc(sizeof(struct gl_capture_s));
@@ -147,12 +249,21 @@ int gl_capture_init(gl_capture_t *gl_capture, glc_t *glc)
 
 	(*gl_capture)->glc = glc;
 	(*gl_capture)->fps = 1000000 / 30;		/* default fps is 30 */
+	(*gl_capture)->base_fps = (*gl_capture)->fps;
 	(*gl_capture)->pack_alignment = 8;		/* read as dword aligned by default */
 	(*gl_capture)->format = GL_BGRA;		/* capture as BGRA data by default */
 	(*gl_capture)->bpp = 4;				/* since we use BGRA */
 	(*gl_capture)->capture_buffer = GL_FRONT;	/* front buffer is default */
 
+	(*gl_capture)->prof_call.name = "call";
+	(*gl_capture)->prof_interval.name = "swap interval";
+	(*gl_capture)->prof_readback.name = "readback";
+	(*gl_capture)->prof_map.name = "pbo map";
+	(*gl_capture)->prof_open.name = "packet open";
+	(*gl_capture)->prof_copy.name = "copy";
+
 	pthread_mutex_init(&(*gl_capture)->init_pbo_mutex, NULL);
+	pthread_mutex_init(&(*gl_capture)->governor_mutex, NULL);
 	pthread_rwlock_init(&(*gl_capture)->videolist_lock, NULL);
 
 	return 0;
@@ -190,7 +301,9 @@ int gl_capture_set_fps(gl_capture_t gl_capture, double fps)
 	if (fps <= 0)
 		return EINVAL;
 
-	gl_capture->fps = 1000000 / fps;
+	gl_capture->base_fps = 1000000 / fps;
+	gl_capture->fps = gl_capture->base_fps /
+			  gl_capture_governor_levels[gl_capture->governor_level].fps;
 	glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
 		 "capturing at %f fps", fps);
 
@@ -205,6 +318,9 @@ int gl_capture_set_pack_alignment(gl_capture_t gl_capture, GLint pack_alignment)
 	else if (pack_alignment == 8)
 		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
 			 "reading data as dword aligned");
+	else if (pack_alignment == GLC_VIDEO_CACHELINE)
+		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+			 "reading data as cache-line aligned");
 	else {
 		glc_log(gl_capture->glc, GLC_ERROR, "gl_capture",
 			 "unknown GL_PACK_ALIGNMENT %d", pack_alignment);
@@ -304,6 +420,74 @@ int gl_capture_lock_fps(gl_capture_t gl_capture, int lock_fps)
 	return 0;
 }
 
+int gl_capture_set_frame_times(gl_capture_t gl_capture, unsigned int batch)
+{
+	if (gl_capture->video) {
+		glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+			 "can't change frame timing; video streams exist");
+		return EALREADY;
+	}
+
+	if (batch)
+		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+			 "recording frame timing, %u swaps per message", batch);
+
+	gl_capture->frame_times = batch;
+	return 0;
+}
+
+int gl_capture_set_governor(gl_capture_t gl_capture, unsigned int headroom)
+{
+	if (headroom) {
+		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+			 "adapting capture quality, keeping room for %u frames", headroom);
+		gl_capture->flags |= GL_CAPTURE_GOVERNOR;
+	} else {
+		gl_capture->flags &= ~GL_CAPTURE_GOVERNOR;
+		gl_capture_governor_set_level(gl_capture, 0);
+	}
+
+	gl_capture->governor_headroom = headroom;
+	gl_capture->governor_up_delay = GL_CAPTURE_GOVERNOR_UP_DELAY;
+	return 0;
+}
+
+int gl_capture_add_governor_buffer(gl_capture_t gl_capture, ps_buffer_t *buffer, size_t size)
+{
+	struct gl_capture_governor_buffer_s *watch;
+
+	if (gl_capture->governor_buffers == GL_CAPTURE_GOVERNOR_BUFFERS)
+		return ENOMEM;
+
+	watch = &gl_capture->governor_buffer[gl_capture->governor_buffers];
+	watch->buffer = buffer;
+	watch->size = size;
+	ps_packet_init(&watch->packet, buffer);
+	gl_capture->governor_buffers++;
+	return 0;
+}
+
+int gl_capture_set_governor_scale_callback(gl_capture_t gl_capture,
+					   gl_capture_scale_callback_t callback,
+					   void *arg)
+{
+	gl_capture->governor_scale_callback = callback;
+	gl_capture->governor_scale_arg = arg;
+	return 0;
+}
+
+int gl_capture_set_profile(gl_capture_t gl_capture, int profile)
+{
+	if (profile) {
+		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+			 "profiling capture overhead");
+		gl_capture->flags |= GL_CAPTURE_PROFILE;
+	} else
+		gl_capture->flags &= ~GL_CAPTURE_PROFILE;
+
+	return 0;
+}
+
 int gl_capture_start(gl_capture_t gl_capture)
 {
 	if (!gl_capture->to) {
@@ -326,6 +510,8 @@ int gl_capture_start(gl_capture_t gl_capture)
 
 int gl_capture_stop(gl_capture_t gl_capture)
 {
+	struct gl_capture_video_stream_s *video;
+
 	if (gl_capture->flags & GL_CAPTURE_CAPTURING)
 		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
 			 "stopping capturing");
@@ -333,6 +519,18 @@ int gl_capture_stop(gl_capture_t gl_capture)
 		glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
 			 "capturing is already stopped");
 
+	/* flush partial frame timing batches */
+	if ((gl_capture->frame_times) &&
+	    (!glc_state_test(gl_capture->glc, GLC_STATE_CANCEL))) {
+		pthread_rwlock_rdlock(&gl_capture->videolist_lock);
+		video = gl_capture->video;
+		while (video != NULL) {
+			gl_capture_write_frame_times(gl_capture, video);
+			video = video->next;
+		}
+		pthread_rwlock_unlock(&gl_capture->videolist_lock);
+	}
+
 	gl_capture->flags &= ~GL_CAPTURE_CAPTURING;
 	return 0;
 }
@@ -355,6 +553,7 @@ void gl_capture_error(gl_capture_t gl_capture, int err)
 int gl_capture_destroy(gl_capture_t gl_capture)
 {
 	struct gl_capture_video_stream_s *del;
+	unsigned int i;
 
 	while (gl_capture->video != NULL) {
 		del = gl_capture->video;
@@ -368,11 +567,19 @@ int gl_capture_destroy(gl_capture_t gl_capture)
 			gl_capture_destroy_pbo(gl_capture, del);
 
 		ps_packet_destroy(&del->packet);
+		ps_packet_destroy(&del->times_packet);
+		ps_packet_destroy(&del->drop_packet);
+		if (del->times)
+			free(del->times);
 		free(del);
 	}
 
+	for (i = 0; i < gl_capture->governor_buffers; i++)
+		ps_packet_destroy(&gl_capture->governor_buffer[i].packet);
+
 	pthread_rwlock_destroy(&gl_capture->videolist_lock);
 	pthread_mutex_destroy(&gl_capture->init_pbo_mutex);
+	pthread_mutex_destroy(&gl_capture->governor_mutex);
 
 	if (gl_capture->libGL_handle)
 		dlclose(gl_capture->libGL_handle);
@@ -447,13 +654,29 @@ int gl_capture_calc_geometry(gl_capture_t gl_capture, struct gl_capture_video_st
 	return 0;
 }
 
+void gl_capture_set_pixel_store(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	if (gl_capture->pack_alignment <= 8) {
+		glPixelStorei(GL_PACK_ALIGNMENT, gl_capture->pack_alignment);
+		return;
+	}
+
+	/*
+	 GL_PACK_ALIGNMENT can't be larger than 8, so wider alignment
+	 is done by padding row length. For BGR this leaves less than
+	 8 bytes of slack which dword alignment then rounds up to row.
+	*/
+	glPixelStorei(GL_PACK_ALIGNMENT, 8);
+	glPixelStorei(GL_PACK_ROW_LENGTH, video->row / gl_capture->bpp);
+}
+
 int gl_capture_get_pixels(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video, char *to)
 {
 	glPushAttrib(GL_PIXEL_MODE_BIT);
 	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
 
 	glReadBuffer(gl_capture->capture_buffer);
-	glPixelStorei(GL_PACK_ALIGNMENT, gl_capture->pack_alignment);
+	gl_capture_set_pixel_store(gl_capture, video);
 	glReadPixels(video->cx, video->cy, video->cw, video->ch, gl_capture->format, GL_UNSIGNED_BYTE, to);
 
 	glPopClientAttrib();
@@ -589,7 +812,7 @@ int gl_capture_start_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream
 	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo);
 
 	glReadBuffer(gl_capture->capture_buffer);
-	glPixelStorei(GL_PACK_ALIGNMENT, gl_capture->pack_alignment);
+	gl_capture_set_pixel_store(gl_capture, video);
 	/* to = ((char *)NULL + (offset)) */
 	glReadPixels(video->cx, video->cy, video->cw, video->ch, gl_capture->format, GL_UNSIGNED_BYTE, NULL);
 
@@ -605,6 +828,7 @@ int gl_capture_read_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_
 {
 	GLvoid *buf;
 	GLint binding;
+	glc_utime_t start;
 	
 	if (!video->pbo_active)
 		return EAGAIN;
@@ -612,11 +836,15 @@ int gl_capture_read_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_
 	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
 
 	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo);
+	start = gl_capture_profile_time(gl_capture);
 	buf = gl_capture->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY);
+	gl_capture_profile_add(gl_capture, &gl_capture->prof_map, start);
 	if (!buf)
 		return EINVAL;
 
+	start = gl_capture_profile_time(gl_capture);
 	ps_packet_write(&video->packet, buf, video->row * video->ch);
+	gl_capture_profile_add(gl_capture, &gl_capture->prof_copy, start);
 
 	gl_capture->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
 
@@ -647,6 +875,8 @@ int gl_capture_get_video_stream(gl_capture_t gl_capture, struct gl_capture_video
 		fvideo->dpy = dpy;
 		fvideo->drawable = drawable;
 		ps_packet_init(&fvideo->packet, gl_capture->to);
+		ps_packet_init(&fvideo->times_packet, gl_capture->to);
+		ps_packet_init(&fvideo->drop_packet, gl_capture->to);
 
 		glc_state_video_new(gl_capture->glc, &fvideo->id, &fvideo->state_video);
 
@@ -666,8 +896,6 @@ int gl_capture_get_video_stream(gl_capture_t gl_capture, struct gl_capture_video
 int gl_capture_update_video_stream(gl_capture_t gl_capture,
 			  struct gl_capture_video_stream_s *video)
 {
-	glc_message_header_t msg;
-	glc_video_format_message_t format_msg;
 	unsigned int w, h;
 
 	/* initialize PBO if not already done */
@@ -703,6 +931,8 @@ int gl_capture_update_video_stream(gl_capture_t gl_capture,
 
 		if (gl_capture->pack_alignment == 8)
 			video->flags |= GLC_VIDEO_DWORD_ALIGNED;
+		else if (gl_capture->pack_alignment == GLC_VIDEO_CACHELINE)
+			video->flags |= GLC_VIDEO_CACHELINE_ALIGNED;
 	}
 
 	if ((w != video->w) | (h != video->h)) {
@@ -711,21 +941,7 @@ int gl_capture_update_video_stream(gl_capture_t gl_capture,
 		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
 			 "creating/updating configuration for video %d", video->id);
 
-		msg.type = GLC_MESSAGE_VIDEO_FORMAT;
-		format_msg.flags = video->flags;
-		format_msg.format = video->format;
-		format_msg.id = video->id;
-		format_msg.width = video->cw;
-		format_msg.height = video->ch;
-
-		ps_packet_open(&video->packet, PS_PACKET_WRITE);
-		ps_packet_write(&video->packet, &msg, sizeof(glc_message_header_t));
-		ps_packet_write(&video->packet, &format_msg, sizeof(glc_video_format_message_t));
-		ps_packet_close(&video->packet);
-
-		glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture",
-			 "video %d: %ux%u (%ux%u), 0x%02x flags", video->id,
-			 video->cw, video->ch, video->w, video->h, video->flags);
+		gl_capture_write_video_format(gl_capture, video);
 
 		/* how about color correction? */
 		gl_capture_update_color(gl_capture, video);
@@ -740,6 +956,9 @@ int gl_capture_update_video_stream(gl_capture_t gl_capture,
 				/** \todo race condition? */
 			}
 		}
+	} else if (video->refresh_format) {
+		/* geometry is the same but downstream scale has changed */
+		gl_capture_write_video_format(gl_capture, video);
 	}
 
 
@@ -750,20 +969,50 @@ int gl_capture_update_video_stream(gl_capture_t gl_capture,
 	return 0;
 }
 
+int gl_capture_write_video_format(gl_capture_t gl_capture,
+				  struct gl_capture_video_stream_s *video)
+{
+	glc_message_header_t msg;
+	glc_video_format_message_t format_msg;
+
+	msg.type = GLC_MESSAGE_VIDEO_FORMAT;
+	format_msg.flags = video->flags;
+	format_msg.format = video->format;
+	format_msg.id = video->id;
+	format_msg.width = video->cw;
+	format_msg.height = video->ch;
+
+	ps_packet_open(&video->packet, PS_PACKET_WRITE);
+	ps_packet_write(&video->packet, &msg, sizeof(glc_message_header_t));
+	ps_packet_write(&video->packet, &format_msg, sizeof(glc_video_format_message_t));
+	ps_packet_close(&video->packet);
+
+	video->refresh_format = 0;
+
+	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture",
+		 "video %d: %ux%u (%ux%u), 0x%02x flags", video->id,
+		 video->cw, video->ch, video->w, video->h, video->flags);
+	return 0;
+}
+
 int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable)
 {
 	struct gl_capture_video_stream_s *video;
 	glc_message_header_t msg;
 	glc_video_frame_header_t pic;
-	glc_utime_t now;
+	glc_utime_t now, call_start, start, swap_time = 0;
 	char *dma;
-	int ret = 0;
+	int ret = 0, captured = 0;
 
 	if (!(gl_capture->flags & GL_CAPTURE_CAPTURING))
 		return 0; /* capturing not active */
 
+	call_start = gl_capture_profile_time(gl_capture);
 	gl_capture_get_video_stream(gl_capture, &video, dpy, drawable);
 
+	if (gl_capture->frame_times)
+		swap_time = glc_state_time(gl_capture->glc);
+
 	msg.type = GLC_MESSAGE_VIDEO_FRAME;
 	pic.id = video->id;
 
@@ -789,19 +1038,37 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 	if ((ret = gl_capture_update_video_stream(gl_capture, video)))
 		goto finish;
 
+	if (gl_capture->flags & GL_CAPTURE_GOVERNOR)
+		gl_capture_governor(gl_capture, video, now);
+
 	/* if PBO is not active, just start transfer and finish */
 	if ((gl_capture->flags & GL_CAPTURE_USE_PBO) && (!video->pbo_active)) {
+		start = gl_capture_profile_time(gl_capture);
 		ret = gl_capture_start_pbo(gl_capture, video);
+		gl_capture_profile_add(gl_capture, &gl_capture->prof_readback, start);
 		video->pbo_time = now;
 
 		goto finish;
 	}
 
-	if (ps_packet_open(&video->packet, ((gl_capture->flags & GL_CAPTURE_LOCK_FPS) |
-					    (gl_capture->flags & GL_CAPTURE_IGNORE_TIME)) ?
-					   (PS_PACKET_WRITE) :
-					   (PS_PACKET_WRITE | PS_PACKET_TRY)))
+	/* drop markers must precede the frame in stream */
+	if (!(gl_capture->flags & GL_CAPTURE_USE_PBO)) {
+		gl_capture_frame_captured(gl_capture, video, now);
+		if ((ret = gl_capture_write_drops(gl_capture, video)))
+			goto finish;
+	}
+
+	start = gl_capture_profile_time(gl_capture);
+	ret = ps_packet_open(&video->packet, ((gl_capture->flags & GL_CAPTURE_LOCK_FPS) |
+					      (gl_capture->flags & GL_CAPTURE_IGNORE_TIME)) ?
+					     (PS_PACKET_WRITE) :
+					     (PS_PACKET_WRITE | PS_PACKET_TRY));
+	gl_capture_profile_add(gl_capture, &gl_capture->prof_open, start);
+	if (ret) {
+		ret = 0;
+		gl_capture_frame_drop(gl_capture, video, now, GLC_FRAME_DROP_BUFFER_FULL);
 		goto finish;
+	}
 	if ((ret = ps_packet_write(&video->packet, &msg, sizeof(glc_message_header_t))))
 		goto cancel;
 	if ((ret = ps_packet_write(&video->packet, &pic, sizeof(glc_video_frame_header_t))))
@@ -817,14 +1084,19 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 		if ((ret = gl_capture_read_pbo(gl_capture, video)))
 			goto cancel;
 
+		start = gl_capture_profile_time(gl_capture);
 		ret = gl_capture_start_pbo(gl_capture, video);
+		gl_capture_profile_add(gl_capture, &gl_capture->prof_readback, start);
 		video->pbo_time = now;
 	} else {
 		if ((ret = ps_packet_dma(&video->packet, (void *) &dma,
 					video->row * video->ch, PS_ACCEPT_FAKE_DMA)))
 		goto cancel;
 
+		/* without PBO readback and copy are the same operation */
+		start = gl_capture_profile_time(gl_capture);
 		ret = gl_capture_get_pixels(gl_capture, video, dma);
+		gl_capture_profile_add(gl_capture, &gl_capture->prof_readback, start);
 	}
 
 	if ((gl_capture->flags & GL_CAPTURE_LOCK_FPS) &&
@@ -850,25 +1122,453 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 	}
 
 	ps_packet_close(&video->packet);
+	captured = 1;
+
+	/* with PBO the frame just written is older than the markers */
+	if (gl_capture->flags & GL_CAPTURE_USE_PBO) {
+		gl_capture_frame_captured(gl_capture, video, now);
+		ret = gl_capture_write_drops(gl_capture, video);
+	}
 
 finish:
+	/* every swap is recorded, also ones skipped because of fps cap */
+	if (gl_capture->frame_times)
+		gl_capture_frame_time(gl_capture, video, swap_time,
+				      captured ? GLC_FRAME_TIME_CAPTURED : 0);
+
 	if (ret != 0)
 		gl_capture_error(gl_capture, ret);
 
 	if (gl_capture->flags & GL_CAPTURE_DRAW_INDICATOR)
 		glCallList(video->indicator_list);
 
+	gl_capture_profile_add(gl_capture, &gl_capture->prof_call, call_start);
 	return ret;
 cancel:
 	if (ret == EBUSY) {
 		ret = 0;
 		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
 			 "dropped frame, buffer not ready");
+		gl_capture_frame_drop(gl_capture, video, now, GLC_FRAME_DROP_BUFFER_BUSY);
 	}
 	ps_packet_cancel(&video->packet);
 	goto finish;
 }
 
+void gl_capture_frame_drop(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			   glc_utime_t time, glc_frame_drop_reason_t reason)
+{
+	/*
+	 failed slot is retried at next swap and is usually captured
+	 a few ms later, it is lost only when retrying reaches next slot
+	*/
+	if (video->drop_pending) {
+		if (time - video->drop_time < gl_capture->fps)
+			return;
+		gl_capture_queue_drop(gl_capture, video);
+	}
+
+	video->drop_pending = 1;
+	video->drop_time = time;
+	video->drop_reason = reason;
+	gl_capture->governor_drops++;
+}
+
+void gl_capture_frame_captured(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			       glc_utime_t time)
+{
+	if (!video->drop_pending)
+		return;
+
+	/* frame fills the failed slot unless it is a slot later */
+	if (time - video->drop_time >= gl_capture->fps)
+		gl_capture_queue_drop(gl_capture, video);
+	video->drop_pending = 0;
+}
+
+void gl_capture_queue_drop(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	glc_frame_drop_message_t *drop;
+
+	if (video->drop_count >= GL_CAPTURE_MAX_DROPS) {
+		video->drops_lost++;
+		return;
+	}
+
+	drop = &video->drops[video->drop_count++];
+	drop->id = video->id;
+	drop->time = video->drop_time;
+	drop->reason = video->drop_reason;
+}
+
+int gl_capture_write_drops(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	glc_message_header_t msg;
+	unsigned int written = 0;
+	int ret;
+
+	if (!video->drop_count)
+		return 0;
+
+	if (video->drops_lost) {
+		glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+			 "%u dropped frame markers lost for video %d",
+			 video->drops_lost, video->id);
+		video->drops_lost = 0;
+	}
+
+	msg.type = GLC_MESSAGE_FRAME_DROP;
+	while (written < video->drop_count) {
+		/* buffer is still full, try again later */
+		if (ps_packet_open(&video->drop_packet, PS_PACKET_WRITE | PS_PACKET_TRY))
+			break;
+		if ((ret = ps_packet_write(&video->drop_packet, &msg, sizeof(glc_message_header_t))))
+			goto err;
+		if ((ret = ps_packet_write(&video->drop_packet, &video->drops[written],
+					   sizeof(glc_frame_drop_message_t))))
+			goto err;
+		if ((ret = ps_packet_close(&video->drop_packet)))
+			goto err;
+		written++;
+	}
+
+	/* keep markers that didn't fit */
+	video->drop_count -= written;
+	memmove(video->drops, &video->drops[written],
+		sizeof(glc_frame_drop_message_t) * video->drop_count);
+	return 0;
+
+err:
+	ps_packet_cancel(&video->drop_packet);
+	return ret;
+}
+
+int gl_capture_governor(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			glc_utime_t now)
+{
+	unsigned int level = gl_capture->governor_level;
+	int pressure;
+
+	if (now - gl_capture->governor_time < GL_CAPTURE_GOVERNOR_INTERVAL)
+		return 0;
+
+	/* somebody else is already evaluating */
+	if (pthread_mutex_trylock(&gl_capture->governor_mutex))
+		return 0;
+
+	gl_capture->governor_time = now;
+	pressure = gl_capture->governor_drops || gl_capture_governor_probe(gl_capture, video);
+	gl_capture->governor_drops = 0;
+
+	if (pressure) {
+		/* stepped up too early, wait longer next time */
+		if ((gl_capture->governor_up_time) &&
+		    (now - gl_capture->governor_up_time < 2 * GL_CAPTURE_GOVERNOR_INTERVAL) &&
+		    (gl_capture->governor_up_delay < GL_CAPTURE_GOVERNOR_MAX_UP_DELAY))
+			gl_capture->governor_up_delay *= 2;
+		gl_capture->governor_up_time = 0;
+		gl_capture->governor_clean = 0;
+
+		/* without scale callback skip levels that only change scale */
+		while (++level < GL_CAPTURE_GOVERNOR_LEVELS) {
+			if ((gl_capture->governor_scale_callback) ||
+			    (gl_capture_governor_levels[level].fps !=
+			     gl_capture_governor_levels[gl_capture->governor_level].fps))
+				break;
+		}
+
+		if (level < GL_CAPTURE_GOVERNOR_LEVELS)
+			gl_capture_governor_set_level(gl_capture, level);
+	} else if ((gl_capture->governor_level) &&
+		   (++gl_capture->governor_clean >= gl_capture->governor_up_delay)) {
+		gl_capture->governor_clean = 0;
+
+		while (--level > 0) {
+			if ((gl_capture->governor_scale_callback) ||
+			    (gl_capture_governor_levels[level].fps !=
+			     gl_capture_governor_levels[gl_capture->governor_level].fps))
+				break;
+		}
+
+		gl_capture->governor_up_time = now;
+		gl_capture_governor_set_level(gl_capture, level);
+	}
+
+	pthread_mutex_unlock(&gl_capture->governor_mutex);
+	return 0;
+}
+
+int gl_capture_governor_probe(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	struct gl_capture_governor_buffer_s *watch;
+	size_t size;
+	unsigned int i;
+	int ret;
+
+	/*
+	 packetstream doesn't tell how full a buffer is, so try to
+	 reserve [headroom] frames without writing anything. If that
+	 fails, a drop is about to happen. Compressed frames are never
+	 larger than raw ones, so same size is used for every buffer.
+	*/
+	for (i = 0; i < gl_capture->governor_buffers; i++) {
+		watch = &gl_capture->governor_buffer[i];
+
+		/* a reservation the buffer can never satisfy would mean pressure forever */
+		size = (size_t) gl_capture->governor_headroom * video->row * video->ch;
+		if (size > watch->size / 2)
+			size = watch->size / 2;
+
+		if (ps_packet_open(&watch->packet, PS_PACKET_WRITE | PS_PACKET_TRY))
+			return 1;
+		ret = ps_packet_setsize(&watch->packet, size);
+		ps_packet_cancel(&watch->packet);
+
+		if (ret)
+			return 1;
+	}
+
+	return 0;
+}
+
+int gl_capture_governor_set_level(gl_capture_t gl_capture, unsigned int level)
+{
+	struct gl_capture_video_stream_s *video;
+	double scale = gl_capture_governor_levels[level].scale;
+	int scale_changed;
+
+	if (level == gl_capture->governor_level)
+		return 0;
+
+	scale_changed = (scale != gl_capture_governor_levels[gl_capture->governor_level].scale);
+
+	glc_log(gl_capture->glc, GLC_PERFORMANCE, "gl_capture",
+		 "%s capture quality: fps x%.2f, scale x%.2f",
+		 level > gl_capture->governor_level ? "lowering" : "raising",
+		 gl_capture_governor_levels[level].fps,
+		 gl_capture->governor_scale_callback ? scale : 1.0);
+
+	gl_capture->governor_level = level;
+	gl_capture->fps = gl_capture->base_fps / gl_capture_governor_levels[level].fps;
+
+	if ((!scale_changed) || (!gl_capture->governor_scale_callback))
+		return 0;
+
+	if (gl_capture->governor_scale_callback(gl_capture->governor_scale_arg, scale))
+		return 0;
+
+	/* scale is applied when next format message passes downstream filter */
+	pthread_rwlock_rdlock(&gl_capture->videolist_lock);
+	video = gl_capture->video;
+	while (video != NULL) {
+		video->refresh_format = 1;
+		video = video->next;
+	}
+	pthread_rwlock_unlock(&gl_capture->videolist_lock);
+
+	return 0;
+}
+
+void gl_capture_frame_time(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			   glc_utime_t time, glc_flags_t flags)
+{
+	glc_frame_time_t *entry;
+	int ret;
+
+	if (!video->times) {
+		/* room for another batch if buffer is busy */
+		video->times = (glc_frame_time_t *) malloc(sizeof(glc_frame_time_t) *
+							   gl_capture->frame_times * 2);
+		if (!video->times) {
+			video->times_lost++;
+			return;
+		}
+		video->times_size = gl_capture->frame_times * 2;
+	}
+
+	/* buffer has been busy for two batches, drop the oldest one */
+	if (video->times_count >= video->times_size) {
+		video->times_lost += gl_capture->frame_times;
+		video->times_count -= gl_capture->frame_times;
+		memmove(video->times, &video->times[gl_capture->frame_times],
+			sizeof(glc_frame_time_t) * video->times_count);
+	}
+
+	entry = &video->times[video->times_count++];
+	entry->time = time;
+	entry->overhead = glc_state_time(gl_capture->glc) - time;
+	entry->flags = flags;
+
+	if (video->times_count < gl_capture->frame_times)
+		return;
+
+	/* telemetry never blocks or stops capture */
+	if ((ret = gl_capture_write_frame_times(gl_capture, video))) {
+		glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+			 "dropping %u frame times: %s (%d)", video->times_count, strerror(ret), ret);
+		video->times_lost += video->times_count;
+		video->times_count = 0;
+	}
+}
+
+int gl_capture_write_frame_times(gl_capture_t gl_capture,
+				 struct gl_capture_video_stream_s *video)
+{
+	glc_message_header_t msg;
+	glc_frame_times_header_t times_msg;
+	int ret;
+
+	if (!video->times_count)
+		return 0;
+
+	msg.type = GLC_MESSAGE_FRAME_TIMES;
+	times_msg.id = video->id;
+	times_msg.count = video->times_count;
+
+	/* buffer is full, try again at next swap */
+	if (ps_packet_open(&video->times_packet, PS_PACKET_WRITE | PS_PACKET_TRY))
+		return 0;
+	if ((ret = ps_packet_write(&video->times_packet, &msg, sizeof(glc_message_header_t))))
+		goto err;
+	if ((ret = ps_packet_write(&video->times_packet, &times_msg,
+				   sizeof(glc_frame_times_header_t))))
+		goto err;
+	if ((ret = ps_packet_write(&video->times_packet, video->times,
+				   sizeof(glc_frame_time_t) * video->times_count)))
+		goto err;
+	if ((ret = ps_packet_close(&video->times_packet)))
+		goto err;
+
+	video->times_count = 0;
+
+	if (video->times_lost) {
+		glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+			 "%u frame times lost for video %d",
+			 video->times_lost, video->id);
+		video->times_lost = 0;
+	}
+	return 0;
+
+err:
+	ps_packet_cancel(&video->times_packet);
+	return ret;
+}
+
+int gl_capture_profile_swap(gl_capture_t gl_capture)
+{
+	glc_utime_t now;
+
+	if (!(gl_capture->flags & GL_CAPTURE_PROFILE))
+		return 0;
+
+	now = glc_time(gl_capture->glc);
+	if (gl_capture->prof_last_swap)
+		gl_capture_profile_record(&gl_capture->prof_interval,
+					  now - gl_capture->prof_last_swap);
+	gl_capture->prof_last_swap = now;
+
+	return 0;
+}
+
+int gl_capture_profile_report(gl_capture_t gl_capture)
+{
+	if (!(gl_capture->flags & GL_CAPTURE_PROFILE))
+		return 0;
+
+	glc_log(gl_capture->glc, GLC_PERFORMANCE, "gl_capture",
+		 "capture overhead profile (times in usec):");
+
+	gl_capture_profile_report_histogram(gl_capture, &gl_capture->prof_interval);
+	gl_capture_profile_report_histogram(gl_capture, &gl_capture->prof_call);
+	gl_capture_profile_report_histogram(gl_capture, &gl_capture->prof_readback);
+	gl_capture_profile_report_histogram(gl_capture, &gl_capture->prof_map);
+	gl_capture_profile_report_histogram(gl_capture, &gl_capture->prof_open);
+	gl_capture_profile_report_histogram(gl_capture, &gl_capture->prof_copy);
+
+	return 0;
+}
+
+glc_utime_t gl_capture_profile_time(gl_capture_t gl_capture)
+{
+	if (!(gl_capture->flags & GL_CAPTURE_PROFILE))
+		return 0;
+	return glc_time(gl_capture->glc);
+}
+
+void gl_capture_profile_add(gl_capture_t gl_capture, struct gl_capture_histogram_s *hist,
+			    glc_utime_t start)
+{
+	if (!(gl_capture->flags & GL_CAPTURE_PROFILE))
+		return;
+	gl_capture_profile_record(hist, glc_time(gl_capture->glc) - start);
+}
+
+void gl_capture_profile_record(struct gl_capture_histogram_s *hist, glc_utime_t usec)
+{
+	glc_utime_t v = usec;
+	unsigned int b = 0;
+
+	/* bucket b holds values in [2^(b-1), 2^b) */
+	while ((v) && (b < GL_CAPTURE_PROFILE_BUCKETS - 1)) {
+		v >>= 1;
+		b++;
+	}
+
+	hist->bucket[b]++;
+	hist->count++;
+	hist->sum += usec;
+	if (usec > hist->max)
+		hist->max = usec;
+}
+
+void gl_capture_profile_report_histogram(gl_capture_t gl_capture,
+					 struct gl_capture_histogram_s *hist)
+{
+	u_int64_t count = hist->count, acc = 0;
+	u_int64_t p50 = 0, p99 = 0;
+	unsigned int b;
+	char range[32];
+
+	if (!count) {
+		glc_log(gl_capture->glc, GLC_PERFORMANCE, "gl_capture",
+			 "%s: no samples", hist->name);
+		return;
+	}
+
+	/* percentiles are reported as bucket upper bounds */
+	for (b = 0; b < GL_CAPTURE_PROFILE_BUCKETS; b++) {
+		acc += hist->bucket[b];
+		if ((!p50) && (acc * 2 >= count))
+			p50 = 1ull << b;
+		if ((!p99) && (acc * 100 >= count * 99))
+			p99 = 1ull << b;
+	}
+
+	glc_log(gl_capture->glc, GLC_PERFORMANCE, "gl_capture",
+		 "%s: %llu samples, avg %.1f, max %llu, p50 < %llu, p99 < %llu",
+		 hist->name, (unsigned long long) count,
+		 (double) hist->sum / (double) count,
+		 (unsigned long long) hist->max,
+		 (unsigned long long) p50, (unsigned long long) p99);
+
+	for (b = 0; b < GL_CAPTURE_PROFILE_BUCKETS; b++) {
+		if (!hist->bucket[b])
+			continue;
+
+		if (b == GL_CAPTURE_PROFILE_BUCKETS - 1)
+			snprintf(range, sizeof(range), ">= %llu",
+				 (unsigned long long) (1ull << (b - 1)));
+		else
+			snprintf(range, sizeof(range), "< %llu",
+				 (unsigned long long) (1ull << b));
+
+		glc_log(gl_capture->glc, GLC_PERFORMANCE, "gl_capture",
+			 "  %s %12s: %10llu (%5.1f%%)", hist->name, range,
+			 (unsigned long long) hist->bucket[b],
+			 100.0 * (double) hist->bucket[b] / (double) count);
+	}
+}
+
 int gl_capture_refresh_color_correction(gl_capture_t gl_capture)
 {
 	struct gl_capture_video_stream_s *video;
@@ -30,6 +30,15 @@ extern "C" {
  */
 typedef struct gl_capture_s* gl_capture_t;
 
+/**
+ * \brief scale change callback
+ *
+ * Called by the capture governor when capture scale should
+ * change. [factor] is relative to the configured scale.
+ * Return 0 if scale was changed.
+ */
+typedef int (*gl_capture_scale_callback_t)(void *arg, double factor);
+
 /**
  * \brief initialize gl_capture object
  *
@@ -68,6 +77,10 @@ __PUBLIC int gl_capture_set_fps(gl_capture_t gl_capture, double fps);
 
 /**
  * \brief set GL_PACK_ALIGNMENT for OpenGL read calls
+ *
+ * Supported values are 1, 8 and GLC_VIDEO_CACHELINE. Cache-line
+ * alignment is done using GL_PACK_ROW_LENGTH and frames are
+ * tagged with GLC_VIDEO_CACHELINE_ALIGNED.
  * \param gl_capture gl_capture object
  * \param pack_alignment GL_PACK_ALIGNMENT
  * \return 0 on success otherwise an error code
@@ -143,6 +156,102 @@ __PUBLIC int gl_capture_crop(gl_capture_t gl_capture, unsigned int x, unsigned i
  */
 __PUBLIC int gl_capture_lock_fps(gl_capture_t gl_capture, int lock_fps);
 
+/**
+ * \brief record frame timing
+ *
+ * Every swap passed to gl_capture_frame() during capturing is
+ * recorded with its time and glc overhead, including swaps
+ * that were skipped because of the fps cap. Entries are written
+ * as GLC_MESSAGE_FRAME_TIMES messages, [batch] swaps per message.
+ * Partial batches are flushed when capturing is stopped.
+ * Timing never blocks the application: when buffer stays full
+ * for two batches, the oldest batch is dropped and counted.
+ *
+ * This must be set before first frame is captured.
+ * \param gl_capture gl_capture object
+ * \param batch swaps per message, 0 disables frame timing
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_frame_times(gl_capture_t gl_capture, unsigned int batch);
+
+/**
+ * \brief adapt capture quality to buffer pressure
+ *
+ * Governor checks twice a second whether there is still room for
+ * [headroom] frames in each watched buffer (see
+ * gl_capture_add_governor_buffer()). If not, or if frames
+ * were dropped, capture fps (and scale, when a scale callback is
+ * set) is stepped down. Quality is stepped back up after buffer
+ * has stayed clear for a while; the wait grows when stepping up
+ * leads to immediate pressure.
+ * \param gl_capture gl_capture object
+ * \param headroom frames to keep free, 0 disables governor
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_governor(gl_capture_t gl_capture, unsigned int headroom);
+
+/**
+ * \brief add buffer watched by governor
+ *
+ * Reservation is limited to half of [size], so a buffer smaller
+ * than [headroom] frames doesn't look full forever. Up to four
+ * buffers can be watched. Without watched buffers governor reacts
+ * only to dropped frames.
+ * \param gl_capture gl_capture object
+ * \param buffer buffer to watch
+ * \param size buffer size in bytes
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_add_governor_buffer(gl_capture_t gl_capture, ps_buffer_t *buffer,
+					    size_t size);
+
+/**
+ * \brief set governor scale callback
+ *
+ * Without a callback the governor only changes fps. After
+ * successful scale change a new video format message is written
+ * so downstream filters pick up the new scale.
+ * \param gl_capture gl_capture object
+ * \param callback callback function
+ * \param arg argument passed to callback
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_governor_scale_callback(gl_capture_t gl_capture,
+						    gl_capture_scale_callback_t callback,
+						    void *arg);
+
+/**
+ * \brief profile capture overhead
+ *
+ * When enabled, time spent in gl_capture_frame() is measured
+ * per call and per phase (readback, PBO map, packet open and
+ * copy) and collected into log2 histograms. Cost is a few
+ * gettimeofday() calls per captured frame.
+ * \param gl_capture gl_capture object
+ * \param profile 1 enables profiling, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_profile(gl_capture_t gl_capture, int profile);
+
+/**
+ * \brief record application swap
+ *
+ * Call this at every hooked swap, even when not capturing, to
+ * collect the application's inter-swap interval.
+ * \param gl_capture gl_capture object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_profile_swap(gl_capture_t gl_capture);
+
+/**
+ * \brief write profiling histograms to log
+ *
+ * Histograms are written with GLC_PERFORMANCE level.
+ * \param gl_capture gl_capture object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_profile_report(gl_capture_t gl_capture);
+
 /**
  * \brief start capturing
  * \param gl_capture gl_capture object
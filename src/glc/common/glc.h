@@ -160,12 +160,61 @@ typedef struct {
 	u_int32_t name_size;
 	/** size of date */
 	u_int32_t date_size;
-	/** reserved */
-	u_int64_t reserved1;
+	/** stream size known to be on disk, written by group
+	    commit (see file_set_group_commit()), 0 if unknown */
+	u_int64_t durable_size;
 	/** reserved */
 	u_int64_t reserved2;
 } __attribute__((packed)) glc_stream_info_t;
 
+/** stream has sync markers, see glc_sync_message_t */
+#define GLC_STREAM_SYNC_MARKERS      0x1
+
+/** index signature = "GLCI" */
+#define GLC_INDEX_SIGNATURE          0x49434c47
+
+/**
+ * \brief stream index footer
+ *
+ * Writer appends an index after last stream in file. Index
+ * starts with [count] glc_index_entry_t entries followed by
+ * [state_size] bytes of state snapshots and [summary_count]
+ * glc_stream_summary_t entries. Footer is the last thing in
+ * file and [size] includes entries, snapshots, summary and
+ * footer itself.
+ *
+ * A state snapshot is a sequence of on-disk packets (format,
+ * color etc. messages) terminated by a close message.
+ */
+typedef struct {
+	/** index signature */
+	u_int32_t signature;
+	/** number of entries */
+	u_int32_t count;
+	/** number of stream summary entries */
+	u_int32_t summary_count;
+	/** size of state snapshots */
+	u_int64_t state_size;
+	/** total index size */
+	u_int64_t size;
+} __attribute__((packed)) glc_index_footer_t;
+
+/**
+ * \brief stream index entry
+ *
+ * No packet before [offset] carries a timestamp newer than
+ * [time], so reading can start at [offset] when seeking to
+ * [time] or later. Entries are in stream order.
+ */
+typedef struct {
+	/** stream time */
+	glc_utime_t time;
+	/** file offset of packet */
+	u_int64_t offset;
+	/** offset of state snapshot from beginning of snapshots */
+	u_int64_t state;
+} __attribute__((packed)) glc_index_entry_t;
+
 /** stream message type */
 typedef u_int8_t glc_message_type_t;
 /** end of stream */
@@ -190,6 +239,24 @@ typedef u_int8_t glc_message_type_t;
 #define GLC_MESSAGE_LZJB               0x0a
 /** callback request */
 #define GLC_CALLBACK_REQUEST           0x0b
+/** frame timing telemetry */
+#define GLC_MESSAGE_FRAME_TIMES        0x0c
+/** dropped frame marker */
+#define GLC_MESSAGE_FRAME_DROP         0x0d
+/** lz4-compressed packet */
+#define GLC_MESSAGE_LZ4                0x0e
+/** inter-frame delta coded video data */
+#define GLC_MESSAGE_VIDEO_DELTA        0x0f
+/** packet compressed in independent blocks */
+#define GLC_MESSAGE_BLOCKS             0x10
+/** video data stored in planar layout */
+#define GLC_MESSAGE_VIDEO_LAYOUT       0x11
+/** losslessly coded audio data */
+#define GLC_MESSAGE_AUDIO_LPC          0x12
+/** sync marker */
+#define GLC_MESSAGE_SYNC               0x13
+/** delta coded video key frame */
+#define GLC_MESSAGE_VIDEO_DELTA_KEY    0x14
 
 /**
  * \brief stream message header
@@ -199,6 +266,46 @@ typedef struct {
 	glc_message_type_t type;
 } __attribute__((packed)) glc_message_header_t;
 
+/**
+ * \brief stream summary entry
+ *
+ * Writer keeps running totals for each video and audio stream
+ * and stores them with the index. Totals cover only packets
+ * in this file. Packets whose stream can't be told without
+ * decompressing (QuickLZ, LZO) and weren't decoded (see
+ * file_set_decode()) are counted to a separate entry with id
+ * GLC_SUMMARY_UNKNOWN_STREAM. Its times are known only
+ * when writer clock was used (see file_set_writer_clock()),
+ * otherwise first and last are 0.
+ */
+typedef struct {
+	/** GLC_MESSAGE_VIDEO_FORMAT or GLC_MESSAGE_AUDIO_FORMAT */
+	glc_message_type_t type;
+	/** stream identifier */
+	glc_stream_id_t id;
+	/** video frames or audio data packets */
+	u_int64_t frames;
+	/** all packets of stream */
+	u_int64_t packets;
+	/** bytes on disk, including packet headers */
+	u_int64_t bytes;
+	/** time of first frame */
+	glc_utime_t first;
+	/** time of last frame */
+	glc_utime_t last;
+	/** video width or audio rate */
+	u_int32_t width;
+	/** video height or audio channels */
+	u_int32_t height;
+	/** resolution or audio format changes */
+	u_int32_t changes;
+	/** dropped frame markers */
+	u_int32_t drops;
+} __attribute__((packed)) glc_stream_summary_t;
+
+/** summary entry for packets of unknown stream */
+#define GLC_SUMMARY_UNKNOWN_STREAM   0
+
 /**
  * \brief lzo-compressed message header
  */
@@ -229,6 +336,37 @@ typedef struct {
 	glc_message_header_t header;
 } __attribute__((packed)) glc_lzjb_header_t;
 
+/**
+ * \brief lz4-compressed message header
+ */
+typedef struct {
+	/** uncompressed data size */
+	glc_size_t size;
+	/** original message header */
+	glc_message_header_t header;
+} __attribute__((packed)) glc_lz4_header_t;
+
+/**
+ * \brief block-compressed message header
+ *
+ * Packet data is split into [block_size] sized blocks (last one
+ * may be smaller) and each block is compressed independently
+ * using [compression]. Header is followed by [count] u_int32_t
+ * compressed block sizes and then compressed blocks in order.
+ */
+typedef struct {
+	/** uncompressed data size */
+	glc_size_t size;
+	/** original message header */
+	glc_message_header_t header;
+	/** block compression, GLC_MESSAGE_QUICKLZ etc. */
+	glc_message_type_t compression;
+	/** uncompressed block size */
+	u_int32_t block_size;
+	/** number of blocks */
+	u_int32_t count;
+} __attribute__((packed)) glc_blocks_header_t;
+
 /** video format type */
 typedef u_int8_t glc_video_format_t;
 /** 24bit BGR, last row first */
@@ -258,6 +396,12 @@ typedef struct {
 
 /** double-word aligned rows (GL_PACK_ALIGNMENT = 8) */
 #define GLC_VIDEO_DWORD_ALIGNED         0x1
+/** cache-line aligned rows, row size is a multiple of
+    GLC_VIDEO_CACHELINE bytes */
+#define GLC_VIDEO_CACHELINE_ALIGNED     0x2
+
+/** cache-line size used for GLC_VIDEO_CACHELINE_ALIGNED rows */
+#define GLC_VIDEO_CACHELINE            64
 
 /**
  * \brief video data header
@@ -269,6 +413,76 @@ typedef struct {
 	glc_utime_t time;
 } __attribute__((packed)) glc_video_frame_header_t;
 
+/**
+ * \brief delta coded video data header
+ *
+ * Written by pack in place of a video data message. Header
+ * is followed by frame data XORed with previous frame of the
+ * same stream. Key frames carry unmodified frame data and
+ * start a new reference and are written as
+ * GLC_MESSAGE_VIDEO_DELTA_KEY messages, so that key frames can
+ * be told apart from compressed packet headers without
+ * decompressing. unpack restores the original video data message.
+ */
+typedef struct {
+	/** stream identifier */
+	glc_stream_id_t id;
+	/** time */
+	glc_utime_t time;
+	/** flags */
+	glc_flags_t flags;
+} __attribute__((packed)) glc_video_delta_header_t;
+
+/** data is not delta coded, reference starts here */
+#define GLC_VIDEO_DELTA_KEY             0x1
+
+/**
+ * \brief planar video layout header
+ *
+ * Written by pack in place of a BGR or BGRA video message.
+ * Header is followed by a message of type [compression]
+ * (a compressed message or the original message type if
+ * stored uncompressed) that carries [prefix] bytes of the
+ * original message header and then picture data split into
+ * [width] x [height] planes, first colour channels in memory
+ * order, then row padding (GLC_VIDEO_LAYOUT_PADDING) and
+ * alpha (GLC_VIDEO_LAYOUT_ALPHA). Padding that is all zeros
+ * and alpha that is constant are not stored. With
+ * GLC_VIDEO_LAYOUT_YCOCG the three colour planes hold Y, Cg
+ * and Co of the reversible YCoCg-R transform, computed modulo
+ * 256 with first plane as blue and third as red. unpack
+ * restores the original message exactly.
+ */
+typedef struct {
+	/** original data size */
+	glc_size_t size;
+	/** original message header */
+	glc_message_header_t header;
+	/** type of contained message */
+	glc_message_type_t compression;
+	/** flags */
+	glc_flags_t flags;
+	/** bytes of original data before picture */
+	u_int32_t prefix;
+	/** width */
+	u_int32_t width;
+	/** height */
+	u_int32_t height;
+	/** original row size in bytes */
+	u_int32_t row;
+	/** bytes per pixel, 3 or 4 */
+	u_int8_t bpp;
+	/** alpha value when alpha plane is not stored */
+	u_int8_t alpha;
+} __attribute__((packed)) glc_video_layout_header_t;
+
+/** row padding is stored */
+#define GLC_VIDEO_LAYOUT_PADDING        0x1
+/** alpha plane is stored */
+#define GLC_VIDEO_LAYOUT_ALPHA          0x2
+/** colour planes are YCoCg-R transformed */
+#define GLC_VIDEO_LAYOUT_YCOCG          0x4
+
 /** audio format type */
 typedef u_int8_t glc_audio_format_t;
 /** signed 16bit little-endian */
@@ -309,6 +523,53 @@ typedef struct {
 	glc_size_t size;
 } __attribute__((packed)) glc_audio_data_header_t;
 
+/**
+ * \brief losslessly coded audio data header
+ *
+ * Written by pack in place of an audio data message. Header
+ * is followed by the original glc_audio_data_header_t and one
+ * block per channel, each starting with
+ * glc_audio_lpc_channel_header_t.
+ *
+ * A coded channel block is a MSB-first bit stream: [order]
+ * warm-up samples in sample width, then residuals of fixed
+ * polynomial predictor of given order in partitions of
+ * GLC_AUDIO_LPC_PARTITION samples. Each partition starts with
+ * a 6 bit Rice parameter k. Residuals are zigzag mapped to
+ * unsigned values u and written as (u >> k) one bits, a zero
+ * bit and low k bits of u. If u >> k is 32 or more, 32 one
+ * bits are followed by u in sample width + 5 bits instead.
+ */
+typedef struct {
+	/** original data size */
+	glc_size_t size;
+	/** original message header */
+	glc_message_header_t header;
+	/** sample format */
+	glc_audio_format_t format;
+	/** stream flags, GLC_AUDIO_INTERLEAVED */
+	glc_flags_t flags;
+	/** number of channels */
+	u_int32_t channels;
+	/** samples per channel */
+	u_int32_t frames;
+} __attribute__((packed)) glc_audio_lpc_header_t;
+
+/**
+ * \brief coded audio channel block header
+ */
+typedef struct {
+	/** predictor order 0 - 4 or GLC_AUDIO_LPC_VERBATIM */
+	u_int8_t order;
+	/** block size in bytes, excluding this header */
+	u_int32_t size;
+} __attribute__((packed)) glc_audio_lpc_channel_header_t;
+
+/** channel is stored as plain samples */
+#define GLC_AUDIO_LPC_VERBATIM       0xff
+/** residual partition size in samples */
+#define GLC_AUDIO_LPC_PARTITION       256
+
 /**
  * \brief color correction information message
  */
@@ -327,6 +588,85 @@ typedef struct {
 	float blue;
 } __attribute__((packed)) glc_color_message_t;
 
+/**
+ * \brief frame timing message header
+ *
+ * Header is followed by [count] glc_frame_time_t entries,
+ * one for each hooked swap of the video stream in
+ * chronological order.
+ */
+typedef struct {
+	/** video stream identifier */
+	glc_stream_id_t id;
+	/** number of entries */
+	u_int32_t count;
+} __attribute__((packed)) glc_frame_times_header_t;
+
+/**
+ * \brief frame timing entry
+ */
+typedef struct {
+	/** swap time */
+	glc_utime_t time;
+	/** time spent in glc during swap in microseconds */
+	u_int32_t overhead;
+	/** flags */
+	glc_flags_t flags;
+} __attribute__((packed)) glc_frame_time_t;
+
+/** frame was captured during this swap */
+#define GLC_FRAME_TIME_CAPTURED         0x1
+
+/** frame drop reason */
+typedef u_int8_t glc_frame_drop_reason_t;
+/** buffer was full, packet couldn't be opened */
+#define GLC_FRAME_DROP_BUFFER_FULL      0x1
+/** buffer was busy when writing frame */
+#define GLC_FRAME_DROP_BUFFER_BUSY      0x2
+/** delta coded frame without key frame, f.ex. after seeking */
+#define GLC_FRAME_DROP_NO_KEY_FRAME     0x3
+
+/**
+ * \brief dropped frame marker
+ *
+ * Written in place of a video frame that should have been
+ * captured but was dropped. At most one marker is written
+ * per 1/fps interval, and only when the slot was given up
+ * without a capture.
+ */
+typedef struct {
+	/** video stream identifier */
+	glc_stream_id_t id;
+	/** time of dropped frame */
+	glc_utime_t time;
+	/** reason */
+	glc_frame_drop_reason_t reason;
+} __attribute__((packed)) glc_frame_drop_message_t;
+
+/** sync marker signature = "GLCSYNC" + 0xf1 */
+#define GLC_SYNC_SIGNATURE           0xf1434e5953434c47ULL
+
+/**
+ * \brief sync marker
+ *
+ * With GLC_STREAM_SYNC_MARKERS writer puts a marker after
+ * every few MiB of packets. Marker covers packets written
+ * since previous marker, or since stream info for first one.
+ * Reader checks covered packets before passing them on and
+ * if they are damaged, searches for next marker and
+ * continues from there. Markers are never passed on.
+ */
+typedef struct {
+	/** GLC_SYNC_SIGNATURE */
+	u_int64_t signature;
+	/** size of covered packets in bytes */
+	u_int64_t size;
+	/** CRC32C of covered packets */
+	u_int32_t crc;
+	/** CRC32C of marker up to this field */
+	u_int32_t check;
+} __attribute__((packed)) glc_sync_message_t;
+
 /**
  * \brief container message header
  */
@@ -35,6 +35,11 @@ struct glc_thread_private_s {
 	pthread_t *pthread_thread;
 	pthread_mutex_t open, finish;
 
+	/* write packet order when process callback is used */
+	pthread_mutex_t order;
+	pthread_cond_t order_cond;
+	unsigned long read_ticket, write_ticket;
+
 	glc_thread_t *thread;
 	size_t running_threads;
 
@@ -43,6 +48,8 @@ struct glc_thread_private_s {
 };
 
 void *glc_thread(void *argptr);
+int glc_thread_wait_turn(struct glc_thread_private_s *private, unsigned long ticket);
+void glc_thread_next_turn(struct glc_thread_private_s *private);
 
 int glc_thread_create(glc_t *glc, glc_thread_t *thread, ps_buffer_t *from, ps_buffer_t *to)
 {
@@ -66,6 +73,8 @@ int glc_thread_create(glc_t *glc, glc_thread_t *thread, ps_buffer_t *from, ps_bu
 
 	pthread_mutex_init(&private->open, NULL);
 	pthread_mutex_init(&private->finish, NULL);
+	pthread_mutex_init(&private->order, NULL);
+	pthread_cond_init(&private->order_cond, NULL);
 
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
@@ -102,12 +111,46 @@ int glc_thread_wait(glc_thread_t *thread)
 	free(private->pthread_thread);
 	pthread_mutex_destroy(&private->finish);
 	pthread_mutex_destroy(&private->open);
+	pthread_mutex_destroy(&private->order);
+	pthread_cond_destroy(&private->order_cond);
 	free(private);
 	thread->priv = NULL;
 
 	return 0;
 }
 
+/**
+ * \brief wait until it is ticket's turn to write
+ * \param private thread private data
+ * \param ticket ticket taken when packet was read
+ * \return 0 on success, EINTR if thread was stopped
+ */
+int glc_thread_wait_turn(struct glc_thread_private_s *private, unsigned long ticket)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&private->order);
+	while ((private->write_ticket != ticket) && (!private->stop))
+		pthread_cond_wait(&private->order_cond, &private->order);
+	if (private->write_ticket != ticket)
+		ret = EINTR;
+	pthread_mutex_unlock(&private->order);
+
+	return ret;
+}
+
+/**
+ * \brief pass write turn to next ticket
+ * \param private thread private data
+ */
+void glc_thread_next_turn(struct glc_thread_private_s *private)
+{
+	pthread_mutex_lock(&private->order);
+	private->write_ticket++;
+	pthread_cond_broadcast(&private->order_cond);
+	pthread_mutex_unlock(&private->order);
+}
+
 /**
  * \brief thread loop
  *
@@ -118,7 +161,8 @@ int glc_thread_wait(glc_thread_t *thread)
  */
 void *glc_thread(void *argptr)
 {
-	int has_locked, ret, write_size_set, packets_init;
+	int has_locked, ret, write_size_set, packets_init, has_ticket;
+	unsigned long ticket;
 
 	struct glc_thread_private_s *private = (struct glc_thread_private_s *) argptr;
 	glc_thread_t *thread = private->thread;
@@ -126,7 +170,7 @@ void *glc_thread(void *argptr)
 
 	ps_packet_t read, write;
 
-	write_size_set = ret = has_locked = packets_init = 0;
+	write_size_set = ret = has_locked = packets_init = has_ticket = 0;
 	state.flags = state.read_size = state.write_size = 0;
 	state.ptr = thread->ptr;
 
@@ -159,6 +203,11 @@ void *glc_thread(void *argptr)
 		if ((thread->flags & GLC_THREAD_WRITE) && (thread->flags & GLC_THREAD_READ)) {
 			pthread_mutex_lock(&private->open); /* preserve packet order */
 			has_locked = 1;
+
+			if (thread->process_callback) {
+				ticket = private->read_ticket++;
+				has_ticket = 1;
+			}
 		}
 
 		if ((thread->flags & GLC_THREAD_READ) && (!(state.flags & GLC_THREAD_STATE_SKIP_READ))) {
@@ -188,6 +237,19 @@ void *glc_thread(void *argptr)
 			}
 		}
 
+		if (has_ticket) {
+			/* let next packet be read while this one is processed */
+			has_locked = 0;
+			pthread_mutex_unlock(&private->open);
+
+			if ((ret = thread->process_callback(&state)))
+				goto err;
+
+			/* write packets are opened in read order */
+			if ((ret = glc_thread_wait_turn(private, ticket)))
+				goto err;
+		}
+
 		if ((thread->flags & GLC_THREAD_WRITE) && (!(state.flags & GLC_THREAD_STATE_SKIP_WRITE))) {
 			if ((ret = ps_packet_open(&write, PS_PACKET_WRITE)))
 				goto err;
@@ -197,6 +259,11 @@ void *glc_thread(void *argptr)
 				pthread_mutex_unlock(&private->open);
 			}
 
+			if (has_ticket) {
+				has_ticket = 0;
+				glc_thread_next_turn(private);
+			}
+
 			/* reserve space for header */
 			if ((ret = ps_packet_seek(&write, sizeof(glc_message_header_t))))
 				goto err;
@@ -238,6 +305,11 @@ void *glc_thread(void *argptr)
 			pthread_mutex_unlock(&private->open);
 		}
 
+		if (has_ticket) {
+			has_ticket = 0;
+			glc_thread_next_turn(private);
+		}
+
 		if ((thread->flags & GLC_THREAD_READ) && (!(state.flags & GLC_THREAD_STATE_SKIP_READ))) {
 			ps_packet_close(&read);
 			state.read_data = NULL;
@@ -280,7 +352,11 @@ finish:
 
 	/* wake up remaining threads */
 	if ((thread->flags & GLC_THREAD_READ) && (!private->stop)) {
+		pthread_mutex_lock(&private->order);
 		private->stop = 1;
+		pthread_cond_broadcast(&private->order_cond);
+		pthread_mutex_unlock(&private->order);
+
 		ps_buffer_cancel(private->from);
 
 		/* error might have happened @ write buffer
@@ -318,6 +394,8 @@ finish:
 err:
 	if (has_locked)
 		pthread_mutex_unlock(&private->open);
+	if (has_ticket)
+		glc_thread_next_turn(private);
 
 	if (ret == EINTR)
 		ret = 0;
@@ -110,6 +110,12 @@ typedef struct {
 	/** finish callback is called only once, when all threads have
 	    finished */
 	void (*finish_callback)(void *, int);
+	/** process callback is called after read callback without
+	    holding packet order lock, so threads can do heavy work
+	    whose result size is not known in advance in parallel.
+	    Write packets are still opened in read order. Only used
+	    when both GLC_THREAD_READ and GLC_THREAD_WRITE are set. */
+	int (*process_callback)(glc_thread_state_t *);
 } glc_thread_t;
 
 /**
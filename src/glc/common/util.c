@@ -17,12 +17,21 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <nmmintrin.h>
+# define __CRC32C_SSE42
+#endif
 
 #include "glc.h"
 #include "core.h"
 #include "log.h"
 #include "util.h"
 
+/** CRC32C (Castagnoli) polynomial, bit reversed */
+#define GLC_UTIL_CRC32C_POLY 0x82f63b78
+
 /**
  * \brief util private structure
  */
@@ -279,4 +288,93 @@ char *glc_util_format_filename(const char *fmt, unsigned int capture)
 	return filename;
 }
 
+static pthread_once_t glc_util_crc32c_once = PTHREAD_ONCE_INIT;
+static u_int32_t glc_util_crc32c_table[8][256];
+static int glc_util_crc32c_hw = 0;
+
+/**
+ * \brief build slicing tables and check for crc32 instruction
+ */
+static void glc_util_crc32c_init(void)
+{
+	u_int32_t crc;
+	unsigned int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (GLC_UTIL_CRC32C_POLY & -(crc & 1));
+		glc_util_crc32c_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		crc = glc_util_crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = glc_util_crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			glc_util_crc32c_table[j][i] = crc;
+		}
+	}
+
+#ifdef __CRC32C_SSE42
+	__builtin_cpu_init();
+	glc_util_crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#ifdef __CRC32C_SSE42
+/**
+ * \brief crc32c with SSE 4.2 crc32 instruction
+ */
+__attribute__((target("sse4.2")))
+static u_int32_t glc_util_crc32c_sse42(u_int32_t crc, const unsigned char *p, size_t size)
+{
+	u_int64_t crc64 = crc;
+	u_int64_t word;
+
+	for (; (size) && ((size_t) p & 7); size--)
+		crc64 = _mm_crc32_u8(crc64, *p++);
+
+	for (; size >= 8; size -= 8, p += 8) {
+		memcpy(&word, p, sizeof(u_int64_t));
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+
+	for (; size; size--)
+		crc64 = _mm_crc32_u8(crc64, *p++);
+
+	return crc64;
+}
+#endif
+
+u_int32_t glc_util_crc32c(u_int32_t crc, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	pthread_once(&glc_util_crc32c_once, &glc_util_crc32c_init);
+	crc = ~crc;
+
+#ifdef __CRC32C_SSE42
+	if (glc_util_crc32c_hw)
+		return ~glc_util_crc32c_sse42(crc, p, size);
+#endif
+
+	/* slicing by 8, little-endian */
+	for (; size >= 8; size -= 8, p += 8) {
+		crc ^= p[0] | (p[1] << 8) | (p[2] << 16) | ((u_int32_t) p[3] << 24);
+		crc = glc_util_crc32c_table[7][crc & 0xff] ^
+		      glc_util_crc32c_table[6][(crc >> 8) & 0xff] ^
+		      glc_util_crc32c_table[5][(crc >> 16) & 0xff] ^
+		      glc_util_crc32c_table[4][crc >> 24] ^
+		      glc_util_crc32c_table[3][p[4]] ^
+		      glc_util_crc32c_table[2][p[5]] ^
+		      glc_util_crc32c_table[1][p[6]] ^
+		      glc_util_crc32c_table[0][p[7]];
+	}
+
+	for (; size; size--)
+		crc = glc_util_crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
 /**  \} */
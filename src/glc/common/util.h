@@ -107,6 +107,19 @@ __PUBLIC char *glc_util_str_replace(const char *str, const char *find, const cha
  */
 __PUBLIC char *glc_util_format_filename(const char *fmt, unsigned int capture);
 
+/**
+ * \brief calculate CRC32C (Castagnoli) checksum
+ *
+ * Uses SSE 4.2 crc32 instruction when processor has it.
+ * Checksum of consecutive data can be calculated by passing
+ * previous return value as [crc].
+ * \param crc previous checksum, 0 for first call
+ * \param data data
+ * \param size size of data in bytes
+ * \return checksum
+ */
+__PUBLIC u_int32_t glc_util_crc32c(u_int32_t crc, const void *data, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,637 @@
+/**
+ * \file glc/core/bench.c
+ * \brief codec benchmark
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup bench
+ *  \{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <packetstream.h>
+#include <errno.h>
+
+#include <glc/common/glc.h>
+#include <glc/common/core.h>
+#include <glc/common/log.h>
+#include <glc/common/thread.h>
+#include <glc/common/util.h>
+
+#include "bench.h"
+#include "pack.h"
+
+#define BENCH_VIDEO                 1
+#define BENCH_AUDIO                 2
+
+struct bench_packet_s {
+	glc_message_header_t header;
+	size_t size;
+	char *data;
+};
+
+struct bench_list_s {
+	struct bench_packet_s *packet;
+	size_t count, size;
+	size_t bytes;
+};
+
+struct bench_s {
+	glc_t *glc;
+	glc_thread_t thread;
+	int running;
+
+	FILE *stream;
+	size_t sample_size;
+	long int threads;
+
+	struct bench_list_s sample;
+	size_t sample_bytes;
+	size_t max_size;
+	glc_flags_t content;
+};
+
+struct bench_run_s {
+	bench_t bench;
+	glc_thread_t thread;
+	long int threads;
+
+	struct bench_list_s *original;
+	struct bench_list_s result;
+	int verify;
+	unsigned long mismatches;
+
+	glc_utime_t *sent;
+	glc_utime_t *latency;
+	size_t received;
+	int finished, err;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+struct bench_codec_s {
+	const char *name;
+	int compression;
+};
+
+struct bench_transform_s {
+	const char *name;
+	int layout, ycocg, lpc;
+	unsigned int delta;
+	size_t block_size;
+	glc_flags_t content;
+};
+
+static const struct bench_codec_s bench_codecs[] = {
+#ifdef __QUICKLZ
+	{"quicklz", PACK_QUICKLZ},
+#endif
+#ifdef __LZO
+	{"lzo", PACK_LZO},
+#endif
+#ifdef __LZJB
+	{"lzjb", PACK_LZJB},
+#endif
+#ifdef __LZ4
+	{"lz4", PACK_LZ4},
+#endif
+	{"adaptive", PACK_ADAPTIVE},
+	{NULL, 0}
+};
+
+static const struct bench_transform_s bench_transforms[] = {
+	{"none", 0, 0, 0, 0, 0, 0},
+	{"layout", 1, 0, 0, 0, 0, BENCH_VIDEO},
+	{"ycocg", 0, 1, 0, 0, 0, BENCH_VIDEO},
+	{"delta", 0, 0, 0, 30, 0, BENCH_VIDEO},
+	{"blocks", 0, 0, 0, 0, 256 * 1024, 0},
+	{"lpc", 0, 0, 1, 0, 0, BENCH_AUDIO},
+	{"ycocg+lpc", 0, 1, 1, 0, 0, BENCH_VIDEO | BENCH_AUDIO},
+	{NULL, 0, 0, 0, 0, 0, 0}
+};
+
+void bench_finish_callback(void *ptr, int err);
+int bench_read_callback(glc_thread_state_t *state);
+
+int bench_list_add(struct bench_list_s *list, glc_message_header_t *header,
+		   const char *data, size_t size);
+void bench_list_free(struct bench_list_s *list);
+
+int bench_measure(bench_t bench, const struct bench_codec_s *codec,
+		  const struct bench_transform_s *transform, long int threads);
+int bench_pipeline(bench_t bench, struct bench_run_s *run,
+		   struct bench_list_s *input, int pack,
+		   const struct bench_codec_s *codec,
+		   const struct bench_transform_s *transform,
+		   glc_utime_t *elapsed);
+int bench_feed(struct bench_run_s *run, ps_buffer_t *to, struct bench_list_s *list);
+int bench_collect_callback(glc_thread_state_t *state);
+void bench_collect_finish_callback(void *ptr, int err);
+int bench_buffer_init(ps_buffer_t *buffer, size_t size);
+
+int bench_compare_utime(const void *a, const void *b);
+glc_utime_t bench_percentile(glc_utime_t *sorted, size_t count, double p);
+
+int bench_init(bench_t *bench, glc_t *glc)
+{
+	*bench = (bench_t) malloc(sizeof(struct bench_s));
+	memset(*bench, 0, sizeof(struct bench_s));
+
+	(*bench)->glc = glc;
+	(*bench)->stream = stdout;
+	(*bench)->sample_size = 64 * 1024 * 1024;
+	(*bench)->threads = glc_threads_hint(glc);
+
+	(*bench)->thread.flags = GLC_THREAD_READ;
+	(*bench)->thread.ptr = *bench;
+	(*bench)->thread.read_callback = &bench_read_callback;
+	(*bench)->thread.finish_callback = &bench_finish_callback;
+	(*bench)->thread.threads = 1;
+
+	return 0;
+}
+
+int bench_destroy(bench_t bench)
+{
+	bench_list_free(&bench->sample);
+	free(bench);
+	return 0;
+}
+
+int bench_set_sample_size(bench_t bench, size_t size)
+{
+	if (!size)
+		return EINVAL;
+
+	bench->sample_size = size;
+	return 0;
+}
+
+int bench_set_threads(bench_t bench, long int threads)
+{
+	if (threads < 1)
+		return EINVAL;
+
+	bench->threads = threads;
+	return 0;
+}
+
+int bench_set_stream(bench_t bench, FILE *stream)
+{
+	bench->stream = stream;
+	return 0;
+}
+
+int bench_process_start(bench_t bench, ps_buffer_t *from)
+{
+	int ret;
+	if (bench->running)
+		return EAGAIN;
+
+	if ((ret = glc_thread_create(bench->glc, &bench->thread, from, NULL)))
+		return ret;
+	bench->running = 1;
+
+	return 0;
+}
+
+int bench_process_wait(bench_t bench)
+{
+	if (!bench->running)
+		return EAGAIN;
+
+	glc_thread_wait(&bench->thread);
+	bench->running = 0;
+
+	return 0;
+}
+
+void bench_finish_callback(void *ptr, int err)
+{
+	bench_t bench = (bench_t) ptr;
+
+	if (err)
+		glc_log(bench->glc, GLC_ERROR, "bench", "%s (%d)",
+			 strerror(err), err);
+}
+
+int bench_read_callback(glc_thread_state_t *state)
+{
+	bench_t bench = (bench_t) state->ptr;
+	int ret;
+
+	if ((state->header.type == GLC_MESSAGE_VIDEO_FRAME) |
+	    (state->header.type == GLC_MESSAGE_AUDIO_DATA)) {
+		if (state->header.type == GLC_MESSAGE_VIDEO_FRAME)
+			bench->content |= BENCH_VIDEO;
+		else
+			bench->content |= BENCH_AUDIO;
+		bench->sample_bytes += state->read_size;
+	} else if ((state->header.type != GLC_MESSAGE_VIDEO_FORMAT) &&
+		   (state->header.type != GLC_MESSAGE_AUDIO_FORMAT))
+		return 0;
+
+	if ((ret = bench_list_add(&bench->sample, &state->header,
+				  state->read_data, state->read_size)))
+		return ret;
+
+	if (state->read_size > bench->max_size)
+		bench->max_size = state->read_size;
+
+	/* sample is full, stopping cancels the rest of the pipeline */
+	if (bench->sample_bytes >= bench->sample_size)
+		state->flags |= GLC_THREAD_STOP;
+
+	return 0;
+}
+
+int bench_list_add(struct bench_list_s *list, glc_message_header_t *header,
+		   const char *data, size_t size)
+{
+	struct bench_packet_s *packet;
+
+	if (list->count == list->size) {
+		list->size = list->size ? list->size * 2 : 256;
+		packet = (struct bench_packet_s *)
+			realloc(list->packet, sizeof(struct bench_packet_s) * list->size);
+		if (!packet)
+			return ENOMEM;
+		list->packet = packet;
+	}
+
+	packet = &list->packet[list->count];
+	if (!(packet->data = (char *) malloc(size ? size : 1)))
+		return ENOMEM;
+	memcpy(packet->data, data, size);
+	packet->header = *header;
+	packet->size = size;
+
+	list->count++;
+	list->bytes += sizeof(glc_container_message_header_t) + size;
+	return 0;
+}
+
+void bench_list_free(struct bench_list_s *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->count; i++)
+		free(list->packet[i].data);
+	free(list->packet);
+	memset(list, 0, sizeof(struct bench_list_s));
+}
+
+int bench_run(bench_t bench)
+{
+	const struct bench_codec_s *codec;
+	const struct bench_transform_s *transform;
+	long int threads, hint;
+	int ret = 0;
+
+	if (bench->running)
+		return EAGAIN;
+
+	if (!bench->content) {
+		glc_log(bench->glc, GLC_ERROR, "bench", "no video frames or audio packets in sample");
+		return ENODATA;
+	}
+
+	fprintf(bench->stream, "sample: %zu packets, %.2f MiB\n",
+		bench->sample.count, bench->sample.bytes / (1024.0 * 1024.0));
+	fprintf(bench->stream, "%-9s %-10s %7s %7s %12s %12s %10s %10s\n",
+		"codec", "transform", "threads", "ratio", "pack MiB/s",
+		"unpack MiB/s", "pack p99", "unpack p99");
+
+	/* pack and unpack read thread count from hint */
+	hint = glc_threads_hint(bench->glc);
+
+	for (codec = bench_codecs; codec->name; codec++) {
+		for (transform = bench_transforms; transform->name; transform++) {
+			if ((transform->content & bench->content) != transform->content)
+				continue;
+
+			for (threads = 1; ; threads *= 2) {
+				if (threads > bench->threads)
+					threads = bench->threads;
+
+				if ((ret = bench_measure(bench, codec, transform, threads)))
+					goto finish;
+
+				if (threads == bench->threads)
+					break;
+			}
+		}
+	}
+
+finish:
+	glc_set_threads_hint(bench->glc, hint);
+	return ret;
+}
+
+int bench_measure(bench_t bench, const struct bench_codec_s *codec,
+		  const struct bench_transform_s *transform, long int threads)
+{
+	struct bench_run_s pack_run, unpack_run;
+	glc_utime_t pack_time, unpack_time;
+	size_t count = bench->sample.count;
+	int ret;
+
+	memset(&pack_run, 0, sizeof(struct bench_run_s));
+	memset(&unpack_run, 0, sizeof(struct bench_run_s));
+	pack_run.threads = unpack_run.threads = threads;
+
+	glc_set_threads_hint(bench->glc, threads);
+
+	/* compress sample */
+	pack_run.original = &bench->sample;
+	if ((ret = bench_pipeline(bench, &pack_run, &bench->sample, 1, codec, transform, &pack_time)))
+		goto finish;
+
+	if (pack_run.result.count != count) {
+		glc_log(bench->glc, GLC_ERROR, "bench", "%s/%s: pack produced %zu packets, expected %zu",
+			 codec->name, transform->name, pack_run.result.count, count);
+		ret = EINVAL;
+		goto finish;
+	}
+
+	/* decompress it and verify against original */
+	unpack_run.original = &bench->sample;
+	unpack_run.verify = 1;
+	if ((ret = bench_pipeline(bench, &unpack_run, &pack_run.result, 0, codec, transform, &unpack_time)))
+		goto finish;
+
+	if ((unpack_run.mismatches) | (unpack_run.received != count)) {
+		glc_log(bench->glc, GLC_ERROR, "bench", "%s/%s: unpack output differs from original",
+			 codec->name, transform->name);
+		ret = EINVAL;
+		goto finish;
+	}
+
+	qsort(pack_run.latency, count, sizeof(glc_utime_t), &bench_compare_utime);
+	qsort(unpack_run.latency, count, sizeof(glc_utime_t), &bench_compare_utime);
+
+	fprintf(bench->stream, "%-9s %-10s %7ld %7.3f %12.1f %12.1f %7.2f ms %7.2f ms\n",
+		codec->name, transform->name, threads,
+		(double) bench->sample.bytes / (double) pack_run.result.bytes,
+		(bench->sample.bytes / (1024.0 * 1024.0)) /
+		((pack_time ? pack_time : 1) / 1000000.0),
+		(bench->sample.bytes / (1024.0 * 1024.0)) /
+		((unpack_time ? unpack_time : 1) / 1000000.0),
+		bench_percentile(pack_run.latency, count, 0.99) / 1000.0,
+		bench_percentile(unpack_run.latency, count, 0.99) / 1000.0);
+
+finish:
+	bench_list_free(&pack_run.result);
+	free(pack_run.sent);
+	free(pack_run.latency);
+	free(unpack_run.sent);
+	free(unpack_run.latency);
+	return ret;
+}
+
+int bench_pipeline(bench_t bench, struct bench_run_s *run,
+		   struct bench_list_s *input, int pack,
+		   const struct bench_codec_s *codec,
+		   const struct bench_transform_s *transform,
+		   glc_utime_t *elapsed)
+{
+	/*
+	 Compress run:   feed -(from)-> pack -(to)-> collect
+	 Decompress run: feed -(from)-> unpack -(to)-> collect
+	*/
+	ps_buffer_t from, to;
+	pack_t pack_obj = NULL;
+	unpack_t unpack_obj = NULL;
+	size_t buffer_size;
+	glc_utime_t start;
+	int ret, buffers = 0, started = 0;
+
+	run->bench = bench;
+
+	if (!(run->sent = (glc_utime_t *) malloc(sizeof(glc_utime_t) * (bench->sample.count + 1))))
+		return ENOMEM;
+	if (!(run->latency = (glc_utime_t *) malloc(sizeof(glc_utime_t) * (bench->sample.count + 1))))
+		return ENOMEM;
+	pthread_mutex_init(&run->mutex, NULL);
+	pthread_cond_init(&run->cond, NULL);
+
+	/* room for every packet in flight plus codec overhead */
+	buffer_size = (run->threads + 2) * (bench->max_size + bench->max_size / 8 + 4096);
+	if ((ret = bench_buffer_init(&from, buffer_size)))
+		goto finish;
+	if ((ret = bench_buffer_init(&to, buffer_size))) {
+		ps_buffer_destroy(&from);
+		goto finish;
+	}
+	buffers = 1;
+
+	if (pack) {
+		if ((ret = pack_init(&pack_obj, bench->glc)))
+			goto finish;
+		if ((ret = pack_set_compression(pack_obj, codec->compression)))
+			goto finish;
+		if (transform->layout)
+			pack_set_layout(pack_obj, 1);
+		if (transform->ycocg)
+			pack_set_ycocg(pack_obj, 1);
+		if (transform->lpc)
+			pack_set_lpc(pack_obj, 1);
+		if (transform->delta)
+			pack_set_delta(pack_obj, transform->delta);
+		if (transform->block_size)
+			pack_set_block_size(pack_obj, transform->block_size);
+		if ((ret = pack_process_start(pack_obj, &from, &to)))
+			goto finish;
+	} else {
+		if ((ret = unpack_init(&unpack_obj, bench->glc)))
+			goto finish;
+		if ((ret = unpack_process_start(unpack_obj, &from, &to)))
+			goto finish;
+	}
+	started = 1;
+
+	run->thread.flags = GLC_THREAD_READ;
+	run->thread.ptr = run;
+	run->thread.read_callback = &bench_collect_callback;
+	run->thread.finish_callback = &bench_collect_finish_callback;
+	run->thread.threads = 1;
+	if ((ret = glc_thread_create(bench->glc, &run->thread, &to, NULL)))
+		goto finish;
+
+	start = glc_time(bench->glc);
+	ret = bench_feed(run, &from, input);
+	glc_thread_wait(&run->thread);
+	*elapsed = glc_time(bench->glc) - start;
+
+	if (!ret)
+		ret = run->err;
+
+finish:
+	if (started) {
+		if (pack)
+			pack_process_wait(pack_obj);
+		else
+			unpack_process_wait(unpack_obj);
+	}
+	if (pack_obj)
+		pack_destroy(pack_obj);
+	if (unpack_obj)
+		unpack_destroy(unpack_obj);
+	if (buffers) {
+		ps_buffer_destroy(&from);
+		ps_buffer_destroy(&to);
+	}
+
+	pthread_cond_destroy(&run->cond);
+	pthread_mutex_destroy(&run->mutex);
+	return ret;
+}
+
+int bench_feed(struct bench_run_s *run, ps_buffer_t *to, struct bench_list_s *list)
+{
+	ps_packet_t packet;
+	struct bench_packet_s *src;
+	size_t i;
+	int ret, finished = 0;
+
+	if ((ret = ps_packet_init(&packet, to)))
+		return ret;
+
+	for (i = 0; i < list->count; i++) {
+		src = &list->packet[i];
+
+		/* keep at most one packet per thread in flight */
+		pthread_mutex_lock(&run->mutex);
+		while ((i - run->received >= (size_t) run->threads) && (!run->finished))
+			pthread_cond_wait(&run->cond, &run->mutex);
+		run->sent[i] = glc_time(run->bench->glc);
+		finished = run->finished;
+		pthread_mutex_unlock(&run->mutex);
+
+		/* pipeline failed, missing packets are reported later */
+		if (finished)
+			break;
+
+		if ((ret = ps_packet_open(&packet, PS_PACKET_WRITE)))
+			goto err;
+		if ((ret = ps_packet_write(&packet, &src->header, sizeof(glc_message_header_t))))
+			goto err;
+		if ((ret = ps_packet_write(&packet, src->data, src->size)))
+			goto err;
+		if ((ret = ps_packet_close(&packet)))
+			goto err;
+	}
+
+	ps_packet_destroy(&packet);
+	if (finished)
+		return 0;
+	return glc_util_write_end_of_stream(run->bench->glc, to);
+
+err:
+	ps_packet_destroy(&packet);
+	if (ret == EINTR)
+		return 0; /* collector reports what went wrong */
+	ps_buffer_cancel(to);
+	return ret;
+}
+
+int bench_collect_callback(glc_thread_state_t *state)
+{
+	struct bench_run_s *run = (struct bench_run_s *) state->ptr;
+	glc_container_message_header_t *container;
+	struct bench_packet_s *original;
+	glc_message_header_t *header = &state->header;
+	char *data = state->read_data;
+	size_t size = state->read_size, index;
+	int ret;
+
+	if (state->header.type == GLC_MESSAGE_CLOSE)
+		return 0;
+
+	pthread_mutex_lock(&run->mutex);
+	index = run->received;
+	if (index < run->original->count)
+		run->latency[index] = glc_time(run->bench->glc) - run->sent[index];
+	pthread_mutex_unlock(&run->mutex);
+
+	if (run->verify) {
+		original = index < run->original->count ? &run->original->packet[index] : NULL;
+		if ((!original) ||
+		    (original->header.type != header->type) ||
+		    (original->size != size) ||
+		    (memcmp(original->data, data, size)))
+			run->mismatches++;
+	} else {
+		/* keep what file would write */
+		if (header->type == GLC_MESSAGE_CONTAINER) {
+			container = (glc_container_message_header_t *) state->read_data;
+			header = &container->header;
+			data = &state->read_data[sizeof(glc_container_message_header_t)];
+			size = container->size;
+		}
+
+		if ((ret = bench_list_add(&run->result, header, data, size)))
+			return ret;
+	}
+
+	pthread_mutex_lock(&run->mutex);
+	run->received++;
+	pthread_cond_signal(&run->cond);
+	pthread_mutex_unlock(&run->mutex);
+
+	return 0;
+}
+
+void bench_collect_finish_callback(void *ptr, int err)
+{
+	struct bench_run_s *run = (struct bench_run_s *) ptr;
+
+	pthread_mutex_lock(&run->mutex);
+	run->finished = 1;
+	run->err = err;
+	pthread_cond_broadcast(&run->cond);
+	pthread_mutex_unlock(&run->mutex);
+}
+
+int bench_buffer_init(ps_buffer_t *buffer, size_t size)
+{
+	ps_bufferattr_t attr;
+	int ret;
+
+	if ((ret = ps_bufferattr_init(&attr)))
+		return ret;
+	if ((ret = ps_bufferattr_setsize(&attr, size)))
+		goto finish;
+	ret = ps_buffer_init(buffer, &attr);
+
+finish:
+	ps_bufferattr_destroy(&attr);
+	return ret;
+}
+
+int bench_compare_utime(const void *a, const void *b)
+{
+	glc_utime_t x = *((const glc_utime_t *) a);
+	glc_utime_t y = *((const glc_utime_t *) b);
+	return (x > y) - (x < y);
+}
+
+glc_utime_t bench_percentile(glc_utime_t *sorted, size_t count, double p)
+{
+	size_t i;
+
+	if (!count)
+		return 0;
+
+	i = (size_t) (p * (double) (count - 1) + 0.5);
+	return sorted[i < count ? i : count - 1];
+}
+
+/**  \} */
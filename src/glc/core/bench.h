@@ -0,0 +1,116 @@
+/**
+ * \file glc/core/bench.h
+ * \brief codec benchmark
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup core
+ *  \{
+ * \defgroup bench codec benchmark
+ *  \{
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdio.h>
+#include <packetstream.h>
+#include <glc/common/glc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief bench object
+ */
+typedef struct bench_s* bench_t;
+
+/**
+ * \brief initialize bench object
+ * \param bench bench object
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int bench_init(bench_t *bench, glc_t *glc);
+
+/**
+ * \brief destroy bench object
+ * \param bench bench object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int bench_destroy(bench_t bench);
+
+/**
+ * \brief set sample size
+ *
+ * bench stops reading after it has collected [size] bytes of
+ * video frames and audio packets. Default is 64 MiB.
+ * \param bench bench object
+ * \param size sample size in bytes
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int bench_set_sample_size(bench_t bench, size_t size);
+
+/**
+ * \brief set maximum thread count
+ *
+ * Every configuration is measured with 1, 2, 4, ... and finally
+ * [threads] threads. Default is glc_threads_hint().
+ * \param bench bench object
+ * \param threads maximum thread count
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int bench_set_threads(bench_t bench, long int threads);
+
+/**
+ * \brief set report stream
+ *
+ * Default stream is stdout.
+ * \param bench bench object
+ * \param stream report stream
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int bench_set_stream(bench_t bench, FILE *stream);
+
+/**
+ * \brief start collecting sample
+ *
+ * Video and audio format messages, video frames and audio
+ * packets are copied from [from] until sample is full.
+ * \param bench bench object
+ * \param from source buffer
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int bench_process_start(bench_t bench, ps_buffer_t *from);
+
+/**
+ * \brief block until sample has been collected
+ * \param bench bench object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int bench_process_wait(bench_t bench);
+
+/**
+ * \brief run benchmark
+ *
+ * Sample is compressed with every compiled codec and applicable
+ * pre-transform at every thread count, decompressed again and
+ * verified. Compression ratio, pack and unpack throughput and
+ * 99th percentile per-packet latency are reported.
+ * \param bench bench object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int bench_run(bench_t bench);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
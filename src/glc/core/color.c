@@ -281,6 +281,9 @@ int color_video_format_msg(color_t color, glc_video_format_message_t *msg)
 		if ((msg->flags & GLC_VIDEO_DWORD_ALIGNED) &&
 		    (video->row % 8 != 0))
 			video->row += 8 - video->row % 8;
+		else if ((msg->flags & GLC_VIDEO_CACHELINE_ALIGNED) &&
+			 (video->row % GLC_VIDEO_CACHELINE != 0))
+			video->row += GLC_VIDEO_CACHELINE - video->row % GLC_VIDEO_CACHELINE;
 	}
 
 	if (color->flags & COLOR_OVERRIDE) {
@@ -13,7 +13,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <packetstream.h>
@@ -23,8 +25,29 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 
+#ifdef __URING
+# include <liburing.h>
+#endif
+
+#ifdef __LZJB
+# include <lzjb.h>
+#endif
+
+#ifdef __MINILZO
+# include <minilzo.h>
+# define __LZO
+#elif defined __LZO
+# include <lzo/lzo1x.h>
+#endif
+
+#ifdef __QUICKLZ
+# include <quicklz.h>
+#endif
+
 #include <glc/common/glc.h>
 #include <glc/common/state.h>
 #include <glc/common/core.h>
@@ -43,21 +66,202 @@
 #define FILE_INFO_READ    0x10
 #define FILE_INFO_VALID   0x20
 
+/** write-behind buffer size */
+#define FILE_WRITE_BUFFER_SIZE  (1024 * 1024)
+/** buffered data is written at latest after this many microseconds */
+#define FILE_WRITE_BUFFER_TIME  100000
+/** file_write() takes at most this many vectors */
+#define FILE_WRITE_IOV_MAX      4
+/** write-behind buffer alignment */
+#define FILE_WRITE_BUFFER_ALIGN 4096
+/** number of direct writes in flight */
+#define FILE_URING_DEPTH        4
+/** mapped stream is read ahead in windows of this size */
+#define FILE_MAP_READAHEAD      (32 * 1024 * 1024)
+/** with group commit, start writeback after this many bytes */
+#define FILE_SYNC_KICK_SIZE     (4 * 1024 * 1024)
+/** index entry is added at most this often, in microseconds */
+#define FILE_INDEX_INTERVAL     1000000
+/** in scan mode, this much of each packet is read */
+#define FILE_SCAN_PEEK          (16 * 1024)
+/** in scan mode, this much of original message is decoded */
+#define FILE_SCAN_HEADER        64
+/* failed segment preparation is retried after this much stream time */
+#define FILE_SEGMENT_RETRY      1000000
+
 struct file_s {
 	glc_t *glc;
 	glc_flags_t flags;
 	glc_thread_t thread;
 	int fd;
 	int sync;
+	int direct;
+	int scan;
+	int writer_clock;
+	size_t sync_size;
+	unsigned int sync_interval;
+	size_t prealloc_size;
 	u_int32_t stream_version;
+	glc_flags_t stream_flags;
 	callback_request_func_t callback;
 	tracker_t state_tracker;
+
+	char *buffer;
+	size_t buffer_pos;
+	glc_utime_t buffer_time;
+	/* flush thread writes buffered data when no new packets arrive */
+	int buffer_pending;
+	pthread_t flush_thread;
+	pthread_mutex_t buffer_mutex;
+	pthread_cond_t buffer_cond;
+	int flush_running, flush_stop;
+
+	/* bytes handed to kernel, writer thread updates this */
+	off_t written, sync_kick;
+	/* space allocated with fallocate() */
+	off_t allocated;
+
+	/* memory mapped source */
+	char *map;
+	size_t map_size, map_pos, map_ahead;
+	char *scan_buffer;
+	/* QuickLZ and LZO packets are decoded whole when this is set */
+	int decode, decode_packets;
+	char *decode_buffer;
+	size_t decode_size;
+
+	/* sync markers, writer sums packets since last marker */
+	size_t resync_interval;
+	u_int64_t resync_size;
+	u_int32_t resync_crc;
+	/* reader passes checked packets up to resync_end */
+	int resync, resync_partial;
+	size_t resync_end, resync_next;
+	/* stream without markers is trusted up to durable_end */
+	int durable_only, durable_warned;
+	u_int64_t durable_end;
+
+	/* seek index and state snapshots, written when file is closed */
+	glc_index_entry_t *index;
+	unsigned int index_count, index_alloc;
+	char *index_state;
+	size_t index_state_size, index_state_alloc;
+	int index_state_changed;
+
+	/* running totals for each stream, written with index */
+	glc_stream_summary_t *summary;
+	unsigned int summary_count, summary_alloc;
+	/* newest packet time written so far */
+	glc_utime_t stream_time;
+
+	/* bytes known to be on disk, sync thread updates this */
+	off_t durable, durable_recorded;
+	pthread_t sync_thread;
+	pthread_mutex_t sync_mutex;
+	pthread_cond_t sync_cond;
+	int sync_running, sync_stop;
+
+	/* rolling segments, segment thread prepares next and retires old */
+	u_int64_t segment_size;
+	glc_utime_t segment_duration, segment_start;
+	file_segment_name_func_t segment_name;
+	void *segment_arg;
+	unsigned int segment;
+	int segment_requested, segment_postponed, segment_failed, segment_delta;
+	glc_utime_t segment_retry;
+	glc_stream_info_t segment_info;
+	char *segment_info_name, *segment_info_date;
+	pthread_t segment_thread;
+	pthread_mutex_t segment_mutex;
+	pthread_cond_t segment_cond;
+	int segment_running, segment_stop, segment_prepare;
+	int segment_next_fd, segment_retire_fd;
+	char *segment_next_name;
+	off_t segment_next_allocated, segment_retire_size, segment_retire_allocated;
+
+#ifdef __URING
+	struct io_uring ring;
+	int uring;
+	char *uring_buffer[FILE_URING_DEPTH];
+	int uring_busy[FILE_URING_DEPTH];
+	off_t uring_busy_offset[FILE_URING_DEPTH];
+	unsigned int uring_index, uring_inflight;
+	off_t uring_offset;
+#endif
 };
 
 void file_finish_callback(void *ptr, int err);
 int file_read_callback(glc_thread_state_t *state);
+int file_write_packet(file_t file, glc_thread_state_t *state);
 int file_write_message(file_t file, glc_message_header_t *header, void *message, size_t message_size);
 int file_write_state_callback(glc_message_header_t *header, void *message, size_t message_size, void *arg);
+int file_write(file_t file, struct iovec *iov, int iovcnt);
+int file_writev_all(int fd, struct iovec *iov, int iovcnt);
+int file_flush(file_t file);
+int file_flush_start(file_t file);
+void file_flush_stop(file_t file);
+void *file_flush_thread(void *argptr);
+void file_set_written(file_t file, off_t written);
+void file_prealloc(file_t file);
+
+off_t file_offset(file_t file);
+int file_index_add(file_t file);
+int file_index_state_callback(glc_message_header_t *header, void *message, size_t message_size, void *arg);
+int file_write_index(file_t file);
+int file_write_marker(file_t file);
+int file_read_footer(file_t file, glc_index_footer_t *footer, off_t *start);
+int file_read_index(file_t file, glc_index_footer_t *footer,
+		    glc_index_entry_t **entries, char **state);
+
+glc_stream_summary_t *file_summary_get(file_t file, glc_message_type_t type,
+				       glc_stream_id_t id);
+int file_summary_add(file_t file, glc_message_header_t *header, char *data, size_t size);
+
+int file_map_source(file_t file);
+void file_unmap_source(file_t file);
+int file_read_data(file_t file, void *data, size_t size);
+
+int file_scan_packet(file_t file, ps_packet_t *packet, glc_message_header_t *header,
+		     size_t size);
+int file_scan_peek(file_t file, glc_message_type_t type, const char *src, size_t size,
+		   int complete, glc_message_header_t *header, char *data, size_t *data_size);
+int file_scan_decompress(file_t file, glc_message_type_t type, const char *src, size_t size,
+			 int complete, size_t orig, char *dst, size_t len);
+int file_scan_decode(file_t file, glc_message_type_t type, const char *src, size_t size,
+		     size_t orig, char *dst, size_t len);
+int file_scan_lz4(const unsigned char *src, size_t size, unsigned char *dst, size_t len);
+int file_skip(file_t file, size_t size);
+
+int file_resync_next(file_t file);
+int file_resync_marker(file_t file, size_t pos, glc_sync_message_t *marker);
+int file_resync_find(file_t file, size_t from, size_t *pos);
+
+int file_sync_start(file_t file);
+void file_sync_stop(file_t file);
+void *file_sync_thread(void *argptr);
+int file_record_durable(file_t file);
+
+int file_open_fd(file_t file, const char *filename, int direct);
+int file_lock_target(file_t file, int fd);
+
+int file_segment_start(file_t file);
+void file_segment_stop(file_t file);
+void *file_segment_thread(void *argptr);
+int file_segment_open(file_t file, unsigned int segment, int *fd, char **filename,
+		      off_t *allocated);
+void file_segment_retire(file_t file, int fd, off_t size, off_t allocated);
+int file_segment_check(file_t file, glc_message_header_t *header, char *data, size_t size);
+int file_segment_key(file_t file, glc_message_header_t *header, char *data, size_t size);
+int file_segment_switch(file_t file);
+
+int file_uring_init(file_t file);
+#ifdef __URING
+void file_uring_destroy(file_t file);
+int file_uring_write(file_t file, struct iovec *iov, int iovcnt);
+int file_uring_submit(file_t file);
+int file_uring_reap(file_t file);
+int file_uring_flush(file_t file);
+#endif
 
 int file_init(file_t *file, glc_t *glc)
 {
@@ -67,6 +271,15 @@ int file_init(file_t *file, glc_t *glc)
 	(*file)->glc = glc;
 	(*file)->fd = -1;
 	(*file)->sync = 0;
+	(*file)->writer_clock = 1;
+	(*file)->segment_next_fd = -1;
+	(*file)->segment_retire_fd = -1;
+	pthread_mutex_init(&(*file)->sync_mutex, NULL);
+	pthread_cond_init(&(*file)->sync_cond, NULL);
+	pthread_mutex_init(&(*file)->segment_mutex, NULL);
+	pthread_cond_init(&(*file)->segment_cond, NULL);
+	pthread_mutex_init(&(*file)->buffer_mutex, NULL);
+	pthread_cond_init(&(*file)->buffer_cond, NULL);
 
 	(*file)->thread.flags = GLC_THREAD_READ;
 	(*file)->thread.ptr = *file;
@@ -82,6 +295,20 @@ int file_init(file_t *file, glc_t *glc)
 int file_destroy(file_t file)
 {
 	tracker_destroy(file->state_tracker);
+	pthread_cond_destroy(&file->sync_cond);
+	pthread_mutex_destroy(&file->sync_mutex);
+	pthread_cond_destroy(&file->segment_cond);
+	pthread_mutex_destroy(&file->segment_mutex);
+	pthread_cond_destroy(&file->buffer_cond);
+	pthread_mutex_destroy(&file->buffer_mutex);
+	free(file->segment_info_name);
+	free(file->segment_info_date);
+	free(file->index);
+	free(file->index_state);
+	free(file->summary);
+	free(file->scan_buffer);
+	free(file->decode_buffer);
+	free(file->buffer);
 	free(file);
 	return 0;
 }
@@ -92,6 +319,65 @@ int file_set_sync(file_t file, int sync)
 	return 0;
 }
 
+int file_set_group_commit(file_t file, size_t size, unsigned int interval)
+{
+	file->sync_size = size;
+	file->sync_interval = interval;
+	return 0;
+}
+
+int file_set_prealloc(file_t file, size_t size)
+{
+	file->prealloc_size = size;
+	return 0;
+}
+
+int file_set_direct(file_t file, int direct)
+{
+	file->direct = direct;
+	return 0;
+}
+
+int file_set_resync(file_t file, size_t interval)
+{
+	file->resync_interval = interval;
+	return 0;
+}
+
+int file_set_writer_clock(file_t file, int clock)
+{
+	file->writer_clock = clock;
+	return 0;
+}
+
+int file_set_decode(file_t file, int decode)
+{
+	file->decode_packets = decode;
+	return 0;
+}
+
+int file_set_scan(file_t file, int scan)
+{
+	file->scan = scan;
+	return 0;
+}
+
+int file_set_durable_only(file_t file, int durable)
+{
+	file->durable_only = durable;
+	return 0;
+}
+
+int file_set_segment(file_t file, u_int64_t size, glc_utime_t duration,
+		     file_segment_name_func_t name, void *arg)
+{
+	file->segment_size = size;
+	file->segment_duration = duration;
+	file->segment_name = name;
+	file->segment_arg = arg;
+	return 0;
+}
+
 int file_set_callback(file_t file, callback_request_func_t callback)
 {
 	file->callback = callback;
@@ -105,29 +391,51 @@ int file_open_target(file_t file, const char *filename)
 		return EBUSY;
 
 	glc_log(file->glc, GLC_INFORMATION, "file",
-		 "opening %s for writing stream (%s)",
+		 "opening %s for writing stream (%s%s)",
 		 filename,
-		 file->sync ? "sync" : "no sync");
+		 file->sync ? "sync" : "no sync",
+		 file->direct ? ", direct" : "");
 
-	fd = open(filename, O_CREAT | O_WRONLY | (file->sync ? O_SYNC : 0), 0644);
-
-	if (fd == -1) {
-		glc_log(file->glc, GLC_ERROR, "file", "can't open %s: %s (%d)",
-			 filename, strerror(errno), errno);
+	if ((fd = file_open_fd(file, filename, file->direct)) == -1)
 		return errno;
-	}
 
-	if ((ret = file_set_target(file, fd)))
+	if ((ret = file_set_target(file, fd))) {
 		close(fd);
+		return ret;
+	}
 
-	return ret;
+	/* O_DIRECT is used only together with io_uring */
+	if ((fcntl(fd, F_GETFL) & O_DIRECT) && (file_uring_init(file))) {
+		if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT) == -1)
+			glc_log(file->glc, GLC_WARNING, "file",
+				 "can't disable direct io: %s (%d)", strerror(errno), errno);
+	}
+
+	return 0;
 }
 
-int file_set_target(file_t file, int fd)
+int file_open_fd(file_t file, const char *filename, int direct)
 {
-	if (file->fd >= 0)
-		return EBUSY;
+	int fd;
+
+	fd = open(filename, O_CREAT | O_WRONLY | (file->sync ? O_SYNC : 0) |
+		  (direct ? O_DIRECT : 0), 0644);
+
+	if ((fd == -1) && (direct) && (errno == EINVAL)) {
+		/* file system doesn't support O_DIRECT */
+		glc_log(file->glc, GLC_WARNING, "file",
+			 "direct io not supported on %s", filename);
+		fd = open(filename, O_CREAT | O_WRONLY | (file->sync ? O_SYNC : 0), 0644);
+	}
+
+	if (fd == -1)
+		glc_log(file->glc, GLC_ERROR, "file", "can't open %s: %s (%d)",
+			 filename, strerror(errno), errno);
+	return fd;
+}
 
+int file_lock_target(file_t file, int fd)
+{
 	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
 		glc_log(file->glc, GLC_ERROR, "file",
 			 "can't lock file: %s (%d)", strerror(errno), errno);
@@ -135,20 +443,102 @@ int file_set_target(file_t file, int fd)
 	}
 
 	/* truncate file when we have locked it */
-	lseek(file->fd, 0, SEEK_SET);
-	ftruncate(file->fd, 0);
+	lseek(fd, 0, SEEK_SET);
+	ftruncate(fd, 0);
+	return 0;
+}
+
+int file_set_target(file_t file, int fd)
+{
+	int ret;
+
+	if (file->fd >= 0)
+		return EBUSY;
+
+	if ((ret = file_lock_target(file, fd)))
+		return ret;
 
 	file->fd = fd;
 	file->flags |= FILE_WRITING;
+	file->written = file->sync_kick = 0;
+	file->durable = file->durable_recorded = 0;
+
+	file->index_count = 0;
+	file->index_state_size = 0;
+	file->index_state_changed = 1;
+	file->summary_count = 0;
+	file->stream_time = 0;
+	file->resync_size = 0;
+	file->resync_crc = 0;
+
+	file->allocated = 0;
+	if (file->prealloc_size)
+		file_prealloc(file);
+
+	if (((file->segment_size) | (file->segment_duration)) && (file->segment_name) &&
+	    (ret = file_segment_start(file)))
+		return ret;
+
+	if ((file->sync_size) | (file->sync_interval))
+		return file_sync_start(file);
 	return 0;
 }
 
 int file_close_target(file_t file)
 {
+	int ret;
 	if ((file->fd < 0) | (file->flags & FILE_RUNNING) |
 	    (!(file->flags & FILE_WRITING)))
 		return EAGAIN;
 
+	/* old segment is closed and unused next segment removed */
+	if (file->segment_running)
+		file_segment_stop(file);
+
+	/* last marker covers end of stream, index is not covered */
+	if ((file->resync_interval) && (file->resync_size) && (ret = file_write_marker(file)))
+		glc_log(file->glc, GLC_ERROR, "file",
+			 "can't write sync marker: %s (%d)", strerror(ret), ret);
+
+	/* index goes after last stream in file */
+	if ((file->index_count) && (ret = file_write_index(file)))
+		glc_log(file->glc, GLC_ERROR, "file",
+			 "can't write index: %s (%d)", strerror(ret), ret);
+
+	if ((ret = file_flush(file)))
+		glc_log(file->glc, GLC_ERROR, "file",
+			 "can't write buffered data: %s (%d)",
+			 strerror(ret), ret);
+	file->buffer_pos = 0;
+	file->buffer_pending = 0;
+
+	/* release preallocated space past end of stream */
+	if ((file->allocated > file->written) && (ftruncate(file->fd, file->written)))
+		glc_log(file->glc, GLC_WARNING, "file",
+			 "can't release preallocated space: %s (%d)", strerror(errno), errno);
+
+	if (file->sync_running) {
+		file_sync_stop(file);
+
+		/* everything is on disk when file is closed */
+		if (fdatasync(file->fd))
+			glc_log(file->glc, GLC_ERROR, "file", "can't sync file: %s (%d)",
+				 strerror(errno), errno);
+		else {
+			file->durable = file->written;
+			if ((!(ret = file_record_durable(file))) && (fdatasync(file->fd)))
+				ret = errno;
+			if (ret)
+				glc_log(file->glc, GLC_ERROR, "file",
+					 "can't record durable size: %s (%d)", strerror(ret), ret);
+		}
+	}
+
+#ifdef __URING
+	if (file->uring)
+		file_uring_destroy(file);
+#endif
+
 	/* try to remove lock */
 	if (flock(file->fd, LOCK_UN) == -1)
 		glc_log(file->glc, GLC_WARNING,
@@ -169,45 +559,949 @@ int file_close_target(file_t file)
 int file_write_info(file_t file, glc_stream_info_t *info,
 		    const char *info_name, const char *info_date)
 {
+	struct iovec iov[3];
+	int ret;
+
 	if ((file->fd < 0) | (file->flags & FILE_RUNNING) |
 	    (!(file->flags & FILE_WRITING)))
 		return EAGAIN;
 
-	if (write(file->fd, info, sizeof(glc_stream_info_t)) != sizeof(glc_stream_info_t))
-		goto err;
-	if (write(file->fd, info_name, info->name_size) != info->name_size)
-		goto err;
-	if (write(file->fd, info_date, info->date_size) != info->date_size)
+	if (file->resync_interval)
+		info->flags |= GLC_STREAM_SYNC_MARKERS;
+	else
+		info->flags &= ~GLC_STREAM_SYNC_MARKERS;
+
+	iov[0].iov_base = info;
+	iov[0].iov_len = sizeof(glc_stream_info_t);
+	iov[1].iov_base = (void *) info_name;
+	iov[1].iov_len = info->name_size;
+	iov[2].iov_base = (void *) info_date;
+	iov[2].iov_len = info->date_size;
+
+	if ((ret = file_write(file, iov, 3)))
 		goto err;
 
+	/* first marker covers packets after stream info */
+	file->resync_size = 0;
+	file->resync_crc = 0;
+
+	/* every segment starts with same stream info */
+	if (file->segment_name) {
+		free(file->segment_info_name);
+		free(file->segment_info_date);
+		file->segment_info = *info;
+		file->segment_info.durable_size = 0;
+		file->segment_info_name = malloc(info->name_size);
+		file->segment_info_date = malloc(info->date_size);
+		memcpy(file->segment_info_name, info_name, info->name_size);
+		memcpy(file->segment_info_date, info_date, info->date_size);
+	}
+
 	file->flags |= FILE_INFO_WRITTEN;
 	return 0;
 err:
 	glc_log(file->glc, GLC_ERROR, "file",
 		 "can't write stream information: %s (%d)",
-		 strerror(errno), errno);
-	return errno;
+		 strerror(ret), ret);
+	return ret;
 }
 
 int file_write_message(file_t file, glc_message_header_t *header, void *message, size_t message_size)
 {
-	glc_size_t glc_size = (glc_size_t) message_size;
+	glc_container_message_header_t container;
+	struct iovec iov[2];
+
+	/* on-disk packet header is the same as container header */
+	container.size = (glc_size_t) message_size;
+	container.header = *header;
+
+	iov[0].iov_base = &container;
+	iov[0].iov_len = sizeof(glc_container_message_header_t);
+	iov[1].iov_base = message;
+	iov[1].iov_len = message_size;
+
+	return file_write(file, iov, message_size > 0 ? 2 : 1);
+}
+
+int file_write(file_t file, struct iovec *iov, int iovcnt)
+{
+	struct iovec vec[FILE_WRITE_IOV_MAX + 1];
+	size_t size = 0;
+	int i, ret;
+
+	if (file->resync_interval) {
+		for (i = 0; i < iovcnt; i++) {
+			file->resync_crc = glc_util_crc32c(file->resync_crc, iov[i].iov_base,
+							   iov[i].iov_len);
+			file->resync_size += iov[i].iov_len;
+		}
+	}
+
+	/* flush thread writes data that has waited too long */
+	if (!file->buffer_pending) {
+		file->buffer_pending = 1;
+		file->buffer_time = glc_time(file->glc);
+		if (file->flush_running)
+			pthread_cond_signal(&file->buffer_cond);
+	}
+
+#ifdef __URING
+	if (file->uring)
+		return file_uring_write(file, iov, iovcnt);
+#endif
+
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
+
+	if (!file->buffer) {
+		if ((ret = posix_memalign((void **) &file->buffer, FILE_WRITE_BUFFER_ALIGN,
+					  FILE_WRITE_BUFFER_SIZE)))
+			return ret;
+	}
+
+	if (file->buffer_pos + size <= FILE_WRITE_BUFFER_SIZE) {
+		/* small packets are gathered into write-behind buffer */
+		for (i = 0; i < iovcnt; i++) {
+			memcpy(&file->buffer[file->buffer_pos], iov[i].iov_base, iov[i].iov_len);
+			file->buffer_pos += iov[i].iov_len;
+		}
+
+		if ((file->buffer_pos == FILE_WRITE_BUFFER_SIZE) ||
+		    (glc_time(file->glc) - file->buffer_time >= FILE_WRITE_BUFFER_TIME))
+			return file_flush(file);
+		return 0;
+	}
+
+	/* write buffered data and this packet with a single call */
+	vec[0].iov_base = file->buffer;
+	vec[0].iov_len = file->buffer_pos;
+	for (i = 0; i < iovcnt; i++)
+		vec[i + 1] = iov[i];
+
+	if ((ret = file_writev_all(file->fd, vec, iovcnt + 1)))
+		return ret;
+
+	file_set_written(file, file->written + file->buffer_pos + size);
+	file->buffer_pos = 0;
+	file->buffer_pending = 0;
+	return 0;
+}
+
+int file_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t ret;
+
+	while (iovcnt > 0) {
+		if ((ret = writev(fd, iov, iovcnt)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+
+		/* skip what was written */
+		while ((iovcnt > 0) && ((size_t) ret >= iov->iov_len)) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = (char *) iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+int file_flush(file_t file)
+{
+	struct iovec iov;
+	int ret;
+
+#ifdef __URING
+	if (file->uring) {
+		if ((ret = file_uring_flush(file)))
+			return ret;
+		file->buffer_pending = 0;
+		return 0;
+	}
+#endif
+
+	if (!file->buffer_pos) {
+		file->buffer_pending = 0;
+		return 0;
+	}
+
+	iov.iov_base = file->buffer;
+	iov.iov_len = file->buffer_pos;
+
+	if ((ret = file_writev_all(file->fd, &iov, 1)))
+		return ret;
+
+	file_set_written(file, file->written + file->buffer_pos);
+	file->buffer_pos = 0;
+	file->buffer_pending = 0;
+	return 0;
+}
+
+int file_flush_start(file_t file)
+{
+	int ret;
+
+	file->flush_stop = 0;
+	if ((ret = pthread_create(&file->flush_thread, NULL, &file_flush_thread, file))) {
+		glc_log(file->glc, GLC_ERROR, "file",
+			 "can't create flush thread: %s (%d)", strerror(ret), ret);
+		return ret;
+	}
+
+	file->flush_running = 1;
+	return 0;
+}
+
+void file_flush_stop(file_t file)
+{
+	pthread_mutex_lock(&file->buffer_mutex);
+	file->flush_stop = 1;
+	pthread_cond_signal(&file->buffer_cond);
+	pthread_mutex_unlock(&file->buffer_mutex);
+
+	pthread_join(file->flush_thread, NULL);
+	file->flush_running = 0;
+}
+
+void *file_flush_thread(void *argptr)
+{
+	file_t file = (file_t) argptr;
+	struct timespec ts;
+	glc_utime_t age;
+	int ret;
+
+	pthread_mutex_lock(&file->buffer_mutex);
+	while (!file->flush_stop) {
+		if (!file->buffer_pending) {
+			pthread_cond_wait(&file->buffer_cond, &file->buffer_mutex);
+			continue;
+		}
+
+		/* writer thread holds the lock while it writes packets */
+		age = glc_time(file->glc) - file->buffer_time;
+		if (age >= FILE_WRITE_BUFFER_TIME) {
+			if ((ret = file_flush(file))) {
+				glc_log(file->glc, GLC_ERROR, "file",
+					 "can't write buffered data: %s (%d)", strerror(ret), ret);
+				break;
+			}
+			continue;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += (FILE_WRITE_BUFFER_TIME - age) * 1000;
+		ts.tv_sec += ts.tv_nsec / 1000000000;
+		ts.tv_nsec %= 1000000000;
+		pthread_cond_timedwait(&file->buffer_cond, &file->buffer_mutex, &ts);
+	}
+	pthread_mutex_unlock(&file->buffer_mutex);
+
+	return NULL;
+}
+
+void file_set_written(file_t file, off_t written)
+{
+	int ret;
+
+	if (!file->sync_running) {
+		if (written > file->written)
+			file->written = written;
+		if (file->prealloc_size)
+			file_prealloc(file);
+		return;
+	}
+
+	pthread_mutex_lock(&file->sync_mutex);
+	if (written > file->written)
+		file->written = written;
+	if ((file->sync_size) &&
+	    (file->written - file->durable >= (off_t) file->sync_size))
+		pthread_cond_signal(&file->sync_cond);
+	pthread_mutex_unlock(&file->sync_mutex);
+
+	/* start writeback early so that dirty pages don't pile up */
+	if (file->written - file->sync_kick >= FILE_SYNC_KICK_SIZE) {
+		sync_file_range(file->fd, file->sync_kick, file->written - file->sync_kick,
+				SYNC_FILE_RANGE_WRITE);
+		file->sync_kick = file->written;
+	}
+
+	if ((ret = file_record_durable(file)))
+		glc_log(file->glc, GLC_WARNING, "file",
+			 "can't record durable size: %s (%d)", strerror(ret), ret);
+
+	if (file->prealloc_size)
+		file_prealloc(file);
+}
+
+void file_prealloc(file_t file)
+{
+	off_t size;
+
+	/* stay at least half a chunk ahead of write offset */
+	if (file->written + (off_t) file->prealloc_size / 2 < file->allocated)
+		return;
+
+	size = file->prealloc_size;
+	while (file->allocated + size <= file->written + (off_t) file->prealloc_size / 2)
+		size += file->prealloc_size;
+
+	/* file size doesn't change, so readers never see the extra space */
+	if (fallocate(file->fd, FALLOC_FL_KEEP_SIZE, file->allocated, size)) {
+		glc_log(file->glc, GLC_WARNING, "file",
+			 "can't preallocate space: %s (%d)", strerror(errno), errno);
+		file->prealloc_size = 0;
+		return;
+	}
+
+	file->allocated += size;
+}
+
+int file_sync_start(file_t file)
+{
+	int ret;
+
+	file->sync_stop = 0;
+	if ((ret = pthread_create(&file->sync_thread, NULL, &file_sync_thread, file))) {
+		glc_log(file->glc, GLC_ERROR, "file",
+			 "can't create sync thread: %s (%d)", strerror(ret), ret);
+		return ret;
+	}
+
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "group commit every %zu MiB or %u ms",
+		 file->sync_size / (1024 * 1024), file->sync_interval);
+	file->sync_running = 1;
+	return 0;
+}
+
+void file_sync_stop(file_t file)
+{
+	pthread_mutex_lock(&file->sync_mutex);
+	file->sync_stop = 1;
+	pthread_cond_signal(&file->sync_cond);
+	pthread_mutex_unlock(&file->sync_mutex);
+
+	pthread_join(file->sync_thread, NULL);
+	file->sync_running = 0;
+}
+
+void *file_sync_thread(void *argptr)
+{
+	file_t file = (file_t) argptr;
+	struct timespec ts;
+	off_t written;
+	unsigned int segment;
+	int fd, timeout, ret;
+
+	pthread_mutex_lock(&file->sync_mutex);
+	while (!file->sync_stop) {
+		timeout = 0;
+		if (file->sync_interval) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += file->sync_interval / 1000;
+			ts.tv_nsec += (file->sync_interval % 1000) * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			timeout = (pthread_cond_timedwait(&file->sync_cond, &file->sync_mutex,
+							  &ts) == ETIMEDOUT);
+		} else
+			pthread_cond_wait(&file->sync_cond, &file->sync_mutex);
+
+		if (file->sync_stop)
+			break;
+		if ((!timeout) && ((!file->sync_size) ||
+				   (file->written - file->durable < (off_t) file->sync_size)))
+			continue;
+		if (file->written == file->durable)
+			continue;
+
+		/* one sync commits everything written so far */
+		written = file->written;
+		fd = file->fd;
+		segment = file->segment;
+		pthread_mutex_unlock(&file->sync_mutex);
+		ret = fdatasync(fd) ? errno : 0;
+		pthread_mutex_lock(&file->sync_mutex);
+
+		/* segment was switched meanwhile, old one is synced when closed */
+		if (segment != file->segment)
+			continue;
+
+		if (ret)
+			glc_log(file->glc, GLC_ERROR, "file", "can't sync file: %s (%d)",
+				 strerror(ret), ret);
+		else
+			file->durable = written;
+	}
+	pthread_mutex_unlock(&file->sync_mutex);
+
+	return NULL;
+}
+
+int file_record_durable(file_t file)
+{
+	u_int64_t durable;
+	ssize_t ret;
+#ifdef __URING
+	int flags = 0;
+#endif
+
+	pthread_mutex_lock(&file->sync_mutex);
+	durable = file->durable;
+	pthread_mutex_unlock(&file->sync_mutex);
+
+	/*
+	 Stream info header is rewritten in place. It becomes durable
+	 with next sync, so on-disk value never exceeds what really is
+	 on disk.
+	*/
+	if ((durable == file->durable_recorded) ||
+	    (file->written < (off_t) sizeof(glc_stream_info_t)))
+		return 0;
+
+#ifdef __URING
+	if (file->uring) {
+		/* header may still be in first buffer */
+		if (file->uring_offset == 0)
+			memcpy(&file->uring_buffer[file->uring_index][offsetof(glc_stream_info_t, durable_size)],
+			       &durable, sizeof(u_int64_t));
+
+		flags = fcntl(file->fd, F_GETFL);
+		if (fcntl(file->fd, F_SETFL, flags & ~O_DIRECT) == -1)
+			return errno;
+	}
+#endif
+
+	ret = pwrite(file->fd, &durable, sizeof(u_int64_t),
+		     offsetof(glc_stream_info_t, durable_size));
+
+#ifdef __URING
+	if (file->uring)
+		fcntl(file->fd, F_SETFL, flags);
+#endif
+
+	if (ret != sizeof(u_int64_t))
+		return ret == -1 ? errno : EIO;
+
+	file->durable_recorded = durable;
+	return 0;
+}
+
+int file_segment_start(file_t file)
+{
+	int ret;
+
+	file->segment_stop = file->segment_prepare = 0;
+	file->segment_requested = file->segment_postponed = 0;
+	file->segment_failed = file->segment_delta = 0;
+	file->segment_start = file->segment_retry = 0;
+	file->segment = 0;
+	if ((ret = pthread_create(&file->segment_thread, NULL, &file_segment_thread, file))) {
+		glc_log(file->glc, GLC_ERROR, "file",
+			 "can't create segment thread: %s (%d)", strerror(ret), ret);
+		return ret;
+	}
+
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "new segment every %llu MiB or %llu s",
+		 (unsigned long long) file->segment_size / (1024 * 1024),
+		 (unsigned long long) file->segment_duration / 1000000);
+	file->segment_running = 1;
+	return 0;
+}
+
+void file_segment_stop(file_t file)
+{
+	pthread_mutex_lock(&file->segment_mutex);
+	file->segment_stop = 1;
+	pthread_cond_signal(&file->segment_cond);
+	pthread_mutex_unlock(&file->segment_mutex);
+
+	pthread_join(file->segment_thread, NULL);
+	file->segment_running = 0;
+
+	/* next segment was never written to */
+	if (file->segment_next_fd >= 0) {
+		flock(file->segment_next_fd, LOCK_UN);
+		close(file->segment_next_fd);
+		if (unlink(file->segment_next_name))
+			glc_log(file->glc, GLC_WARNING, "file", "can't remove %s: %s (%d)",
+				 file->segment_next_name, strerror(errno), errno);
+		file->segment_next_fd = -1;
+	}
+	free(file->segment_next_name);
+	file->segment_next_name = NULL;
+}
+
+void *file_segment_thread(void *argptr)
+{
+	file_t file = (file_t) argptr;
+	off_t size, allocated;
+	unsigned int segment;
+	char *filename;
+	int fd, ret;
+
+	pthread_mutex_lock(&file->segment_mutex);
+	for (;;) {
+		if (file->segment_retire_fd >= 0) {
+			/* old segment is closed before next one is prepared */
+			fd = file->segment_retire_fd;
+			size = file->segment_retire_size;
+			allocated = file->segment_retire_allocated;
+			pthread_mutex_unlock(&file->segment_mutex);
+			file_segment_retire(file, fd, size, allocated);
+			pthread_mutex_lock(&file->segment_mutex);
+			file->segment_retire_fd = -1;
+		} else if (file->segment_stop)
+			break;
+		else if ((file->segment_prepare) && (file->segment_next_fd < 0)) {
+			file->segment_prepare = 0;
+			segment = file->segment + 1;
+			pthread_mutex_unlock(&file->segment_mutex);
+			ret = file_segment_open(file, segment, &fd, &filename, &allocated);
+			pthread_mutex_lock(&file->segment_mutex);
+
+			if (ret) {
+				glc_log(file->glc, GLC_ERROR, "file",
+					 "can't prepare next segment: %s (%d)", strerror(ret), ret);
+				/* writer asks again */
+				file->segment_failed = 1;
+				continue;
+			}
+
+			free(file->segment_next_name);
+			file->segment_next_name = filename;
+			file->segment_next_allocated = allocated;
+			file->segment_next_fd = fd;
+		} else
+			pthread_cond_wait(&file->segment_cond, &file->segment_mutex);
+	}
+	pthread_mutex_unlock(&file->segment_mutex);
+
+	return NULL;
+}
+
+int file_segment_open(file_t file, unsigned int segment, int *fd, char **filename,
+		      off_t *allocated)
+{
+	int direct = 0, ret;
+
+#ifdef __URING
+	/* io_uring writes need O_DIRECT also in next segment */
+	direct = file->uring;
+#endif
 
-	if (write(file->fd, &glc_size, sizeof(glc_size_t)) != sizeof(glc_size_t))
+	if (!(*filename = file->segment_name(file->segment_arg, segment)))
+		return ENOMEM;
+
+	if ((*fd = file_open_fd(file, *filename, direct)) == -1) {
+		ret = errno;
 		goto err;
-	if (write(file->fd, header, sizeof(glc_message_header_t))
-		!= sizeof(glc_message_header_t))
+	}
+
+	if ((ret = file_lock_target(file, *fd))) {
+		close(*fd);
 		goto err;
-	if (message_size > 0) {
-		if (write(file->fd, message, message_size) != message_size)
-			goto err;
 	}
 
+	/* first chunk is reserved now, rest as stream grows */
+	*allocated = 0;
+	if (file->prealloc_size) {
+		if (fallocate(*fd, FALLOC_FL_KEEP_SIZE, 0, file->prealloc_size))
+			glc_log(file->glc, GLC_WARNING, "file",
+				 "can't preallocate space: %s (%d)", strerror(errno), errno);
+		else
+			*allocated = file->prealloc_size;
+	}
+
+	glc_log(file->glc, GLC_INFORMATION, "file", "prepared next segment %s", *filename);
 	return 0;
 err:
-	return errno;
+	free(*filename);
+	*filename = NULL;
+	return ret;
+}
+
+void file_segment_retire(file_t file, int fd, off_t size, off_t allocated)
+{
+	u_int64_t durable = size;
+
+	/* release preallocated space past end of stream */
+	if ((allocated > size) && (ftruncate(fd, size)))
+		glc_log(file->glc, GLC_WARNING, "file",
+			 "can't release preallocated space: %s (%d)", strerror(errno), errno);
+
+	if (file->sync_running) {
+		/* everything is on disk when segment is closed */
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+		if ((fdatasync(fd)) ||
+		    (pwrite(fd, &durable, sizeof(u_int64_t),
+			    offsetof(glc_stream_info_t, durable_size)) != sizeof(u_int64_t)) ||
+		    (fdatasync(fd)))
+			glc_log(file->glc, GLC_ERROR, "file", "can't sync segment: %s (%d)",
+				 strerror(errno), errno);
+	}
+
+	if (flock(fd, LOCK_UN) == -1)
+		glc_log(file->glc, GLC_WARNING,
+			 "file", "can't unlock file: %s (%d)",
+			 strerror(errno), errno);
+
+	if (close(fd))
+		glc_log(file->glc, GLC_ERROR, "file",
+			 "can't close file: %s (%d)",
+			 strerror(errno), errno);
+}
+
+int file_segment_check(file_t file, glc_message_header_t *header, char *data, size_t size)
+{
+	/* next segment is opened as soon as current one has started */
+	if (!file->segment_requested) {
+		pthread_mutex_lock(&file->segment_mutex);
+		file->segment_prepare = 1;
+		pthread_cond_signal(&file->segment_cond);
+		pthread_mutex_unlock(&file->segment_mutex);
+		file->segment_requested = 1;
+	}
+
+	if (!file->segment_start)
+		file->segment_start = file->stream_time;
+
+	if (((file->segment_size) && ((u_int64_t) file_offset(file) >= file->segment_size)) ||
+	    ((file->segment_duration) &&
+	     (file->stream_time - file->segment_start >= file->segment_duration))) {
+		/* delta frames can't be restored without preceding key frame */
+		if ((file->segment_delta) && (!file_segment_key(file, header, data, size)))
+			return 0;
+		return file_segment_switch(file);
+	}
+	return 0;
+}
+
+int file_segment_key(file_t file, glc_message_header_t *header, char *data, size_t size)
+{
+	glc_message_header_t orig;
+	char peek[FILE_SCAN_HEADER];
+	size_t peek_size;
+	int ret;
+
+	if ((header->type == GLC_MESSAGE_CLOSE) | (header->type == GLC_MESSAGE_SYNC))
+		return 0;
+
+	/* key frames have their own type, codec headers show it without decoding */
+	ret = file_scan_peek(file, header->type, data, size, 1, &orig, peek, &peek_size);
+	if ((ret) && (ret != ENOTSUP))
+		return 0;
+
+	return orig.type == GLC_MESSAGE_VIDEO_DELTA_KEY;
+}
+
+int file_segment_switch(file_t file)
+{
+	glc_message_header_t header;
+	struct iovec iov[3];
+	off_t written, allocated;
+	int fd, ret;
+
+	pthread_mutex_lock(&file->segment_mutex);
+	fd = file->segment_next_fd;
+	allocated = file->segment_next_allocated;
+	file->segment_next_fd = -1;
+
+	/* preparing failed, ask again now and then */
+	if ((fd < 0) && (file->segment_failed) &&
+	    (file->stream_time >= file->segment_retry + FILE_SEGMENT_RETRY)) {
+		file->segment_failed = 0;
+		file->segment_prepare = 1;
+		file->segment_retry = file->stream_time;
+		pthread_cond_signal(&file->segment_cond);
+	}
+	pthread_mutex_unlock(&file->segment_mutex);
+
+	/* keep writing current segment until next one is ready */
+	if (fd < 0) {
+		if (!file->segment_postponed)
+			glc_log(file->glc, GLC_WARNING, "file",
+				 "next segment is not ready, switch postponed");
+		file->segment_postponed = 1;
+		return 0;
+	}
+	file->segment_postponed = 0;
+
+	/* current segment is finished like a closed file, but only written here */
+	header.type = GLC_MESSAGE_CLOSE;
+	if ((ret = file_write_message(file, &header, NULL, 0)))
+		goto err;
+	if ((file->resync_interval) && (file->resync_size) && (ret = file_write_marker(file)))
+		goto err;
+	if ((file->index_count) && (ret = file_write_index(file)))
+		goto err;
+	if ((ret = file_flush(file)))
+		goto err;
+
+	/* sync thread follows file descriptor */
+	pthread_mutex_lock(&file->sync_mutex);
+	written = file->written;
+	file->written = file->sync_kick = 0;
+	file->durable = file->durable_recorded = 0;
+	pthread_mutex_lock(&file->segment_mutex);
+	file->segment++;
+	file->segment_retire_fd = file->fd;
+	file->segment_retire_size = written;
+	file->segment_retire_allocated = file->allocated;
+	file->segment_prepare = 1;
+	pthread_cond_signal(&file->segment_cond);
+	pthread_mutex_unlock(&file->segment_mutex);
+	file->fd = fd;
+	pthread_mutex_unlock(&file->sync_mutex);
+
+	file->allocated = allocated;
+#ifdef __URING
+	/* tail was already written, next buffer starts new segment */
+	if (file->uring) {
+		file->uring_offset = 0;
+		file->buffer_pos = 0;
+	}
+#endif
+
+	file->index_count = 0;
+	file->index_state_size = 0;
+	file->index_state_changed = 1;
+	file->summary_count = 0;
+	file->segment_start = file->stream_time;
+
+	/* new segment is a complete stream */
+	iov[0].iov_base = &file->segment_info;
+	iov[0].iov_len = sizeof(glc_stream_info_t);
+	iov[1].iov_base = file->segment_info_name;
+	iov[1].iov_len = file->segment_info.name_size;
+	iov[2].iov_base = file->segment_info_date;
+	iov[2].iov_len = file->segment_info.date_size;
+	if ((ret = file_write(file, iov, 3)))
+		return ret;
+
+	file->resync_size = 0;
+	file->resync_crc = 0;
+
+	if ((ret = tracker_iterate_state(file->state_tracker, &file_write_state_callback, file)))
+		return ret;
+
+	glc_log(file->glc, GLC_INFORMATION, "file", "switched to segment %u", file->segment);
+	return 0;
+err:
+	/* leave next segment for file_close_target() */
+	pthread_mutex_lock(&file->segment_mutex);
+	file->segment_next_fd = fd;
+	pthread_mutex_unlock(&file->segment_mutex);
+	return ret;
+}
+
+int file_uring_init(file_t file)
+{
+#ifdef __URING
+	int i, ret;
+
+	if ((ret = -io_uring_queue_init(FILE_URING_DEPTH, &file->ring, 0))) {
+		glc_log(file->glc, GLC_WARNING, "file",
+			 "io_uring not available: %s (%d)", strerror(ret), ret);
+		return ret;
+	}
+
+	for (i = 0; i < FILE_URING_DEPTH; i++) {
+		if ((ret = posix_memalign((void **) &file->uring_buffer[i], FILE_WRITE_BUFFER_ALIGN,
+					  FILE_WRITE_BUFFER_SIZE))) {
+			file->uring_buffer[i] = NULL;
+			file_uring_destroy(file);
+			return ret;
+		}
+		file->uring_busy[i] = 0;
+	}
+
+	file->uring_index = 0;
+	file->uring_inflight = 0;
+	file->uring_offset = 0;
+	file->uring = 1;
+
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "writing with io_uring and O_DIRECT, %d writes in flight",
+		 FILE_URING_DEPTH);
+	return 0;
+#else
+	glc_log(file->glc, GLC_WARNING, "file",
+		 "direct io requires io_uring support");
+	return ENOTSUP;
+#endif
+}
+
+#ifdef __URING
+void file_uring_destroy(file_t file)
+{
+	unsigned int inflight;
+	int i, ret;
+
+	while (file->uring_inflight) {
+		inflight = file->uring_inflight;
+		/* failed wait reaps nothing and would fail again */
+		if ((ret = file_uring_reap(file)) && (file->uring_inflight == inflight)) {
+			glc_log(file->glc, GLC_ERROR, "file",
+				 "can't wait for %u writes in flight: %s (%d)",
+				 inflight, strerror(ret), ret);
+			break;
+		}
+	}
+
+	/* tearing down the ring cancels whatever is left */
+	io_uring_queue_exit(&file->ring);
+	for (i = 0; i < FILE_URING_DEPTH; i++) {
+		free(file->uring_buffer[i]);
+		file->uring_buffer[i] = NULL;
+		file->uring_busy[i] = 0;
+	}
+
+	file->uring_inflight = 0;
+	file->uring = 0;
 }
 
+int file_uring_write(file_t file, struct iovec *iov, int iovcnt)
+{
+	size_t len, pos;
+	int i, ret;
+
+	/* O_DIRECT needs aligned memory, so everything goes through buffers */
+	for (i = 0; i < iovcnt; i++) {
+		for (pos = 0; pos < iov[i].iov_len; pos += len) {
+			len = FILE_WRITE_BUFFER_SIZE - file->buffer_pos;
+			if (len > iov[i].iov_len - pos)
+				len = iov[i].iov_len - pos;
+
+			memcpy(&file->uring_buffer[file->uring_index][file->buffer_pos],
+			       (char *) iov[i].iov_base + pos, len);
+			file->buffer_pos += len;
+
+			if (file->buffer_pos == FILE_WRITE_BUFFER_SIZE) {
+				if ((ret = file_uring_submit(file)))
+					return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int file_uring_submit(file_t file)
+{
+	struct io_uring_sqe *sqe;
+	int ret;
+
+	/* full buffer is always aligned, so is the offset */
+	if (!(sqe = io_uring_get_sqe(&file->ring)))
+		return EBUSY;
+	io_uring_prep_write(sqe, file->fd, file->uring_buffer[file->uring_index],
+			    FILE_WRITE_BUFFER_SIZE, file->uring_offset);
+	io_uring_sqe_set_data(sqe, (void *) (unsigned long) file->uring_index);
+
+	if ((ret = io_uring_submit(&file->ring)) < 0)
+		return -ret;
+
+	file->uring_busy[file->uring_index] = 1;
+	file->uring_busy_offset[file->uring_index] = file->uring_offset;
+	file->uring_inflight++;
+	file->uring_offset += FILE_WRITE_BUFFER_SIZE;
+	file->buffer_pos = 0;
+
+	/* wait until next buffer is free */
+	file->uring_index = (file->uring_index + 1) % FILE_URING_DEPTH;
+	while (file->uring_busy[file->uring_index]) {
+		if ((ret = file_uring_reap(file)))
+			return ret;
+	}
+
+	return 0;
+}
+
+int file_uring_reap(file_t file)
+{
+	struct io_uring_cqe *cqe;
+	unsigned long index;
+	off_t written;
+	int i, ret;
+
+	if ((ret = -io_uring_wait_cqe(&file->ring, &cqe))) {
+		if (ret == EINTR)
+			return 0;
+		return ret;
+	}
+
+	index = (unsigned long) io_uring_cqe_get_data(cqe);
+	if (cqe->res < 0)
+		ret = -cqe->res;
+	else if (cqe->res != FILE_WRITE_BUFFER_SIZE)
+		ret = ENOSPC; /* short direct write, device is full */
+	io_uring_cqe_seen(&file->ring, cqe);
+
+	file->uring_busy[index] = 0;
+	file->uring_inflight--;
+
+	/* everything before oldest write in flight has been written */
+	written = file->uring_offset;
+	for (i = 0; i < FILE_URING_DEPTH; i++) {
+		if ((file->uring_busy[i]) && (file->uring_busy_offset[i] < written))
+			written = file->uring_busy_offset[i];
+	}
+	if (!ret)
+		file_set_written(file, written);
+
+	return ret;
+}
+
+int file_uring_flush(file_t file)
+{
+	struct iovec iov;
+	int ret, flags;
+
+	while (file->uring_inflight) {
+		if ((ret = file_uring_reap(file)))
+			return ret;
+	}
+
+	if (!file->buffer_pos)
+		return 0;
+
+	/*
+	 Unaligned tail is written through page cache. It stays in the
+	 buffer and is written again with O_DIRECT once the buffer fills.
+	*/
+	flags = fcntl(file->fd, F_GETFL);
+	if (fcntl(file->fd, F_SETFL, flags & ~O_DIRECT) == -1)
+		return errno;
+
+	iov.iov_base = file->uring_buffer[file->uring_index];
+	iov.iov_len = file->buffer_pos;
+	if (lseek(file->fd, file->uring_offset, SEEK_SET) == (off_t) -1)
+		ret = errno;
+	else
+		ret = file_writev_all(file->fd, &iov, 1);
+
+	if (fcntl(file->fd, F_SETFL, flags) == -1)
+		return errno;
+
+	if (!ret)
+		file_set_written(file, file->uring_offset + file->buffer_pos);
+	return ret;
+}
+#endif
+
 int file_write_eof(file_t file)
 {
 	int ret;
@@ -234,27 +1528,306 @@ err:
 int file_write_state_callback(glc_message_header_t *header, void *message, size_t message_size, void *arg)
 {
 	file_t file = arg;
-	return file_write_message(file, header, message, message_size);
+	int ret;
+
+	if ((ret = file_write_message(file, header, message, message_size)))
+		return ret;
+	return file_summary_add(file, header, message, message_size);
 }
 
 int file_write_state(file_t file)
 {
 	int ret;
-	if ((file->fd < 0) | (file->flags & FILE_RUNNING) |
-	    (!(file->flags & FILE_WRITING))) {
-	    ret = EAGAIN;
-	    goto err;
-	}
+	if ((file->fd < 0) | (file->flags & FILE_RUNNING) |
+	    (!(file->flags & FILE_WRITING))) {
+	    ret = EAGAIN;
+	    goto err;
+	}
+
+	if ((ret = tracker_iterate_state(file->state_tracker, &file_write_state_callback, file)))
+		goto err;
+
+	return 0;
+err:
+	glc_log(file->glc, GLC_ERROR, "file",
+		 "can't write state: %s (%d)",
+		 strerror(ret), ret);
+	return ret;
+}
+
+off_t file_offset(file_t file)
+{
+#ifdef __URING
+	if (file->uring)
+		return file->uring_offset + file->buffer_pos;
+#endif
+	return file->written + file->buffer_pos;
+}
+
+int file_index_add(file_t file)
+{
+	glc_index_entry_t *entry;
+	glc_utime_t time = file->stream_time;
+	u_int64_t state = 0;
+	int ret;
+
+	if (file->index_count) {
+		entry = &file->index[file->index_count - 1];
+		if (time < entry->time + FILE_INDEX_INTERVAL)
+			return 0;
+		state = entry->state;
+	}
+
+	if (file->index_count == file->index_alloc) {
+		file->index_alloc = file->index_alloc ? file->index_alloc * 2 : 1024;
+		if (!(entry = realloc(file->index, sizeof(glc_index_entry_t) * file->index_alloc)))
+			return ENOMEM;
+		file->index = entry;
+	}
+
+	/* snapshot is taken only when state has changed */
+	if (file->index_state_changed) {
+		state = file->index_state_size;
+		if ((ret = tracker_iterate_state(file->state_tracker,
+						 &file_index_state_callback, file)))
+			return ret;
+		if ((ret = file_index_state_callback(NULL, NULL, 0, file)))
+			return ret;
+		file->index_state_changed = 0;
+	}
+
+	/*
+	 No packet already written is newer than stream time, so
+	 seeking to this time or later can start here.
+	*/
+	entry = &file->index[file->index_count++];
+	entry->time = time;
+	entry->offset = file_offset(file);
+	entry->state = state;
+	return 0;
+}
+
+int file_index_state_callback(glc_message_header_t *header, void *message, size_t message_size, void *arg)
+{
+	file_t file = arg;
+	glc_container_message_header_t container;
+	size_t size = sizeof(glc_container_message_header_t) + message_size;
+	char *state;
+
+	if (file->index_state_size + size > file->index_state_alloc) {
+		file->index_state_alloc += size > 4096 ? size : 4096;
+		if (!(state = realloc(file->index_state, file->index_state_alloc)))
+			return ENOMEM;
+		file->index_state = state;
+	}
+
+	/* snapshot is terminated with a close message */
+	container.size = (glc_size_t) message_size;
+	if (header)
+		container.header = *header;
+	else
+		container.header.type = GLC_MESSAGE_CLOSE;
+
+	memcpy(&file->index_state[file->index_state_size], &container,
+	       sizeof(glc_container_message_header_t));
+	if (message_size)
+		memcpy(&file->index_state[file->index_state_size +
+					  sizeof(glc_container_message_header_t)],
+		       message, message_size);
+	file->index_state_size += size;
+	return 0;
+}
+
+int file_write_index(file_t file)
+{
+	glc_index_footer_t footer;
+	struct iovec iov[4];
+	int ret;
+
+	footer.signature = GLC_INDEX_SIGNATURE;
+	footer.count = file->index_count;
+	footer.summary_count = file->summary_count;
+	footer.state_size = file->index_state_size;
+	footer.size = sizeof(glc_index_entry_t) * file->index_count +
+		      file->index_state_size +
+		      sizeof(glc_stream_summary_t) * file->summary_count +
+		      sizeof(glc_index_footer_t);
+
+	iov[0].iov_base = file->index;
+	iov[0].iov_len = sizeof(glc_index_entry_t) * file->index_count;
+	iov[1].iov_base = file->index_state;
+	iov[1].iov_len = file->index_state_size;
+	iov[2].iov_base = file->summary;
+	iov[2].iov_len = sizeof(glc_stream_summary_t) * file->summary_count;
+	iov[3].iov_base = &footer;
+	iov[3].iov_len = sizeof(glc_index_footer_t);
+
+	if ((ret = file_write(file, iov, 4)))
+		return ret;
+
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "wrote index with %u entries and summary of %u streams",
+		 file->index_count, file->summary_count);
+	file->index_count = 0;
+	file->summary_count = 0;
+	return 0;
+}
+
+int file_write_marker(file_t file)
+{
+	glc_message_header_t header;
+	glc_sync_message_t marker;
+	int ret;
+
+	header.type = GLC_MESSAGE_SYNC;
+	marker.signature = GLC_SYNC_SIGNATURE;
+	marker.size = file->resync_size;
+	marker.crc = file->resync_crc;
+	marker.check = glc_util_crc32c(0, &marker, offsetof(glc_sync_message_t, check));
+
+	if ((ret = file_write_message(file, &header, &marker, sizeof(glc_sync_message_t))))
+		return ret;
+
+	/* next marker covers packets after this one */
+	file->resync_size = 0;
+	file->resync_crc = 0;
+	return 0;
+}
+
+glc_stream_summary_t *file_summary_get(file_t file, glc_message_type_t type,
+				       glc_stream_id_t id)
+{
+	glc_stream_summary_t *summary;
+	unsigned int i;
+
+	for (i = 0; i < file->summary_count; i++) {
+		if ((file->summary[i].type == type) && (file->summary[i].id == id))
+			return &file->summary[i];
+	}
+
+	if (file->summary_count == file->summary_alloc) {
+		file->summary_alloc = file->summary_alloc ? file->summary_alloc * 2 : 8;
+		if (!(summary = realloc(file->summary,
+					sizeof(glc_stream_summary_t) * file->summary_alloc)))
+			return NULL;
+		file->summary = summary;
+	}
+
+	summary = &file->summary[file->summary_count++];
+	memset(summary, 0, sizeof(glc_stream_summary_t));
+	summary->type = type;
+	summary->id = id;
+	return summary;
+}
+
+int file_summary_add(file_t file, glc_message_header_t *header, char *data, size_t size)
+{
+	glc_stream_summary_t *summary;
+	glc_video_format_message_t *video_format;
+	glc_audio_format_message_t *audio_format;
+	glc_video_frame_header_t frame;
+	glc_audio_data_header_t audio;
+	glc_message_header_t orig;
+	char peek[FILE_SCAN_HEADER];
+	size_t peek_size = 0;
+	glc_stream_id_t id;
+	glc_utime_t time;
+	int ret;
 
-	if ((ret = tracker_iterate_state(file->state_tracker, &file_write_state_callback, file)))
-		goto err;
+	if (header->type == GLC_MESSAGE_VIDEO_FORMAT) {
+		video_format = (glc_video_format_message_t *) data;
+		if (!(summary = file_summary_get(file, GLC_MESSAGE_VIDEO_FORMAT, video_format->id)))
+			return ENOMEM;
+
+		if (((summary->width) | (summary->height)) &&
+		    ((summary->width != video_format->width) |
+		     (summary->height != video_format->height)))
+			summary->changes++;
+		summary->width = video_format->width;
+		summary->height = video_format->height;
+	} else if (header->type == GLC_MESSAGE_AUDIO_FORMAT) {
+		audio_format = (glc_audio_format_message_t *) data;
+		if (!(summary = file_summary_get(file, GLC_MESSAGE_AUDIO_FORMAT, audio_format->id)))
+			return ENOMEM;
+
+		if (((summary->width) | (summary->height)) &&
+		    ((summary->width != audio_format->rate) |
+		     (summary->height != audio_format->channels)))
+			summary->changes++;
+		summary->width = audio_format->rate;
+		summary->height = audio_format->channels;
+	} else if ((header->type == GLC_MESSAGE_FRAME_DROP) |
+		   (header->type == GLC_MESSAGE_COLOR) |
+		   (header->type == GLC_MESSAGE_FRAME_TIMES)) {
+		/* all of these start with video stream id */
+		memcpy(&id, data, sizeof(glc_stream_id_t));
+		if (!(summary = file_summary_get(file, GLC_MESSAGE_VIDEO_FORMAT, id)))
+			return ENOMEM;
+
+		if (header->type == GLC_MESSAGE_FRAME_DROP)
+			summary->drops++;
+	} else {
+		/*
+		 Data packets may be compressed. QuickLZ and LZO packets
+		 are decoded only when they are known to be intact.
+		*/
+		file->decode = file->decode_packets;
+		ret = file_scan_peek(file, header->type, data, size, 1, &orig, peek, &peek_size);
+		file->decode = 0;
+		if ((ret) && (ret != ENOTSUP))
+			return 0;
+
+		/* segments must start at key frames from now on */
+		if ((orig.type == GLC_MESSAGE_VIDEO_DELTA) |
+		    (orig.type == GLC_MESSAGE_VIDEO_DELTA_KEY))
+			file->segment_delta = 1;
+
+		if ((orig.type == GLC_MESSAGE_VIDEO_FRAME) |
+		    (orig.type == GLC_MESSAGE_VIDEO_DELTA) |
+		    (orig.type == GLC_MESSAGE_VIDEO_DELTA_KEY)) {
+			if ((ret) || (peek_size < sizeof(glc_video_frame_header_t))) {
+				summary = file_summary_get(file, GLC_MESSAGE_VIDEO_FORMAT,
+							   GLC_SUMMARY_UNKNOWN_STREAM);
+				time = 0;
+			} else {
+				memcpy(&frame, peek, sizeof(glc_video_frame_header_t));
+				summary = file_summary_get(file, GLC_MESSAGE_VIDEO_FORMAT, frame.id);
+				time = frame.time;
+			}
+		} else if (orig.type == GLC_MESSAGE_AUDIO_DATA) {
+			if ((ret) || (peek_size < sizeof(glc_audio_data_header_t))) {
+				summary = file_summary_get(file, GLC_MESSAGE_AUDIO_FORMAT,
+							   GLC_SUMMARY_UNKNOWN_STREAM);
+				time = 0;
+			} else {
+				memcpy(&audio, peek, sizeof(glc_audio_data_header_t));
+				summary = file_summary_get(file, GLC_MESSAGE_AUDIO_FORMAT, audio.id);
+				time = audio.time;
+			}
+		} else
+			return 0;
+
+		if (!summary)
+			return ENOMEM;
+
+		/* packet was captured before now, which is close enough */
+		if ((ret) && (file->writer_clock))
+			time = glc_state_time(file->glc);
+
+		if ((!ret) || (file->writer_clock)) {
+			if ((!summary->frames) || (time < summary->first))
+				summary->first = time;
+			if (time > summary->last)
+				summary->last = time;
+			if (time > file->stream_time)
+				file->stream_time = time;
+		}
+		summary->frames++;
+	}
 
+	summary->packets++;
+	summary->bytes += sizeof(glc_container_message_header_t) + size;
 	return 0;
-err:
-	glc_log(file->glc, GLC_ERROR, "file",
-		 "can't write state: %s (%d)",
-		 strerror(ret), ret);
-	return ret;
 }
 
 int file_write_process_start(file_t file, ps_buffer_t *from)
@@ -265,8 +1838,13 @@ int file_write_process_start(file_t file, ps_buffer_t *from)
 	    (!(file->flags & FILE_INFO_WRITTEN)))
 		return EAGAIN;
 
-	if ((ret = glc_thread_create(file->glc, &file->thread, from, NULL)))
+	if ((ret = file_flush_start(file)))
+		return ret;
+
+	if ((ret = glc_thread_create(file->glc, &file->thread, from, NULL))) {
+		file_flush_stop(file);
 		return ret;
+	}
 	/** \todo cancel buffer if this fails? */
 	file->flags |= FILE_RUNNING;
 
@@ -281,6 +1859,7 @@ int file_write_process_wait(file_t file)
 		return EAGAIN;
 
 	glc_thread_wait(&file->thread);
+	file_flush_stop(file);
 	file->flags &= ~(FILE_RUNNING | FILE_INFO_WRITTEN);
 
 	return 0;
@@ -292,49 +1871,104 @@ void file_finish_callback(void *ptr, int err)
 
 	if (err)
 		glc_log(file->glc, GLC_ERROR, "file", "%s (%d)", strerror(err), err);
+
+	/* stream must be complete on disk when process has finished */
+	pthread_mutex_lock(&file->buffer_mutex);
+	if ((err = file_flush(file)))
+		glc_log(file->glc, GLC_ERROR, "file", "can't write buffered data: %s (%d)",
+			 strerror(err), err);
+	pthread_mutex_unlock(&file->buffer_mutex);
 }
 
 int file_read_callback(glc_thread_state_t *state)
 {
 	file_t file = (file_t) state->ptr;
+	int ret;
+
+	/* flush thread stays out while target is written or changed */
+	pthread_mutex_lock(&file->buffer_mutex);
+	ret = file_write_packet(file, state);
+	pthread_mutex_unlock(&file->buffer_mutex);
+
+	return ret;
+}
+
+int file_write_packet(file_t file, glc_thread_state_t *state)
+{
 	glc_container_message_header_t *container;
-	glc_size_t glc_size;
 	glc_callback_request_t *callback_req;
+	glc_message_header_t *header;
+	struct iovec iov;
+	char *data;
+	size_t size;
+	int ret = 0;
 
 	/* let state tracker to process this message */
 	tracker_submit(file->state_tracker, &state->header, state->read_data, state->read_size);
 
+	if ((state->header.type == GLC_MESSAGE_VIDEO_FORMAT) |
+	    (state->header.type == GLC_MESSAGE_AUDIO_FORMAT) |
+	    (state->header.type == GLC_MESSAGE_COLOR))
+		file->index_state_changed = 1;
+
 	if (state->header.type == GLC_CALLBACK_REQUEST) {
 		/* callback request messages are never written to disk */
 		if (file->callback != NULL) {
+			/* callback sees everything written so far */
+			if ((ret = file_flush(file)))
+				goto err;
+
 			/* callbacks may manipulate target file so remove FILE_RUNNING flag */
 			file->flags &= ~FILE_RUNNING;
 			callback_req = (glc_callback_request_t *) state->read_data;
 			file->callback(callback_req->arg);
 			file->flags |= FILE_RUNNING;
 		}
-	} else if (state->header.type == GLC_MESSAGE_CONTAINER) {
+		return 0;
+	}
+
+	if (state->header.type == GLC_MESSAGE_CONTAINER) {
 		container = (glc_container_message_header_t *) state->read_data;
-		if (write(file->fd, state->read_data, sizeof(glc_container_message_header_t) + container->size)
-		    != (sizeof(glc_container_message_header_t) + container->size))
+		header = &container->header;
+		data = &state->read_data[sizeof(glc_container_message_header_t)];
+		size = container->size;
+	} else {
+		header = &state->header;
+		data = state->read_data;
+		size = state->read_size;
+	}
+
+	/* end of stream stays in current segment */
+	if ((file->segment_running) && (state->header.type != GLC_MESSAGE_CLOSE) &&
+	    (ret = file_segment_check(file, header, data, size)))
+		goto err;
+
+	if ((ret = file_index_add(file)))
+		goto err;
+
+	if (state->header.type == GLC_MESSAGE_CONTAINER) {
+		iov.iov_base = state->read_data;
+		iov.iov_len = sizeof(glc_container_message_header_t) + size;
+		if ((ret = file_write(file, &iov, 1)))
 			goto err;
 	} else {
 		/* emulate container message */
-		glc_size = state->read_size;
-		if (write(file->fd, &glc_size, sizeof(glc_size_t)) != sizeof(glc_size_t))
-			goto err;
-		if (write(file->fd, &state->header, sizeof(glc_message_header_t))
-		    != sizeof(glc_message_header_t))
-			goto err;
-		if (write(file->fd, state->read_data, state->read_size) != state->read_size)
+		if ((ret = file_write_message(file, header, data, size)))
 			goto err;
 	}
 
+	if ((ret = file_summary_add(file, header, data, size)))
+		goto err;
+
+	if ((file->resync_interval) && (file->resync_size >= file->resync_interval) &&
+	    (ret = file_write_marker(file)))
+		goto err;
+
 	return 0;
 
 err:
-	glc_log(file->glc, GLC_ERROR, "file", "%s (%d)", strerror(errno), errno);
-	return errno;
+	glc_log(file->glc, GLC_ERROR, "file", "%s (%d)", strerror(ret), ret);
+	return ret;
 }
 
 int file_open_source(file_t file, const char *filename)
@@ -431,7 +2065,14 @@ int file_read_info(file_t file, glc_stream_info_t *info,
 		return ENOTSUP;
 	}
 	glc_log(file->glc, GLC_INFORMATION, "file", "stream version 0x%02x", info->version);
+	if (info->durable_size)
+		glc_log(file->glc, GLC_INFORMATION, "file", "%llu bytes known to be durable",
+			 (unsigned long long) info->durable_size);
+	file->durable_end = info->durable_size;
+	file->durable_warned = 0;
 	file->stream_version = info->version; /* copy version */
+	file->stream_flags = info->flags;
+	file->resync_partial = 0;
 
 	if (info->name_size > 0) {
 		*info_name = (char *) malloc(info->name_size);
@@ -476,23 +2117,83 @@ int file_read(file_t file, ps_buffer_t *to)
 
 	ps_packet_init(&packet, to);
 
+	/*
+	 Mapping saves a few syscalls per packet, read() is fallback.
+	 Scan mode skips most of the data, so readahead would be waste.
+	*/
+	if (!file->scan)
+		file_map_source(file);
+
+	/* markers can be checked only when whole stream is at hand */
+	file->resync = (file->stream_flags & GLC_STREAM_SYNC_MARKERS) && (file->map);
+	file->resync_end = file->resync_next = file->map_pos;
+
+	if ((file->durable_only) && (!file->map)) {
+		glc_log(file->glc, GLC_ERROR, "file",
+			 "stream can't be checked, it is not a regular file");
+		ret = ENOTSUP;
+		goto err;
+	}
+
 	do {
+		if ((file->resync) && (file->map_pos >= file->resync_end)) {
+			/* pass on only packets that are known to be intact */
+			if (file_resync_next(file))
+				goto send_eof;
+		}
+
 		if (file->stream_version == 0x03) {
 			/* old order */
-			if (read(file->fd, &header, sizeof(glc_message_header_t)) != sizeof(glc_message_header_t))
+			if (file_read_data(file, &header, sizeof(glc_message_header_t)))
 				goto send_eof;
-			if (read(file->fd, &glc_ps, sizeof(glc_size_t)) != sizeof(glc_size_t))
+			if (file_read_data(file, &glc_ps, sizeof(glc_size_t)))
 				goto send_eof;
 		} else {
 			/* same header format as in container messages */
-			if (read(file->fd, &glc_ps, sizeof(glc_size_t)) != sizeof(glc_size_t))
+			if (file_read_data(file, &glc_ps, sizeof(glc_size_t)))
 				goto send_eof;
-			if (read(file->fd, &header, sizeof(glc_message_header_t)) != sizeof(glc_message_header_t))
+			if (file_read_data(file, &header, sizeof(glc_message_header_t)))
 				goto send_eof;
 		}
 
 		packet_size = glc_ps;
 
+		/* damaged size must not turn into a huge buffer reservation */
+		if ((file->map) && (packet_size > file->map_size - file->map_pos)) {
+			glc_log(file->glc, GLC_ERROR, "file",
+				 "packet size %zd exceeds end of stream", packet_size);
+			goto send_eof;
+		}
+
+		/* without markers only durable part of stream is known to be intact */
+		if ((!file->resync) && (file->map) && (file->durable_end) &&
+		    (file->map_pos + packet_size > file->durable_end)) {
+			if (file->durable_only) {
+				glc_log(file->glc, GLC_WARNING, "file",
+					 "stopping at durable size %llu, rest was not synced",
+					 (unsigned long long) file->durable_end);
+				goto send_eof;
+			}
+			if (!file->durable_warned)
+				glc_log(file->glc, GLC_WARNING, "file",
+					 "data past %llu bytes was not synced and may be damaged",
+					 (unsigned long long) file->durable_end);
+			file->durable_warned = 1;
+		}
+
+		if (header.type == GLC_MESSAGE_SYNC) {
+			/* markers are checked above when possible */
+			if (file_skip(file, packet_size))
+				goto send_eof;
+			continue;
+		}
+
+		if (file->scan) {
+			if ((ret = file_scan_packet(file, &packet, &header, packet_size)))
+				goto err;
+			continue;
+		}
+
 		if ((ret = ps_packet_open(&packet, PS_PACKET_WRITE)))
 			goto err;
 		if ((ret = ps_packet_write(&packet, &header, sizeof(glc_message_header_t))))
@@ -500,7 +2201,7 @@ int file_read(file_t file, ps_buffer_t *to)
 		if ((ret = ps_packet_dma(&packet, (void *) &dma, packet_size, PS_ACCEPT_FAKE_DMA)))
 			goto err;
 
-		if (read(file->fd, dma, packet_size) != packet_size)
+		if (file_read_data(file, dma, packet_size))
 			goto read_fail;
 
 		if ((ret = ps_packet_close(&packet)))
@@ -508,8 +2209,13 @@ int file_read(file_t file, ps_buffer_t *to)
 	} while ((header.type != GLC_MESSAGE_CLOSE) &&
 		 (!glc_state_test(file->glc, GLC_STATE_CANCEL)));
 
+	/* step over marker that covers close message */
+	if ((file->resync) && (file->map_pos == file->resync_end))
+		file->map_pos = file->resync_next;
+
 finish:
 	ps_packet_destroy(&packet);
+	file_unmap_source(file);
 
 	file->flags &= ~(FILE_INFO_READ | FILE_INFO_VALID);
 	return 0;
@@ -532,9 +2238,658 @@ err:
 	glc_log(file->glc, GLC_ERROR, "file", "%s (%d)", strerror(ret), ret);
 	glc_log(file->glc, GLC_DEBUG, "file", "packet size is %zd", packet_size);
 	ps_buffer_cancel(to);
+	file_unmap_source(file);
 
 	file->flags &= ~(FILE_INFO_READ | FILE_INFO_VALID);
 	return ret;
 }
 
+int file_read_footer(file_t file, glc_index_footer_t *footer, off_t *start)
+{
+	struct stat st;
+
+	if ((fstat(file->fd, &st)) || (!S_ISREG(st.st_mode)) ||
+	    (st.st_size < (off_t) sizeof(glc_index_footer_t)))
+		return ENOENT;
+
+	if (pread(file->fd, footer, sizeof(glc_index_footer_t),
+		  st.st_size - sizeof(glc_index_footer_t)) != sizeof(glc_index_footer_t))
+		return EBADMSG;
+	if (footer->signature != GLC_INDEX_SIGNATURE)
+		return ENOENT;
+
+	if ((!footer->count) || (footer->size > (u_int64_t) st.st_size) ||
+	    (footer->size != sizeof(glc_index_entry_t) * (u_int64_t) footer->count +
+			     footer->state_size +
+			     sizeof(glc_stream_summary_t) * (u_int64_t) footer->summary_count +
+			     sizeof(glc_index_footer_t)))
+		return EBADMSG;
+
+	*start = st.st_size - footer->size;
+	return 0;
+}
+
+int file_read_index(file_t file, glc_index_footer_t *footer,
+		    glc_index_entry_t **entries, char **state)
+{
+	off_t start;
+	size_t size;
+	unsigned int i;
+	int ret;
+
+	*entries = NULL;
+	*state = NULL;
+
+	if ((ret = file_read_footer(file, footer, &start)))
+		return ret;
+	size = sizeof(glc_index_entry_t) * footer->count;
+
+	if ((!(*entries = malloc(size))) || (!(*state = malloc(footer->state_size + 1))))
+		return ENOMEM;
+
+	if ((pread(file->fd, *entries, size, start) != size) ||
+	    (pread(file->fd, *state, footer->state_size, start + size) != footer->state_size))
+		return EBADMSG;
+
+	for (i = 0; i < footer->count; i++) {
+		if (((*entries)[i].offset >= (u_int64_t) start) ||
+		    ((*entries)[i].state >= footer->state_size))
+			return EBADMSG;
+	}
+
+	return 0;
+}
+
+int file_read_summary(file_t file, glc_stream_summary_t **summary, unsigned int *count)
+{
+	glc_index_footer_t footer;
+	off_t start;
+	size_t size;
+	int ret;
+
+	*summary = NULL;
+	*count = 0;
+
+	if ((file->fd < 0) | (!(file->flags & FILE_READING)))
+		return EAGAIN;
+
+	if ((ret = file_read_footer(file, &footer, &start)))
+		return ret;
+	if (!footer.summary_count)
+		return ENOENT;
+
+	size = sizeof(glc_stream_summary_t) * footer.summary_count;
+	if (!(*summary = malloc(size)))
+		return ENOMEM;
+
+	if (pread(file->fd, *summary, size, start +
+		  sizeof(glc_index_entry_t) * footer.count + footer.state_size) != size) {
+		free(*summary);
+		*summary = NULL;
+		return EBADMSG;
+	}
+
+	*count = footer.summary_count;
+	return 0;
+}
+
+int file_seek(file_t file, ps_buffer_t *to, glc_utime_t time)
+{
+	glc_index_footer_t footer;
+	glc_index_entry_t *entries;
+	glc_container_message_header_t container;
+	ps_packet_t packet;
+	char *state;
+	unsigned int first, last, middle;
+	size_t pos;
+	int ret;
+
+	if ((file->fd < 0) | (!(file->flags & FILE_READING)))
+		return EAGAIN;
+
+	if (!(file->flags & FILE_INFO_VALID)) {
+		glc_log(file->glc, GLC_ERROR, "file",
+			 "stream info header not read");
+		return EAGAIN;
+	}
+
+	if ((ret = file_read_index(file, &footer, &entries, &state))) {
+		if (ret == ENOENT)
+			glc_log(file->glc, GLC_ERROR, "file", "stream has no index");
+		goto finish;
+	}
+
+	/* last entry that isn't past requested time */
+	first = 0;
+	last = footer.count;
+	while (last - first > 1) {
+		middle = first + (last - first) / 2;
+		if (entries[middle].time <= time)
+			first = middle;
+		else
+			last = middle;
+	}
+
+	/* replay state snapshot */
+	ps_packet_init(&packet, to);
+	for (pos = entries[first].state; ; pos += sizeof(glc_container_message_header_t) + container.size) {
+		if (pos + sizeof(glc_container_message_header_t) > footer.state_size) {
+			ret = EBADMSG;
+			break;
+		}
+		memcpy(&container, &state[pos], sizeof(glc_container_message_header_t));
+		if (container.header.type == GLC_MESSAGE_CLOSE)
+			break;
+		if (container.size > footer.state_size - pos - sizeof(glc_container_message_header_t)) {
+			ret = EBADMSG;
+			break;
+		}
+
+		if ((ret = ps_packet_open(&packet, PS_PACKET_WRITE)))
+			break;
+		if ((ret = ps_packet_write(&packet, &container.header, sizeof(glc_message_header_t))))
+			break;
+		if ((ret = ps_packet_write(&packet, &state[pos + sizeof(glc_container_message_header_t)],
+					   container.size)))
+			break;
+		if ((ret = ps_packet_close(&packet)))
+			break;
+	}
+	ps_packet_destroy(&packet);
+
+	if (ret)
+		goto finish;
+
+	if (lseek(file->fd, entries[first].offset, SEEK_SET) == (off_t) -1) {
+		ret = errno;
+		goto finish;
+	}
+
+	/* first marker after this covers also packets before entry */
+	file->resync_partial = 1;
+
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "seeking to %f s, reading from offset %llu (%f s)",
+		 (double) time / 1000000.0, (unsigned long long) entries[first].offset,
+		 (double) entries[first].time / 1000000.0);
+finish:
+	if ((ret) && (ret != ENOENT))
+		glc_log(file->glc, GLC_ERROR, "file", "can't seek: %s (%d)", strerror(ret), ret);
+	free(entries);
+	free(state);
+	return ret;
+}
+
+int file_map_source(file_t file)
+{
+	struct stat st;
+	off_t pos;
+
+	if ((fstat(file->fd, &st)) || (!S_ISREG(st.st_mode)) ||
+	    ((pos = lseek(file->fd, 0, SEEK_CUR)) == (off_t) -1))
+		return ENOTSUP;
+
+	if (st.st_size <= pos)
+		return 0;
+
+	file->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
+	if (file->map == MAP_FAILED) {
+		glc_log(file->glc, GLC_DEBUG, "file", "can't map stream: %s (%d)",
+			 strerror(errno), errno);
+		file->map = NULL;
+		return errno;
+	}
+
+	madvise(file->map, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	madvise(file->map, st.st_size, MADV_HUGEPAGE);
+#endif
+
+	file->map_size = st.st_size;
+	file->map_pos = pos;
+	file->map_ahead = pos;
+	return 0;
+}
+
+void file_unmap_source(file_t file)
+{
+	if (!file->map)
+		return;
+
+	/* leave file offset where stream ended */
+	lseek(file->fd, file->map_pos, SEEK_SET);
+	munmap(file->map, file->map_size);
+	file->map = NULL;
+}
+
+int file_read_data(file_t file, void *data, size_t size)
+{
+	size_t page, len;
+	ssize_t ret;
+
+	if (!file->map) {
+		/* pipes may return less than asked */
+		while (size) {
+			if ((ret = read(file->fd, data, size)) <= 0)
+				return EBADMSG;
+			data = (char *) data + ret;
+			size -= ret;
+		}
+		return 0;
+	}
+
+	if (size > file->map_size - file->map_pos)
+		return EBADMSG;
+
+	/* ask kernel to read next window while this one is consumed */
+	if (file->map_pos + size >= file->map_ahead) {
+		page = sysconf(_SC_PAGESIZE);
+		file->map_ahead = (file->map_pos + size) & ~(page - 1);
+		len = FILE_MAP_READAHEAD;
+		if (len > file->map_size - file->map_ahead)
+			len = file->map_size - file->map_ahead;
+		madvise(&file->map[file->map_ahead], len, MADV_WILLNEED);
+		file->map_ahead += len;
+	}
+
+	memcpy(data, &file->map[file->map_pos], size);
+	file->map_pos += size;
+	return 0;
+}
+
+int file_resync_next(file_t file)
+{
+	glc_container_message_header_t container;
+	glc_sync_message_t marker;
+	size_t start, pos;
+
+	for (;;) {
+		start = pos = file->map_pos = file->resync_next;
+
+		/* walk packets up to next marker */
+		while ((file->map_size - pos >= sizeof(glc_container_message_header_t))) {
+			memcpy(&container, &file->map[pos], sizeof(glc_container_message_header_t));
+			if (container.size > file->map_size - pos - sizeof(glc_container_message_header_t))
+				break;
+
+			if (container.header.type == GLC_MESSAGE_SYNC) {
+				if (file_resync_marker(file, pos, &marker))
+					break;
+
+				/* after seeking, beginning of covered packets is not read */
+				if ((!file->resync_partial) &&
+				    ((marker.size != pos - start) ||
+				     (marker.crc != glc_util_crc32c(0, &file->map[start], pos - start))))
+					break;
+
+				file->resync_partial = 0;
+				file->resync_end = pos;
+				file->resync_next = pos + sizeof(glc_container_message_header_t) +
+						    sizeof(glc_sync_message_t);
+				return 0;
+			}
+
+			pos += sizeof(glc_container_message_header_t) + container.size;
+		}
+
+		if (file_resync_find(file, start, &file->resync_next)) {
+			/* capture was probably interrupted, pass on what is complete */
+			if (pos == start)
+				return ENODATA;
+
+			if (file->durable_only) {
+				glc_log(file->glc, GLC_WARNING, "file",
+					 "dropping last %zd bytes of stream, no sync marker covers them",
+					 pos - start);
+				return ENODATA;
+			}
+
+			glc_log(file->glc, GLC_WARNING, "file",
+				 "last %zd bytes of stream have no sync marker", pos - start);
+			file->resync_end = file->resync_next = pos;
+			return 0;
+		}
+
+		glc_log(file->glc, GLC_WARNING, "file",
+			 "skipping %zd bytes of damaged stream at offset %zd",
+			 file->resync_next - start, start);
+		file->resync_partial = 0;
+	}
+}
+
+int file_resync_marker(file_t file, size_t pos, glc_sync_message_t *marker)
+{
+	glc_container_message_header_t container;
+
+	if (file->map_size - pos < sizeof(glc_container_message_header_t) +
+				   sizeof(glc_sync_message_t))
+		return EBADMSG;
+
+	memcpy(&container, &file->map[pos], sizeof(glc_container_message_header_t));
+	if ((container.header.type != GLC_MESSAGE_SYNC) ||
+	    (container.size != sizeof(glc_sync_message_t)))
+		return EBADMSG;
+
+	memcpy(marker, &file->map[pos + sizeof(glc_container_message_header_t)],
+	       sizeof(glc_sync_message_t));
+	if ((marker->signature != GLC_SYNC_SIGNATURE) ||
+	    (marker->check != glc_util_crc32c(0, marker, offsetof(glc_sync_message_t, check))))
+		return EBADMSG;
+
+	return 0;
+}
+
+int file_resync_find(file_t file, size_t from, size_t *pos)
+{
+	u_int64_t signature = GLC_SYNC_SIGNATURE;
+	glc_sync_message_t marker;
+	char *p = &file->map[from + sizeof(glc_container_message_header_t)];
+	char *end = &file->map[file->map_size];
+
+	if (file->map_size - from < sizeof(glc_container_message_header_t))
+		return ENOENT;
+
+	/* returns position after marker */
+	while ((p = memmem(p, end - p, &signature, sizeof(u_int64_t)))) {
+		*pos = p - file->map - sizeof(glc_container_message_header_t);
+		if (!file_resync_marker(file, *pos, &marker)) {
+			*pos += sizeof(glc_container_message_header_t) + sizeof(glc_sync_message_t);
+			return 0;
+		}
+		p++;
+	}
+
+	return ENOENT;
+}
+
+int file_skip(file_t file, size_t size)
+{
+	char buf[4096];
+	size_t len;
+
+	if (!size)
+		return 0;
+
+	if (file->map) {
+		if (size > file->map_size - file->map_pos)
+			return EBADMSG;
+		file->map_pos += size;
+		return 0;
+	}
+
+	if (lseek(file->fd, size, SEEK_CUR) != (off_t) -1)
+		return 0;
+
+	/* pipes can't seek */
+	while (size) {
+		len = size < sizeof(buf) ? size : sizeof(buf);
+		if (file_read_data(file, buf, len))
+			return EBADMSG;
+		size -= len;
+	}
+	return 0;
+}
+
+int file_scan_packet(file_t file, ps_packet_t *packet, glc_message_header_t *header,
+		     size_t size)
+{
+	glc_message_header_t orig;
+	char data[FILE_SCAN_HEADER];
+	size_t peek, data_size = 0;
+	char *dma;
+	int ret;
+
+	if (!file->scan_buffer) {
+		if (!(file->scan_buffer = malloc(FILE_SCAN_PEEK)))
+			return ENOMEM;
+	}
+
+	peek = size < FILE_SCAN_PEEK ? size : FILE_SCAN_PEEK;
+	if (file_read_data(file, file->scan_buffer, peek))
+		return EBADMSG;
+
+	if (!file_scan_peek(file, header->type, file->scan_buffer, peek, peek == size,
+			    &orig, data, &data_size)) {
+		/* delta frames are reported as ordinary frames */
+		if ((orig.type == GLC_MESSAGE_VIDEO_DELTA) |
+		    (orig.type == GLC_MESSAGE_VIDEO_DELTA_KEY))
+			orig.type = GLC_MESSAGE_VIDEO_FRAME;
+
+		if (((orig.type == GLC_MESSAGE_VIDEO_FRAME) &&
+		     (data_size >= sizeof(glc_video_frame_header_t))) ||
+		    ((orig.type == GLC_MESSAGE_AUDIO_DATA) &&
+		     (data_size >= sizeof(glc_audio_data_header_t)))) {
+			/* pass only the message header, data is skipped */
+			if (orig.type == GLC_MESSAGE_VIDEO_FRAME)
+				data_size = sizeof(glc_video_frame_header_t);
+			else
+				data_size = sizeof(glc_audio_data_header_t);
+
+			if ((ret = ps_packet_open(packet, PS_PACKET_WRITE)))
+				return ret;
+			if ((ret = ps_packet_write(packet, &orig, sizeof(glc_message_header_t))))
+				return ret;
+			if ((ret = ps_packet_write(packet, data, data_size)))
+				return ret;
+			if ((ret = ps_packet_close(packet)))
+				return ret;
+
+			return file_skip(file, size - peek);
+		}
+	}
+
+	/* anything else is passed as is */
+	if ((ret = ps_packet_open(packet, PS_PACKET_WRITE)))
+		return ret;
+	if ((ret = ps_packet_write(packet, header, sizeof(glc_message_header_t))))
+		return ret;
+	if ((ret = ps_packet_dma(packet, (void *) &dma, size, PS_ACCEPT_FAKE_DMA)))
+		return ret;
+
+	memcpy(dma, file->scan_buffer, peek);
+	if (file_read_data(file, &dma[peek], size - peek))
+		return EBADMSG;
+
+	return ps_packet_close(packet);
+}
+
+int file_scan_peek(file_t file, glc_message_type_t type, const char *src, size_t size,
+		   int complete, glc_message_header_t *header, char *data, size_t *data_size)
+{
+	glc_lz4_header_t codec;
+	glc_blocks_header_t blocks;
+	glc_video_layout_header_t layout;
+	u_int32_t block_size;
+	size_t pos;
+	int ret;
+
+	if ((type == GLC_MESSAGE_LZ4) | (type == GLC_MESSAGE_LZJB) |
+	    (type == GLC_MESSAGE_QUICKLZ) | (type == GLC_MESSAGE_LZO)) {
+		/* all start with original size and header */
+		if (size < sizeof(glc_lz4_header_t))
+			return EBADMSG;
+		memcpy(&codec, src, sizeof(glc_lz4_header_t));
+
+		*header = codec.header;
+		*data_size = codec.size < FILE_SCAN_HEADER ? codec.size : FILE_SCAN_HEADER;
+		return file_scan_decompress(file, type, &src[sizeof(glc_lz4_header_t)],
+					    size - sizeof(glc_lz4_header_t), complete,
+					    codec.size, data, *data_size);
+	} else if (type == GLC_MESSAGE_BLOCKS) {
+		if (size < sizeof(glc_blocks_header_t))
+			return EBADMSG;
+		memcpy(&blocks, src, sizeof(glc_blocks_header_t));
+
+		pos = sizeof(glc_blocks_header_t) + blocks.count * sizeof(u_int32_t);
+		if ((!blocks.count) || (size < pos))
+			return EBADMSG;
+		memcpy(&block_size, &src[sizeof(glc_blocks_header_t)], sizeof(u_int32_t));
+
+		/* first block is enough */
+		if (block_size <= size - pos) {
+			size = pos + block_size;
+			complete = 1;
+		}
+
+		*header = blocks.header;
+		*data_size = blocks.size < blocks.block_size ? blocks.size : blocks.block_size;
+		if (*data_size > FILE_SCAN_HEADER)
+			*data_size = FILE_SCAN_HEADER;
+		return file_scan_decompress(file, blocks.compression, &src[pos], size - pos,
+					    complete,
+					    blocks.size < blocks.block_size ?
+					    blocks.size : blocks.block_size,
+					    data, *data_size);
+	} else if (type == GLC_MESSAGE_VIDEO_LAYOUT) {
+		if (size < sizeof(glc_video_layout_header_t))
+			return EBADMSG;
+		memcpy(&layout, src, sizeof(glc_video_layout_header_t));
+
+		/* decoded data starts with original message header */
+		ret = file_scan_peek(file, layout.compression,
+				     &src[sizeof(glc_video_layout_header_t)],
+				     size - sizeof(glc_video_layout_header_t),
+				     complete, header, data, data_size);
+
+		*header = layout.header;
+		if (ret)
+			return ret;
+		if (*data_size > layout.prefix)
+			*data_size = layout.prefix;
+		return 0;
+	} else if (type == GLC_MESSAGE_AUDIO_LPC) {
+		/* original audio header is stored as is */
+		if (size < sizeof(glc_audio_lpc_header_t) + sizeof(glc_audio_data_header_t))
+			return EBADMSG;
+
+		header->type = GLC_MESSAGE_AUDIO_DATA;
+		*data_size = sizeof(glc_audio_data_header_t);
+		memcpy(data, &src[sizeof(glc_audio_lpc_header_t)], *data_size);
+		return 0;
+	}
+
+	header->type = type;
+	*data_size = size < FILE_SCAN_HEADER ? size : FILE_SCAN_HEADER;
+	memcpy(data, src, *data_size);
+	return 0;
+}
+
+int file_scan_decompress(file_t file, glc_message_type_t type, const char *src, size_t size,
+			 int complete, size_t orig, char *dst, size_t len)
+{
+	/* QuickLZ and LZO have no cheap way to decode only the beginning */
+	if ((type == GLC_MESSAGE_QUICKLZ) | (type == GLC_MESSAGE_LZO)) {
+		if ((!file->decode) || (!complete))
+			return ENOTSUP;
+		return file_scan_decode(file, type, src, size, orig, dst, len);
+	}
+
+	if (type == GLC_MESSAGE_LZ4)
+		return file_scan_lz4((const unsigned char *) src, size,
+				     (unsigned char *) dst, len);
+#ifdef __LZJB
+	if (type == GLC_MESSAGE_LZJB) {
+		/*
+		 lzjb_decompress() doesn't check input bounds, but each
+		 output byte takes at most one input byte plus a copy
+		 map byte per eight items.
+		*/
+		if ((!complete) && (size < len + len / 8 + 1))
+			return EBADMSG;
+		lzjb_decompress((void *) src, dst, size, len);
+		return 0;
+	}
+#endif
+	return ENOTSUP;
+}
+
+int file_scan_decode(file_t file, glc_message_type_t type, const char *src, size_t size,
+		     size_t orig, char *dst, size_t len)
+{
+	char *buffer;
+
+	if (orig > file->decode_size) {
+		if (!(buffer = realloc(file->decode_buffer, orig)))
+			return ENOMEM;
+		file->decode_buffer = buffer;
+		file->decode_size = orig;
+	}
+
+	if (type == GLC_MESSAGE_QUICKLZ) {
+#ifdef __QUICKLZ
+		quicklz_decompress((const unsigned char *) src,
+				   (unsigned char *) file->decode_buffer, orig);
+		memcpy(dst, file->decode_buffer, len);
+		return 0;
+#endif
+	} else if (type == GLC_MESSAGE_LZO) {
+#ifdef __LZO
+		lzo_uint lzo_size = orig;
+		if ((lzo1x_decompress_safe((unsigned char *) src, size,
+					   (unsigned char *) file->decode_buffer,
+					   &lzo_size, NULL)) || (lzo_size != orig))
+			return EBADMSG;
+		memcpy(dst, file->decode_buffer, len);
+		return 0;
+#endif
+	}
+
+	return ENOTSUP;
+}
+
+int file_scan_lz4(const unsigned char *src, size_t size, unsigned char *dst, size_t len)
+{
+	size_t s = 0, d = 0, run, offset;
+	unsigned char token;
+
+	/* LZ4 block format, stops after len bytes of output */
+	while (d < len) {
+		if (s >= size)
+			return EBADMSG;
+		token = src[s++];
+
+		/* literals */
+		run = token >> 4;
+		if (run == 15) {
+			do {
+				if (s >= size)
+					return EBADMSG;
+				run += src[s];
+			} while (src[s++] == 255);
+		}
+
+		if (run > len - d)
+			run = len - d;
+		if (run > size - s)
+			return EBADMSG;
+		memcpy(&dst[d], &src[s], run);
+		d += run;
+		s += run;
+		if (d == len)
+			break;
+
+		/* match */
+		if (size - s < 2)
+			return EBADMSG;
+		offset = src[s] | (src[s + 1] << 8);
+		s += 2;
+		if ((!offset) || (offset > d))
+			return EBADMSG;
+
+		run = (token & 15) + 4;
+		if ((token & 15) == 15) {
+			do {
+				if (s >= size)
+					return EBADMSG;
+				run += src[s];
+			} while (src[s++] == 255);
+		}
+
+		for (; (run > 0) && (d < len); run--, d++)
+			dst[d] = dst[d - offset];
+	}
+
+	return 0;
+}
+
 /**  \} */
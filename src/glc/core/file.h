@@ -67,6 +67,10 @@ typedef struct file_s* file_t;
  *
  * One stream file can actually hold multiple individual
  * streams: [info0][stream0][info1][stream1]...
+ *
+ * When target is closed, a seek index and stream summary are
+ * appended after last stream (see file_seek() and
+ * file_read_summary()).
  * \param file file object
  * \param glc glc
  * \return 0 on success otherwise an error code
@@ -82,6 +86,162 @@ __PUBLIC int file_init(file_t *file, glc_t *glc);
  */
 __PUBLIC int file_set_sync(file_t file, int sync);
 
+/**
+ * \brief set group commit durability
+ *
+ * Instead of synchronous writes (see file_set_sync()), a side
+ * thread calls fdatasync() when [size] bytes have been written
+ * since last sync or every [interval] milliseconds. Writeback is
+ * started early with sync_file_range(). Stream size known to be
+ * on disk is recorded in stream info header (durable_size), so
+ * recovery knows which part of stream is safe after a crash.
+ * \note this must be set before opening file
+ * \param file file object
+ * \param size sync after this many bytes, 0 disables
+ * \param interval sync interval in milliseconds, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_group_commit(file_t file, size_t size, unsigned int interval);
+
+/**
+ * \brief set preallocation chunk size
+ *
+ * Space is reserved with fallocate() in [size] chunks ahead of
+ * write offset, so long streams don't get fragmented and writer
+ * doesn't stall on block allocation. File size isn't changed by
+ * preallocation and unused space is released when file is closed.
+ * \note this must be set before opening file
+ * \param file file object
+ * \param size chunk size in bytes, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_prealloc(file_t file, size_t size);
+
+/**
+ * \brief set direct io mode
+ *
+ * Target file is opened with O_DIRECT and written with io_uring,
+ * keeping several aligned 1 MiB writes in flight. Stream data
+ * doesn't go through page cache. Unaligned tail is written
+ * through page cache when file is closed. If file system doesn't
+ * support O_DIRECT or io_uring is not available, normal writes
+ * are used.
+ * \note this must be set before opening file
+ * \param file file object
+ * \param direct 0 = normal writes, 1 = direct io
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_direct(file_t file, int direct);
+
+/**
+ * \brief set sync marker interval
+ *
+ * A sync marker with CRC32C of everything written since previous
+ * marker is written after a packet when at least interval bytes
+ * have been written. When reading a regular file, file_read()
+ * checks each block before passing its packets and skips over
+ * damaged blocks to next intact marker. Interval 1 checks
+ * every packet separately.
+ * \note this must be set before writing stream info
+ * \param file file object
+ * \param interval bytes between markers, 0 = no markers
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_resync(file_t file, size_t interval);
+
+/**
+ * \brief set whether writer clock stands in for packet times
+ *
+ * Index and stream summary take times from packets. When time
+ * can't be read from a compressed packet, current time is used
+ * by default. That is right only when writing a live capture.
+ * Without writer clock such packets are counted without times,
+ * unless they are decoded (see file_set_decode()).
+ * \param file file object
+ * \param clock 0 = times only from packets, 1 = use current time
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_writer_clock(file_t file, int clock);
+
+/**
+ * \brief set whether QuickLZ and LZO packets are decoded for times
+ *
+ * QuickLZ and LZO packets are decompressed whole to read their
+ * headers for index and stream summary. This costs writer CPU
+ * time, and QuickLZ doesn't check its input, so enable this only
+ * when packets are known to be intact, e.g. checked against sync
+ * markers.
+ * \param file file object
+ * \param decode 0 = don't decode, 1 = decode packets
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_decode(file_t file, int decode);
+
+/**
+ * \brief set scan mode
+ *
+ * In scan mode file_read() passes only message headers of
+ * video frames and audio data and seeks over the rest. Only
+ * the beginning of each packet is read and, when compressed,
+ * decoded. Delta frames are reported as ordinary frames.
+ * Packets that can't be decoded partially (QuickLZ, LZO)
+ * and all other messages are passed whole.
+ * \note this must be set before reading stream
+ * \param file file object
+ * \param scan 0 = read everything, 1 = scan headers only
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_scan(file_t file, int scan);
+
+/**
+ * \brief set whether reading stops at durable size
+ *
+ * Writer records in stream info header how much of stream is
+ * known to be on disk (see file_set_group_commit()). Data past
+ * that may be lost or damaged after a crash. When stream has no
+ * sync markers, file_read() warns when it reads past durable
+ * size, or stops there when this is set. With this set, tail
+ * that no sync marker covers is dropped as well, and source
+ * must be a regular file so that markers can be checked.
+ * \note this must be set before reading stream
+ * \param file file object
+ * \param durable 0 = warn and continue, 1 = stop at durable size
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_durable_only(file_t file, int durable);
+
+/**
+ * \brief segment name callback
+ * Returns file name for segment number [segment], counted from 1
+ * after the target file that was opened. Called from segment
+ * thread. Returned string is freed by file object.
+ */
+typedef char *(*file_segment_name_func_t)(void *arg, unsigned int segment);
+
+/**
+ * \brief set rolling segment limits
+ *
+ * When current segment reaches size bytes or duration
+ * microseconds of stream time, writer closes it and continues
+ * in next segment. A background thread opens, locks and
+ * preallocates next segment well before it is needed, and
+ * finishes closing the old one, so the writer thread only
+ * writes stream info and state to new segment and swaps file
+ * descriptors. Each segment is a complete stream with its own
+ * index. When stream is delta coded, switch waits for next key
+ * frame. If next segment can't be prepared, writer continues in
+ * current segment and preparation is retried.
+ * \note this must be set before opening file
+ * \param file file object
+ * \param size segment size in bytes, 0 = no size limit
+ * \param duration segment duration in microseconds, 0 = no limit
+ * \param name callback returning name of next segment
+ * \param arg custom argument to callback
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_segment(file_t file, u_int64_t size, glc_utime_t duration,
+			      file_segment_name_func_t name, void *arg);
+
 /**
  * \brief set callback function
  * Callback is called when callback_request message is encountered
@@ -149,6 +309,13 @@ __PUBLIC int file_write_state(file_t file);
  *
  * file will write all data from source buffer to target file
  * in a custom format that can be read back using file_read()
+ *
+ * Small packets are gathered into a write-behind buffer which
+ * is written when it fills up or has held data for 100 ms,
+ * also when no new packets arrive (a side thread checks this).
+ * Larger packets are written together with buffered data using
+ * a single writev(). Buffer is flushed before callback requests
+ * and when process finishes.
  * \param file file object
  * \param from source buffer
  * \return 0 on success otherwise an error code
@@ -206,8 +373,53 @@ __PUBLIC int file_read_info(file_t file, glc_stream_info_t *info,
  */
 __PUBLIC int file_test_stream_version(u_int32_t version);
 
+/**
+ * \brief seek to given stream time
+ *
+ * Writer adds an index entry about once per second and a
+ * snapshot of stream state (formats and color correction)
+ * whenever state changes. This finds last entry before [time],
+ * writes its state snapshot into buffer and moves file offset
+ * to entry, so that next file_read() starts from there.
+ *
+ * Index times are conservative, so a few packets older than
+ * [time] are usually read. Delta coded video frames can't be
+ * restored until next key frame and unpack replaces them with
+ * drop markers.
+ * \note this must be called after file_read_info() and before
+ *       file_read()
+ * \param file file object
+ * \param to buffer
+ * \param time stream time in microseconds
+ * \return 0 on success, ENOENT if stream has no index,
+ *         otherwise an error code
+ */
+__PUBLIC int file_seek(file_t file, ps_buffer_t *to, glc_utime_t time);
+
+/**
+ * \brief read stream summary
+ *
+ * Writer keeps per-stream totals (frames, bytes, first and last
+ * time, resolution changes and drops) and stores them with the
+ * index when target is closed. This reads them without reading
+ * the stream itself.
+ * \note file offset is not changed
+ * \param file file object
+ * \param summary returned summary entries, caller must free this
+ * \param count returned number of entries
+ * \return 0 on success, ENOENT if stream has no summary,
+ *         otherwise an error code
+ */
+__PUBLIC int file_read_summary(file_t file, glc_stream_summary_t **summary,
+			       unsigned int *count);
+
 /**
  * \brief read stream from file and write it into buffer
+ *
+ * Regular files are memory mapped and read sequentially with
+ * kernel readahead hints, so each packet is copied once into
+ * buffer without syscalls. Pipes and other sources that can't
+ * be mapped are read with read().
  * \param file file object
  * \param to buffer
  * \return 0 on success otherwise an error code
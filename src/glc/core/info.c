@@ -42,9 +42,16 @@ struct info_video_stream_s {
 	unsigned long pictures;
 	size_t bytes;
 
+	unsigned long drops, drops_full, drops_busy;
+
 	unsigned long fps;
 	glc_utime_t last_fps_time, fps_time;
 
+	unsigned long swaps, captured_swaps;
+	glc_utime_t last_swap_time;
+	u_int32_t *frame_time, *overhead;
+	size_t frame_times, frame_times_size;
+
 	struct info_video_stream_s *next;
 };
 
@@ -64,6 +71,7 @@ struct info_s {
 	glc_utime_t time;
 	int level;
 	FILE *stream;
+	FILE *frame_times_stream;
 
 	struct info_video_stream_s *video_list;
 	struct info_audio_stream_s *audio_list;
@@ -82,9 +90,14 @@ void video_frame_info(info_t info, glc_video_frame_header_t *pic_header);
 void audio_format_info(info_t info, glc_audio_format_message_t *fmt_message);
 void audio_data_info(info_t info, glc_audio_data_header_t *audio_header);
 void color_info(info_t info, glc_color_message_t *color_msg);
+void frame_times_info(info_t info, glc_frame_times_header_t *times_msg);
+void frame_drop_info(info_t info, glc_frame_drop_message_t *drop_msg);
+void frame_times_summary(info_t info, struct info_video_stream_s *video);
 
 void print_time(FILE *stream, glc_utime_t time);
 void print_bytes(FILE *stream, size_t bytes);
+int compare_u32(const void *a, const void *b);
+u_int32_t percentile(u_int32_t *sorted, size_t count, double p);
 
 int info_init(info_t *info, glc_t *glc)
 {
@@ -128,6 +141,14 @@ int info_set_stream(info_t info, FILE *stream)
 	return 0;
 }
 
+int info_set_frame_times_stream(info_t info, FILE *stream)
+{
+	info->frame_times_stream = stream;
+	if (stream)
+		fprintf(stream, "stream,time,frametime,overhead,captured\n");
+	return 0;
+}
+
 int info_process_start(info_t info, ps_buffer_t *from)
 {
 	int ret;
@@ -174,7 +195,17 @@ void info_finish_callback(void *ptr, int err)
 		print_bytes(info->stream, video->bytes);
 		fprintf(info->stream, "  bps         = ");
 		print_bytes(info->stream, (video->bytes * 1000000) / info->time);
+		if (video->drops)
+			fprintf(info->stream, "  dropped     = %lu (%lu buffer full, %lu buffer busy)\n",
+				video->drops, video->drops_full, video->drops_busy);
 
+		if (video->swaps)
+			frame_times_summary(info, video);
+
+		if (video->frame_time)
+			free(video->frame_time);
+		if (video->overhead)
+			free(video->overhead);
 		free(video);
 	}
 
@@ -209,6 +240,10 @@ int info_read_callback(glc_thread_state_t *state)
 		audio_data_info(info, (glc_audio_data_header_t *) state->read_data);
 	else if (state->header.type == GLC_MESSAGE_COLOR)
 		color_info(info, (glc_color_message_t *) state->read_data);
+	else if (state->header.type == GLC_MESSAGE_FRAME_TIMES)
+		frame_times_info(info, (glc_frame_times_header_t *) state->read_data);
+	else if (state->header.type == GLC_MESSAGE_FRAME_DROP)
+		frame_drop_info(info, (glc_frame_drop_message_t *) state->read_data);
 	else if (state->header.type == GLC_MESSAGE_CLOSE) {
 		print_time(info->stream, info->time);
 		fprintf(info->stream, "end of stream\n");
@@ -308,6 +343,7 @@ void video_format_info(info_t info, glc_video_format_message_t *format_message)
 		}
 		fprintf(info->stream, "  flags       = ");
 		INFO_FLAG(format_message->flags, GLC_VIDEO_DWORD_ALIGNED)
+		INFO_FLAG(format_message->flags, GLC_VIDEO_CACHELINE_ALIGNED)
 		fprintf(info->stream, "\n");
 		fprintf(info->stream, "  width       = %u\n", format_message->width);
 		fprintf(info->stream, "  height      = %u\n", format_message->height);
@@ -341,10 +377,16 @@ void video_frame_info(info_t info, glc_video_frame_header_t *pic_header)
 		video->bytes += video->w * video->h * 3;
 		if (video->flags & GLC_VIDEO_DWORD_ALIGNED)
 			video->bytes += video->h * (8 - (video->w * 3) % 8);
+		else if ((video->flags & GLC_VIDEO_CACHELINE_ALIGNED) &&
+			 ((video->w * 3) % GLC_VIDEO_CACHELINE))
+			video->bytes += video->h * (GLC_VIDEO_CACHELINE - (video->w * 3) % GLC_VIDEO_CACHELINE);
 	} else if (video->format == GLC_VIDEO_BGRA) {
 		video->bytes += video->w * video->h * 4;
 		if (video->flags & GLC_VIDEO_DWORD_ALIGNED)
 			video->bytes += video->h * (8 - (video->w * 4) % 8);
+		else if ((video->flags & GLC_VIDEO_CACHELINE_ALIGNED) &&
+			 ((video->w * 4) % GLC_VIDEO_CACHELINE))
+			video->bytes += video->h * (GLC_VIDEO_CACHELINE - (video->w * 4) % GLC_VIDEO_CACHELINE);
 	} else if (video->format == GLC_VIDEO_YCBCR_420JPEG)
 		video->bytes += (video->w * video->h * 3) / 2;
 
@@ -426,6 +468,129 @@ void color_info(info_t info, glc_color_message_t *color_msg)
 		fprintf(info->stream, "color correction information for video %d\n", color_msg->id);
 }
 
+void frame_times_info(info_t info, glc_frame_times_header_t *times_msg)
+{
+	struct info_video_stream_s *video;
+	glc_frame_time_t *entry = (glc_frame_time_t *) &times_msg[1];
+	u_int32_t i, frame_time;
+
+	info_get_video_stream(info, &video, times_msg->id);
+
+	if (info->level >= INFO_DETAILED_PICTURE) {
+		print_time(info->stream, info->time);
+		fprintf(info->stream, "frame timing message\n");
+		fprintf(info->stream, "  stream id   = %d\n", times_msg->id);
+		fprintf(info->stream, "  swaps       = %u\n", times_msg->count);
+	} else if (info->level >= INFO_PICTURE) {
+		print_time(info->stream, info->time);
+		fprintf(info->stream, "frame timing (video %d, %u swaps)\n",
+			times_msg->id, times_msg->count);
+	}
+
+	/* make sure there is room for new entries */
+	if (video->swaps + times_msg->count > video->frame_times_size) {
+		while (video->swaps + times_msg->count > video->frame_times_size)
+			video->frame_times_size = video->frame_times_size ?
+						  video->frame_times_size * 2 : 1024;
+		video->frame_time = (u_int32_t *) realloc(video->frame_time,
+					sizeof(u_int32_t) * video->frame_times_size);
+		video->overhead = (u_int32_t *) realloc(video->overhead,
+					sizeof(u_int32_t) * video->frame_times_size);
+	}
+
+	for (i = 0; i < times_msg->count; i++) {
+		/* first swap doesn't have a frame time */
+		if (video->swaps)
+			frame_time = entry[i].time - video->last_swap_time;
+		else
+			frame_time = 0;
+
+		if (info->frame_times_stream) {
+			fprintf(info->frame_times_stream, "%d,%llu,", times_msg->id,
+				(unsigned long long) entry[i].time);
+			if (video->swaps)
+				fprintf(info->frame_times_stream, "%u", frame_time);
+			fprintf(info->frame_times_stream, ",%u,%d\n", entry[i].overhead,
+				(entry[i].flags & GLC_FRAME_TIME_CAPTURED) ? 1 : 0);
+		}
+
+		/* overhead is indexed by swap, frame time by interval */
+		if (video->swaps)
+			video->frame_time[video->frame_times++] = frame_time;
+		video->overhead[video->swaps] = entry[i].overhead;
+
+		if (entry[i].flags & GLC_FRAME_TIME_CAPTURED)
+			video->captured_swaps++;
+		video->last_swap_time = entry[i].time;
+		video->swaps++;
+	}
+}
+
+void frame_drop_info(info_t info, glc_frame_drop_message_t *drop_msg)
+{
+	struct info_video_stream_s *video;
+	info->time = drop_msg->time;
+
+	info_get_video_stream(info, &video, drop_msg->id);
+	video->drops++;
+
+	if (drop_msg->reason == GLC_FRAME_DROP_BUFFER_FULL)
+		video->drops_full++;
+	else if (drop_msg->reason == GLC_FRAME_DROP_BUFFER_BUSY)
+		video->drops_busy++;
+
+	if (info->level >= INFO_DETAILED_PICTURE) {
+		print_time(info->stream, info->time);
+		fprintf(info->stream, "dropped frame\n");
+		fprintf(info->stream, "  stream id   = %d\n", drop_msg->id);
+		fprintf(info->stream, "  time        = %lu\n", drop_msg->time);
+		fprintf(info->stream, "  reason      = ");
+		switch (drop_msg->reason) {
+			case GLC_FRAME_DROP_BUFFER_FULL:
+				fprintf(info->stream, "GLC_FRAME_DROP_BUFFER_FULL\n");
+				break;
+			case GLC_FRAME_DROP_BUFFER_BUSY:
+				fprintf(info->stream, "GLC_FRAME_DROP_BUFFER_BUSY\n");
+				break;
+			case GLC_FRAME_DROP_NO_KEY_FRAME:
+				fprintf(info->stream, "GLC_FRAME_DROP_NO_KEY_FRAME\n");
+				break;
+			default:
+				fprintf(info->stream, "unknown reason 0x%02x\n", drop_msg->reason);
+		}
+	} else if (info->level >= INFO_PICTURE) {
+		print_time(info->stream, info->time);
+		fprintf(info->stream, "dropped frame (video %d)\n", drop_msg->id);
+	}
+}
+
+void frame_times_summary(info_t info, struct info_video_stream_s *video)
+{
+	size_t n = video->frame_times;
+
+	fprintf(info->stream, "  swaps       = %lu (%lu captured)\n",
+		video->swaps, video->captured_swaps);
+
+	qsort(video->overhead, video->swaps, sizeof(u_int32_t), compare_u32);
+	fprintf(info->stream, "  overhead    = p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+		percentile(video->overhead, video->swaps, 0.5) / 1000.0,
+		percentile(video->overhead, video->swaps, 0.99) / 1000.0,
+		video->overhead[video->swaps - 1] / 1000.0);
+
+	if (!n)
+		return;
+
+	qsort(video->frame_time, n, sizeof(u_int32_t), compare_u32);
+
+	fprintf(info->stream, "  frame time  = p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, "
+		"p99.9 %.2f ms, max %.2f ms\n",
+		percentile(video->frame_time, n, 0.5) / 1000.0,
+		percentile(video->frame_time, n, 0.9) / 1000.0,
+		percentile(video->frame_time, n, 0.99) / 1000.0,
+		percentile(video->frame_time, n, 0.999) / 1000.0,
+		video->frame_time[n - 1] / 1000.0);
+}
+
 /*
 void stream_info(info_t info)
 {
@@ -453,6 +618,24 @@ void print_time(FILE *stream, glc_utime_t time)
 	fprintf(stream, "[%7.2fs] ", (double) time / 1000000.0);
 }
 
+int compare_u32(const void *a, const void *b)
+{
+	u_int32_t va = *((const u_int32_t *) a);
+	u_int32_t vb = *((const u_int32_t *) b);
+	return (va > vb) - (va < vb);
+}
+
+u_int32_t percentile(u_int32_t *sorted, size_t count, double p)
+{
+	/* nearest-rank percentile */
+	size_t i = (size_t) (p * (double) count + 0.5);
+	if (i > 0)
+		i--;
+	if (i >= count)
+		i = count - 1;
+	return sorted[i];
+}
+
 void print_bytes(FILE *stream, size_t bytes)
 {
 	if (bytes >= 1024 * 1024 * 1024)
@@ -66,6 +66,18 @@ __PUBLIC int info_set_level(info_t info, int level);
  */
 __PUBLIC int info_set_stream(info_t info, FILE *stream);
 
+/**
+ * \brief set frame timing output stream
+ *
+ * If set, info writes every entry from GLC_MESSAGE_FRAME_TIMES
+ * messages into stream as CSV (stream, time, frame time, overhead,
+ * captured). Times are in microseconds.
+ * \param info info object
+ * \param stream output stream or NULL to disable
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int info_set_frame_times_stream(info_t info, FILE *stream);
+
 /**
  * \brief start info process
  *
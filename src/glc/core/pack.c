@@ -17,10 +17,13 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
 #include <glc/common/log.h>
+#include <glc/common/state.h>
 #include <glc/common/thread.h>
 #include <glc/common/util.h>
 
@@ -49,32 +52,299 @@
 # include <lzjb.h>
 #endif
 
+#ifdef __LZ4
+# include <lz4.h>
+# define __lz4_worstcase(size) LZ4_COMPRESSBOUND(size)
+#endif
+
+struct pack_delta_stream_s {
+	glc_stream_id_t id;
+	char *ref;
+	size_t size;
+	unsigned int frames;
+
+	struct pack_delta_stream_s *next;
+};
+
+struct pack_layout_stream_s {
+	glc_stream_id_t id;
+	glc_video_format_t format;
+	u_int32_t width, height;
+
+	struct pack_layout_stream_s *next;
+};
+
+struct pack_audio_stream_s {
+	glc_stream_id_t id;
+	glc_audio_format_t format;
+	glc_flags_t flags;
+	u_int32_t channels;
+
+	struct pack_audio_stream_s *next;
+};
+
+struct pack_bits_s {
+	unsigned char *data;
+	size_t pos, size;
+	u_int64_t acc;
+	unsigned int count;
+	int overflow;
+};
+
+struct unpack_bits_s {
+	const unsigned char *data;
+	size_t pos, size;
+	u_int64_t acc;
+	unsigned int count;
+	int underflow;
+};
+
+/* codec index 0 is 'none', 1 - 4 are PACK_QUICKLZ ... PACK_LZ4 */
+#define PACK_CODECS                      5
+/* every Nth packet of a stream re-measures one codec */
+#define PACK_ADAPTIVE_EXPLORE           32
+/* worse compression ratio than this isn't worth it */
+#define PACK_ADAPTIVE_MAX_RATIO       0.95
+
+/* probe compresses this many evenly spaced chunks of packet */
+#define PACK_PROBE_CHUNKS                4
+#define PACK_PROBE_CHUNK_SIZE         4096
+/* stream stops compressing above skip ratio, resumes below resume ratio */
+#define PACK_PROBE_SKIP_RATIO         0.97
+#define PACK_PROBE_RESUME_RATIO       0.90
+/* consecutive probes needed to change state */
+#define PACK_PROBE_HYSTERESIS            3
+
+struct pack_codec_stats_s {
+	double ratio, speed;
+	unsigned long samples, packets;
+	u_int64_t in, out;
+};
+
+struct pack_stream_s {
+	glc_message_type_t type;
+	glc_stream_id_t id;
+	unsigned long packets, raw;
+	struct pack_codec_stats_s codec[PACK_CODECS];
+
+	int skip;
+	unsigned int probe_hits;
+	unsigned long probed, skipped;
+
+	struct pack_stream_s *next;
+};
+
+struct pack_thread_s {
+	void *wrk;
+	char *scratch;
+	size_t scratch_size;
+
+	/* compressed packet is built here before write packet is opened */
+	char *out;
+	size_t out_size;
+
+	int layout;
+	glc_video_layout_header_t layout_header;
+	char *planes;
+	size_t planes_size;
+
+	int audio;
+	glc_audio_lpc_header_t audio_header;
+	char *samples;
+	size_t samples_size;
+
+	int codec;
+	struct pack_stream_s *stream;
+
+	char *probe;
+	size_t probe_size;
+	struct pack_stream_s *probe_stream;
+
+	int blocks;
+	size_t *block_sizes;
+	size_t block_sizes_count;
+};
+
+struct pack_batch_s;
+typedef int (*pack_batch_func_t)(struct pack_batch_s *batch, unsigned int index,
+				 void *threadptr);
+
+/* set of independent jobs, run by pool workers and submitting thread */
+struct pack_batch_s {
+	pack_batch_func_t func;
+	void *arg;
+	unsigned int count, next, done;
+	int ret;
+
+	struct pack_batch_s *next_batch;
+};
+
+struct pack_pool_worker_s {
+	struct pack_pool_s *pool;
+	pthread_t pthread_thread;
+	void *threadptr;
+};
+
+struct pack_pool_s {
+	glc_t *glc;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond, done_cond;
+	struct pack_batch_s *batch;
+	int stop;
+
+	size_t threads;
+	struct pack_pool_worker_s *worker;
+	void *ptr;
+	void (*thread_finish_callback)(void *, void *, int);
+};
+
+/* block compression job */
+struct pack_blocks_s {
+	pack_t pack;
+	int compression;
+	const char *src;
+	char *dst;
+	size_t size, block_size, block_worstcase;
+	size_t *sizes;
+};
+
 struct pack_s {
 	glc_t *glc;
 	glc_thread_t thread;
 	size_t compress_min;
 	int running;
 	int compression;
+
+	unsigned int delta_interval;
+	struct pack_delta_stream_s *delta_stream;
+
+	int layout, ycocg;
+	struct pack_layout_stream_s *layout_stream;
+
+	int lpc;
+	struct pack_audio_stream_s *audio_stream;
+
+	size_t block_size;
+	struct pack_pool_s *pool;
+
+	double adaptive_target;
+	int probe;
+	pthread_mutex_t stream_mutex;
+	struct pack_stream_s *stream;
+};
+
+struct unpack_thread_s {
+	char *scratch;
+	size_t scratch_size;
+	int delta;
+	unsigned long delta_seq;
+
+	size_t *block_offsets;
+	size_t block_offsets_count;
+
+	char *planes;
+	size_t planes_size;
+
+	char *samples;
+	size_t samples_size;
+};
+
+/* block decompression job */
+struct unpack_blocks_s {
+	unpack_t unpack;
+	glc_message_type_t compression;
+	const char *src;
+	char *dst;
+	size_t size, block_size;
+	size_t *offsets;
 };
 
 struct unpack_s {
 	glc_t *glc;
 	glc_thread_t thread;
 	int running;
+
+	pthread_mutex_t pool_mutex;
+	struct pack_pool_s *pool;
+
+	/* delta coded frames are restored in stream order */
+	pthread_mutex_t delta_mutex;
+	pthread_cond_t delta_cond;
+	unsigned long delta_next, delta_done;
+	struct pack_delta_stream_s *delta_stream;
 };
 
 int pack_thread_create_callback(void *ptr, void **threadptr);
 void pack_thread_finish_callback(void *ptr, void *threadptr, int err);
 int pack_read_callback(glc_thread_state_t *state);
-int pack_quicklz_write_callback(glc_thread_state_t *state);
-int pack_lzo_write_callback(glc_thread_state_t *state);
-int pack_lzjb_write_callback(glc_thread_state_t *state);
+int pack_process_callback(glc_thread_state_t *state);
+int pack_codec_write(glc_thread_state_t *state, int compression);
+int pack_write_callback(glc_thread_state_t *state);
 void pack_finish_callback(void *ptr, int err);
 
+size_t pack_codec_worstcase(int compression, size_t size);
+size_t pack_codec_header_size(int compression);
+size_t pack_codec_wrk_size(int compression);
+const char *pack_codec_name(int compression);
+glc_message_type_t pack_codec_message(int compression);
+int pack_codec_compress(int compression, void *wrk, const char *src, size_t size,
+			char *dst, size_t *compressed_size);
+int unpack_codec_decompress(glc_message_type_t compression, const char *src,
+			    size_t src_size, char *dst, size_t size);
+
+int pack_pool_create(struct pack_pool_s **pool, glc_t *glc, size_t threads,
+		     int (*thread_create_callback)(void *, void **),
+		     void (*thread_finish_callback)(void *, void *, int),
+		     void *ptr);
+int pack_pool_destroy(struct pack_pool_s *pool);
+int pack_pool_run(struct pack_pool_s *pool, struct pack_batch_s *batch, void *threadptr);
+void *pack_pool_thread(void *argptr);
+
+int pack_blocks_write(pack_t pack, glc_thread_state_t *state);
+int pack_blocks_compress(struct pack_batch_s *batch, unsigned int index, void *threadptr);
+int unpack_blocks(unpack_t unpack, glc_thread_state_t *state, char *dest, size_t size);
+int unpack_blocks_decompress(struct pack_batch_s *batch, unsigned int index, void *threadptr);
+
+struct pack_stream_s *pack_get_stream(pack_t pack, glc_message_type_t type,
+				      glc_stream_id_t id);
+int pack_probe(pack_t pack, glc_thread_state_t *state);
+void pack_report(pack_t pack);
+int pack_adaptive_select(pack_t pack, glc_thread_state_t *state);
+int pack_adaptive_write(pack_t pack, glc_thread_state_t *state);
+void pack_adaptive_report(pack_t pack);
+
+int pack_delta(pack_t pack, glc_thread_state_t *state);
+struct pack_delta_stream_s *pack_delta_get_stream(struct pack_delta_stream_s **list,
+						  glc_stream_id_t id);
+void pack_delta_free_streams(struct pack_delta_stream_s *list);
+void pack_delta_reset(pack_t pack);
+int pack_scratch(char **scratch, size_t *scratch_size, size_t size);
+
+int pack_layout_format(pack_t pack, glc_thread_state_t *state);
+int pack_layout_select(pack_t pack, glc_thread_state_t *state);
+int pack_layout(pack_t pack, glc_thread_state_t *state);
+
+int pack_audio_format(pack_t pack, glc_thread_state_t *state);
+size_t pack_audio_sample_size(glc_audio_format_t format);
+int pack_audio_select(pack_t pack, glc_thread_state_t *state);
+size_t pack_audio_code(const int32_t *x, size_t frames, size_t sample_size,
+		       unsigned char *dst, size_t size, unsigned int *order);
+int pack_audio_write(pack_t pack, glc_thread_state_t *state);
+
+int unpack_thread_create_callback(void *ptr, void **threadptr);
+void unpack_thread_finish_callback(void *ptr, void *threadptr, int err);
 int unpack_read_callback(glc_thread_state_t *state);
 int unpack_write_callback(glc_thread_state_t *state);
 void unpack_finish_callback(void *ptr, int err);
 
+int unpack_decompress(glc_thread_state_t *state, char *dest, size_t size);
+int unpack_delta(unpack_t unpack, struct unpack_thread_s *thread,
+		 glc_thread_state_t *state, char *src, size_t size);
+int unpack_layout(glc_thread_state_t *state, char *dest, size_t size);
+int unpack_audio(glc_thread_state_t *state, char *dest, size_t size);
+int unpack_audio_decode(int32_t *x, size_t frames, size_t sample_size,
+			const unsigned char *src, size_t size, unsigned int order);
+
 int pack_init(pack_t *pack, glc_t *glc)
 {
 	*pack = (pack_t) malloc(sizeof(struct pack_s));
@@ -82,12 +352,15 @@ int pack_init(pack_t *pack, glc_t *glc)
 
 	(*pack)->glc = glc;
 	(*pack)->compress_min = 1024;
+	(*pack)->adaptive_target = 200.0;
+	pthread_mutex_init(&(*pack)->stream_mutex, NULL);
 
 	(*pack)->thread.flags = GLC_THREAD_WRITE | GLC_THREAD_READ;
 	(*pack)->thread.ptr = *pack;
 	(*pack)->thread.thread_create_callback = &pack_thread_create_callback;
 	(*pack)->thread.thread_finish_callback = &pack_thread_finish_callback;
 	(*pack)->thread.read_callback = &pack_read_callback;
+	(*pack)->thread.process_callback = &pack_process_callback;
 	(*pack)->thread.finish_callback = &pack_finish_callback;
 	(*pack)->thread.threads = glc_threads_hint(glc);
 
@@ -97,6 +370,8 @@ int pack_init(pack_t *pack, glc_t *glc)
 	pack_set_compression(*pack, PACK_LZO);
 #elif defined __LZJB
 	pack_set_compression(*pack, PACK_LZJB);
+#elif defined __LZ4
+	pack_set_compression(*pack, PACK_LZ4);
 #else
 	glc_log((*pack)->glc, GLC_ERROR, "pack",
 		 "no supported compression algorithms found");
@@ -113,7 +388,6 @@ int pack_set_compression(pack_t pack, int compression)
 
 	if (compression == PACK_QUICKLZ) {
 #ifdef __QUICKLZ
-		pack->thread.write_callback = &pack_quicklz_write_callback;
 		glc_log(pack->glc, GLC_INFORMATION, "pack",
 			 "compressing using QuickLZ");
 #else
@@ -123,7 +397,6 @@ int pack_set_compression(pack_t pack, int compression)
 #endif
 	} else if (compression == PACK_LZO) {
 #ifdef __LZO
-		pack->thread.write_callback = &pack_lzo_write_callback;
 		glc_log(pack->glc, GLC_INFORMATION, "pack",
 			 "compressing using LZO");
 		lzo_init();
@@ -134,13 +407,34 @@ int pack_set_compression(pack_t pack, int compression)
 #endif
 	} else if (compression == PACK_LZJB) {
 #ifdef __LZJB
-		pack->thread.write_callback = &pack_lzjb_write_callback;
 		glc_log(pack->glc, GLC_INFORMATION, "pack",
 			"compressing using LZJB");
 #else
 		glc_log(pack->glc, GLC_ERROR, "pack",
 			"LZJB not supported");
 		return ENOTSUP;
+#endif
+	} else if (compression == PACK_LZ4) {
+#ifdef __LZ4
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "compressing using LZ4");
+#else
+		glc_log(pack->glc, GLC_ERROR, "pack",
+			 "LZ4 not supported");
+		return ENOTSUP;
+#endif
+	} else if (compression == PACK_ADAPTIVE) {
+		if ((!pack_codec_worstcase(PACK_QUICKLZ, 1)) && (!pack_codec_worstcase(PACK_LZO, 1)) &&
+		    (!pack_codec_worstcase(PACK_LZJB, 1)) && (!pack_codec_worstcase(PACK_LZ4, 1))) {
+			glc_log(pack->glc, GLC_ERROR, "pack",
+				 "no supported compression algorithms found");
+			return ENOTSUP;
+		}
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "selecting compression per packet, target %.0f MiB/s",
+			 pack->adaptive_target);
+#ifdef __LZO
+		lzo_init();
 #endif
 	} else {
 		glc_log(pack->glc, GLC_ERROR, "pack",
@@ -165,12 +459,112 @@ int pack_set_minimum_size(pack_t pack, size_t min_size)
 	return 0;
 }
 
+int pack_set_delta(pack_t pack, unsigned int interval)
+{
+	if (pack->running)
+		return EALREADY;
+
+	if (interval)
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "delta coding video, key frame every %u frames", interval);
+
+	pack->delta_interval = interval;
+	return 0;
+}
+
+int pack_set_layout(pack_t pack, int layout)
+{
+	if (pack->running)
+		return EALREADY;
+
+	if (layout)
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "storing BGR(A) video in planar layout");
+
+	pack->layout = layout;
+	return 0;
+}
+
+int pack_set_ycocg(pack_t pack, int ycocg)
+{
+	if (pack->running)
+		return EALREADY;
+
+	if (ycocg)
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "applying YCoCg-R transform to planar video");
+
+	pack->ycocg = ycocg;
+	return 0;
+}
+
+int pack_set_lpc(pack_t pack, int lpc)
+{
+	if (pack->running)
+		return EALREADY;
+
+	if (lpc)
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "coding audio losslessly with linear prediction");
+
+	pack->lpc = lpc;
+	return 0;
+}
+
+int pack_set_adaptive_target(pack_t pack, unsigned int throughput)
+{
+	if (pack->running)
+		return EALREADY;
+
+	if (!throughput)
+		return EINVAL;
+
+	pack->adaptive_target = throughput;
+	return 0;
+}
+
+int pack_set_probe(pack_t pack, int probe)
+{
+	if (pack->running)
+		return EALREADY;
+
+	if (probe)
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "probing packets, incompressible streams are stored uncompressed");
+
+	pack->probe = probe;
+	return 0;
+}
+
+int pack_set_block_size(pack_t pack, size_t block_size)
+{
+	if (pack->running)
+		return EALREADY;
+
+	if (block_size > 0xffffffff)
+		return EINVAL;
+
+	if (block_size)
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "compressing packets in %zd byte blocks", block_size);
+
+	pack->block_size = block_size;
+	return 0;
+}
+
 int pack_process_start(pack_t pack, ps_buffer_t *from, ps_buffer_t *to)
 {
 	int ret;
 	if (pack->running)
 		return EAGAIN;
 
+	if (pack->block_size) {
+		if ((ret = pack_pool_create(&pack->pool, pack->glc, glc_threads_hint(pack->glc),
+					    &pack_thread_create_callback,
+					    &pack_thread_finish_callback, pack)))
+			return ret;
+	}
+
 	if ((ret = glc_thread_create(pack->glc, &pack->thread, from, to)))
 		return ret;
 	pack->running = 1;
@@ -186,11 +580,42 @@ int pack_process_wait(pack_t pack)
 	glc_thread_wait(&pack->thread);
 	pack->running = 0;
 
+	if (pack->pool) {
+		pack_pool_destroy(pack->pool);
+		pack->pool = NULL;
+	}
+
+	pack_report(pack);
+
 	return 0;
 }
 
 int pack_destroy(pack_t pack)
 {
+	struct pack_stream_s *del;
+	struct pack_layout_stream_s *del_layout;
+	struct pack_audio_stream_s *del_audio;
+
+	while (pack->stream != NULL) {
+		del = pack->stream;
+		pack->stream = del->next;
+		free(del);
+	}
+
+	while (pack->layout_stream != NULL) {
+		del_layout = pack->layout_stream;
+		pack->layout_stream = del_layout->next;
+		free(del_layout);
+	}
+
+	while (pack->audio_stream != NULL) {
+		del_audio = pack->audio_stream;
+		pack->audio_stream = del_audio->next;
+		free(del_audio);
+	}
+
+	pthread_mutex_destroy(&pack->stream_mutex);
+	pack_delta_free_streams(pack->delta_stream);
 	free(pack);
 	return 0;
 }
@@ -206,15 +631,18 @@ void pack_finish_callback(void *ptr, int err)
 int pack_thread_create_callback(void *ptr, void **threadptr)
 {
 	pack_t pack = (pack_t) ptr;
+	struct pack_thread_s *thread;
 
-	if (pack->compression == PACK_QUICKLZ) {
-#ifdef __QUICKLZ
-		*threadptr = malloc(__quicklz_hashtable);
-#endif
-	} else if (pack->compression == PACK_LZO) {
-#ifdef __LZO
-		*threadptr = malloc(__lzo_wrk_mem);
-#endif
+	size_t wrk_size;
+
+	thread = (struct pack_thread_s *) malloc(sizeof(struct pack_thread_s));
+	memset(thread, 0, sizeof(struct pack_thread_s));
+	*threadptr = thread;
+
+	/* in adaptive mode this is big enough for any codec */
+	if ((wrk_size = pack_codec_wrk_size(pack->compression))) {
+		if (!(thread->wrk = malloc(wrk_size)))
+			return ENOMEM;
 	}
 
 	return 0;
@@ -222,146 +650,1688 @@ int pack_thread_create_callback(void *ptr, void **threadptr)
 
 void pack_thread_finish_callback(void *ptr, void *threadptr, int err)
 {
-	if (threadptr)
-		free(threadptr);
+	struct pack_thread_s *thread = (struct pack_thread_s *) threadptr;
+
+	if (!thread)
+		return;
+
+	if (thread->wrk)
+		free(thread->wrk);
+	if (thread->scratch)
+		free(thread->scratch);
+	if (thread->out)
+		free(thread->out);
+	if (thread->planes)
+		free(thread->planes);
+	if (thread->samples)
+		free(thread->samples);
+	if (thread->block_sizes)
+		free(thread->block_sizes);
+	if (thread->probe)
+		free(thread->probe);
+	free(thread);
 }
 
-int pack_read_callback(glc_thread_state_t *state)
+int pack_scratch(char **scratch, size_t *scratch_size, size_t size)
 {
-	pack_t pack = (pack_t) state->ptr;
+	if (size <= *scratch_size)
+		return 0;
 
-	/* compress only audio and pictures */
-	if ((state->read_size > pack->compress_min) &&
-	    ((state->header.type == GLC_MESSAGE_VIDEO_FRAME) |
-	     (state->header.type == GLC_MESSAGE_AUDIO_DATA))) {
-		if (pack->compression == PACK_QUICKLZ) {
+	if (*scratch)
+		free(*scratch);
+	if (!(*scratch = (char *) malloc(size))) {
+		*scratch_size = 0;
+		return ENOMEM;
+	}
+	*scratch_size = size;
+	return 0;
+}
+
+size_t pack_codec_worstcase(int compression, size_t size)
+{
+	if (compression == PACK_QUICKLZ) {
 #ifdef __QUICKLZ
-			state->write_size = sizeof(glc_container_message_header_t)
-					    + sizeof(glc_quicklz_header_t)
-					    + __quicklz_worstcase(state->read_size);
-#else
-			goto copy;
+		return __quicklz_worstcase(size);
 #endif
-		} else if (pack->compression == PACK_LZO) {
+	} else if (compression == PACK_LZO) {
 #ifdef __LZO
-			state->write_size = sizeof(glc_container_message_header_t)
-					    + sizeof(glc_lzo_header_t)
-			                    + __lzo_worstcase(state->read_size);
-#else
-			goto copy;
+		return __lzo_worstcase(size);
 #endif
-		} else if (pack->compression == PACK_LZJB) {
+	} else if (compression == PACK_LZJB) {
 #ifdef __LZJB
-			state->write_size = sizeof(glc_container_message_header_t)
-					    + sizeof(glc_lzjb_header_t)
-					    + __lzjb_worstcase(state->read_size);
-#else
-			goto copy;
+		return __lzjb_worstcase(size);
+#endif
+	} else if (compression == PACK_LZ4) {
+#ifdef __LZ4
+		/* LZ4 takes int sizes */
+		if (size > LZ4_MAX_INPUT_SIZE)
+			return 0;
+		return __lz4_worstcase(size);
 #endif
-		} else
-			goto copy;
-
-		return 0;
 	}
-copy:
-	state->flags |= GLC_THREAD_COPY;
+
 	return 0;
 }
 
-int pack_lzo_write_callback(glc_thread_state_t *state)
+size_t pack_codec_header_size(int compression)
 {
-#ifdef __LZO
-	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
-	glc_lzo_header_t *lzo_header =
-		(glc_lzo_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
-	lzo_uint compressed_size;
+	if (compression == PACK_QUICKLZ)
+		return sizeof(glc_quicklz_header_t);
+	else if (compression == PACK_LZO)
+		return sizeof(glc_lzo_header_t);
+	else if (compression == PACK_LZJB)
+		return sizeof(glc_lzjb_header_t);
+	else if (compression == PACK_LZ4)
+		return sizeof(glc_lz4_header_t);
+	return 0;
+}
 
-	__lzo_compress((unsigned char *) state->read_data, state->read_size,
-		       (unsigned char *) &state->write_data[sizeof(glc_lzo_header_t) +
-		       					    sizeof(glc_container_message_header_t)],
-		       &compressed_size, (lzo_voidp) state->threadptr);
+size_t pack_codec_wrk_size(int compression)
+{
+	size_t size = 0;
+	int codec;
+
+	if (compression == PACK_ADAPTIVE) {
+		for (codec = 1; codec < PACK_CODECS; codec++) {
+			if ((pack_codec_worstcase(codec, 1)) &&
+			    (pack_codec_wrk_size(codec) > size))
+				size = pack_codec_wrk_size(codec);
+		}
+		return size;
+	}
 
-	lzo_header->size = (glc_size_t) state->read_size;
-	memcpy(&lzo_header->header, &state->header, sizeof(glc_message_header_t));
+	if (compression == PACK_QUICKLZ) {
+#ifdef __QUICKLZ
+		size = __quicklz_hashtable;
+#endif
+	} else if (compression == PACK_LZO) {
+#ifdef __LZO
+		size = __lzo_wrk_mem;
+#endif
+	} else if (compression == PACK_LZ4) {
+#ifdef __LZ4
+		size = LZ4_sizeofState();
+#endif
+	}
 
-	container->size = compressed_size + sizeof(glc_lzo_header_t);
-	container->header.type = GLC_MESSAGE_LZO;
+	return size;
+}
 
-	state->header.type = GLC_MESSAGE_CONTAINER;
+const char *pack_codec_name(int compression)
+{
+	if (compression == PACK_QUICKLZ)
+		return "quicklz";
+	else if (compression == PACK_LZO)
+		return "lzo";
+	else if (compression == PACK_LZJB)
+		return "lzjb";
+	else if (compression == PACK_LZ4)
+		return "lz4";
+	return "none";
+}
 
+glc_message_type_t pack_codec_message(int compression)
+{
+	if (compression == PACK_QUICKLZ)
+		return GLC_MESSAGE_QUICKLZ;
+	else if (compression == PACK_LZO)
+		return GLC_MESSAGE_LZO;
+	else if (compression == PACK_LZJB)
+		return GLC_MESSAGE_LZJB;
+	else if (compression == PACK_LZ4)
+		return GLC_MESSAGE_LZ4;
 	return 0;
-#else
-	return ENOTSUP;
-#endif
 }
 
-int pack_quicklz_write_callback(glc_thread_state_t *state)
+int pack_codec_compress(int compression, void *wrk, const char *src, size_t size,
+			char *dst, size_t *compressed_size)
 {
+	if (compression == PACK_QUICKLZ) {
 #ifdef __QUICKLZ
-	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
-	glc_quicklz_header_t *quicklz_header =
-		(glc_quicklz_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
-	size_t compressed_size;
-
-	quicklz_compress((const unsigned char *) state->read_data,
-			 (unsigned char *) &state->write_data[sizeof(glc_quicklz_header_t) +
-			 				      sizeof(glc_container_message_header_t)],
-			 state->read_size, &compressed_size,
-			 (uintptr_t *) state->threadptr);
-
-	quicklz_header->size = (glc_size_t) state->read_size;
-	memcpy(&quicklz_header->header, &state->header, sizeof(glc_message_header_t));
+		quicklz_compress((const unsigned char *) src, (unsigned char *) dst,
+				 size, compressed_size, (uintptr_t *) wrk);
+		return 0;
+#endif
+	} else if (compression == PACK_LZO) {
+#ifdef __LZO
+		lzo_uint lzo_size;
+		__lzo_compress((unsigned char *) src, size, (unsigned char *) dst,
+			       &lzo_size, (lzo_voidp) wrk);
+		*compressed_size = lzo_size;
+		return 0;
+#endif
+	} else if (compression == PACK_LZJB) {
+#ifdef __LZJB
+		*compressed_size = lzjb_compress((char *) src, dst, size);
+		return 0;
+#endif
+	} else if (compression == PACK_LZ4) {
+#ifdef __LZ4
+		int lz4_size = LZ4_compress_fast_extState(wrk, src, dst, size,
+							  __lz4_worstcase(size), 1);
+		if (lz4_size <= 0)
+			return EINVAL;
+		*compressed_size = lz4_size;
+		return 0;
+#endif
+	}
 
-	container->size = compressed_size + sizeof(glc_quicklz_header_t);
-	container->header.type = GLC_MESSAGE_QUICKLZ;
+	return ENOTSUP;
+}
 
-	state->header.type = GLC_MESSAGE_CONTAINER;
+int unpack_codec_decompress(glc_message_type_t compression, const char *src,
+			    size_t src_size, char *dst, size_t size)
+{
+	if (compression == GLC_MESSAGE_QUICKLZ) {
+#ifdef __QUICKLZ
+		quicklz_decompress((const unsigned char *) src, (unsigned char *) dst, size);
+		return 0;
+#endif
+	} else if (compression == GLC_MESSAGE_LZO) {
+#ifdef __LZO
+		lzo_uint lzo_size = size;
+		__lzo_decompress((unsigned char *) src, src_size, (unsigned char *) dst,
+				 &lzo_size, NULL);
+		return 0;
+#endif
+	} else if (compression == GLC_MESSAGE_LZJB) {
+#ifdef __LZJB
+		lzjb_decompress((char *) src, dst, src_size, size);
+		return 0;
+#endif
+	} else if (compression == GLC_MESSAGE_LZ4) {
+#ifdef __LZ4
+		if (LZ4_decompress_safe(src, dst, src_size, size) != (int) size)
+			return EINVAL;
+		return 0;
+#endif
+	}
 
-	return 0;
-#else
 	return ENOTSUP;
-#endif
 }
 
-int pack_lzjb_write_callback(glc_thread_state_t *state)
+int pack_pool_create(struct pack_pool_s **pool, glc_t *glc, size_t threads,
+		     int (*thread_create_callback)(void *, void **),
+		     void (*thread_finish_callback)(void *, void *, int),
+		     void *ptr)
 {
-#ifdef __LZJB
-	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
-	glc_lzjb_header_t *lzjb_header =
-		(glc_lzjb_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
+	struct pack_pool_worker_s *worker;
+	pthread_attr_t attr;
+	size_t t;
+	int ret;
 
-	size_t compressed_size = lzjb_compress(state->read_data,
-					       &state->write_data[sizeof(glc_lzjb_header_t) +
-					       			  sizeof(glc_container_message_header_t)],
-					       state->read_size);
+	*pool = (struct pack_pool_s *) malloc(sizeof(struct pack_pool_s));
+	memset(*pool, 0, sizeof(struct pack_pool_s));
 
-	lzjb_header->size = (glc_size_t) state->read_size;
-	memcpy(&lzjb_header->header, &state->header, sizeof(glc_message_header_t));
+	(*pool)->glc = glc;
+	(*pool)->ptr = ptr;
+	(*pool)->thread_finish_callback = thread_finish_callback;
+	pthread_mutex_init(&(*pool)->mutex, NULL);
+	pthread_cond_init(&(*pool)->work_cond, NULL);
+	pthread_cond_init(&(*pool)->done_cond, NULL);
 
-	container->size = compressed_size + sizeof(glc_lzjb_header_t);
-	container->header.type = GLC_MESSAGE_LZJB;
+	(*pool)->worker = (struct pack_pool_worker_s *)
+		malloc(sizeof(struct pack_pool_worker_s) * threads);
+	memset((*pool)->worker, 0, sizeof(struct pack_pool_worker_s) * threads);
 
-	state->header.type = GLC_MESSAGE_CONTAINER;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+	for (t = 0; t < threads; t++) {
+		worker = &(*pool)->worker[t];
+		worker->pool = *pool;
+
+		if (thread_create_callback) {
+			if ((ret = thread_create_callback(ptr, &worker->threadptr)))
+				goto err;
+		}
 
+		if ((ret = pthread_create(&worker->pthread_thread, &attr,
+					  pack_pool_thread, worker)))
+			goto err;
+		(*pool)->threads++;
+	}
+
+	pthread_attr_destroy(&attr);
 	return 0;
-#else
-	return ENOTSUP;
-#endif
+err:
+	pthread_attr_destroy(&attr);
+	glc_log(glc, GLC_ERROR, "pack", "can't create worker thread: %s (%d)",
+		 strerror(ret), ret);
+	if ((thread_finish_callback) && (worker->threadptr))
+		thread_finish_callback(ptr, worker->threadptr, ret);
+	pack_pool_destroy(*pool);
+	*pool = NULL;
+	return ret;
 }
 
-int unpack_init(unpack_t *unpack, glc_t *glc)
+int pack_pool_destroy(struct pack_pool_s *pool)
 {
-	*unpack = (unpack_t) malloc(sizeof(struct unpack_s));
-	memset(*unpack, 0, sizeof(struct unpack_s));
+	size_t t;
 
-	(*unpack)->glc = glc;
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
 
-	(*unpack)->thread.flags = GLC_THREAD_WRITE | GLC_THREAD_READ;
-	(*unpack)->thread.ptr = *unpack;
-	(*unpack)->thread.read_callback = &unpack_read_callback;
-	(*unpack)->thread.write_callback = &unpack_write_callback;
-	(*unpack)->thread.finish_callback = &unpack_finish_callback;
-	(*unpack)->thread.threads = glc_threads_hint(glc);
+	for (t = 0; t < pool->threads; t++) {
+		pthread_join(pool->worker[t].pthread_thread, NULL);
+		if (pool->thread_finish_callback)
+			pool->thread_finish_callback(pool->ptr, pool->worker[t].threadptr, 0);
+	}
+
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+	free(pool->worker);
+	free(pool);
+	return 0;
+}
+
+static void pack_pool_dequeue(struct pack_pool_s *pool, struct pack_batch_s *batch)
+{
+	struct pack_batch_s **prev = &pool->batch;
+
+	while (*prev != NULL) {
+		if (*prev == batch) {
+			*prev = batch->next_batch;
+			return;
+		}
+		prev = &(*prev)->next_batch;
+	}
+}
+
+/**
+ * \brief run job [index] of batch, pool mutex must be held
+ */
+static void pack_pool_job(struct pack_pool_s *pool, struct pack_batch_s *batch,
+			  unsigned int index, void *threadptr)
+{
+	int ret;
+
+	if (batch->next == batch->count)
+		pack_pool_dequeue(pool, batch);
+
+	pthread_mutex_unlock(&pool->mutex);
+	ret = batch->func(batch, index, threadptr);
+	pthread_mutex_lock(&pool->mutex);
+
+	if (ret)
+		batch->ret = ret;
+	if (++batch->done == batch->count)
+		pthread_cond_broadcast(&pool->done_cond);
+}
+
+void *pack_pool_thread(void *argptr)
+{
+	struct pack_pool_worker_s *worker = (struct pack_pool_worker_s *) argptr;
+	struct pack_pool_s *pool = worker->pool;
+	struct pack_batch_s *batch;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		/* queued batches always have jobs left */
+		while ((!pool->stop) && (pool->batch == NULL))
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+
+		if (pool->stop)
+			break;
+
+		batch = pool->batch;
+		pack_pool_job(pool, batch, batch->next++, worker->threadptr);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+int pack_pool_run(struct pack_pool_s *pool, struct pack_batch_s *batch, void *threadptr)
+{
+	struct pack_batch_s **tail;
+
+	batch->next = batch->done = 0;
+	batch->ret = 0;
+	batch->next_batch = NULL;
+
+	if (!batch->count)
+		return 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	tail = &pool->batch;
+	while (*tail != NULL)
+		tail = &(*tail)->next_batch;
+	*tail = batch;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	/* help instead of just waiting */
+	while (batch->next < batch->count)
+		pack_pool_job(pool, batch, batch->next++, threadptr);
+
+	while (batch->done < batch->count)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return batch->ret;
+}
+
+struct pack_delta_stream_s *pack_delta_get_stream(struct pack_delta_stream_s **list,
+						  glc_stream_id_t id)
+{
+	struct pack_delta_stream_s *stream = *list;
+
+	while (stream != NULL) {
+		if (stream->id == id)
+			return stream;
+		stream = stream->next;
+	}
+
+	stream = (struct pack_delta_stream_s *) malloc(sizeof(struct pack_delta_stream_s));
+	memset(stream, 0, sizeof(struct pack_delta_stream_s));
+	stream->id = id;
+	stream->next = *list;
+	*list = stream;
+	return stream;
+}
+
+void pack_delta_free_streams(struct pack_delta_stream_s *list)
+{
+	struct pack_delta_stream_s *del;
+
+	while (list != NULL) {
+		del = list;
+		list = list->next;
+
+		if (del->ref)
+			free(del->ref);
+		free(del);
+	}
+}
+
+void pack_delta_reset(pack_t pack)
+{
+	struct pack_delta_stream_s *stream = pack->delta_stream;
+
+	/* next frame of every stream becomes a key frame */
+	while (stream != NULL) {
+		stream->frames = pack->delta_interval;
+		stream = stream->next;
+	}
+}
+
+/**
+ * \brief dst = src ^ ref, ref = src
+ */
+static inline void pack_delta_encode(char *dst, char *ref, const char *src, size_t size)
+{
+	u_int64_t s, r;
+	size_t i = 0;
+
+	for (; i + sizeof(u_int64_t) <= size; i += sizeof(u_int64_t)) {
+		memcpy(&s, &src[i], sizeof(u_int64_t));
+		memcpy(&r, &ref[i], sizeof(u_int64_t));
+		r ^= s;
+		memcpy(&dst[i], &r, sizeof(u_int64_t));
+		memcpy(&ref[i], &s, sizeof(u_int64_t));
+	}
+
+	for (; i < size; i++) {
+		dst[i] = src[i] ^ ref[i];
+		ref[i] = src[i];
+	}
+}
+
+/**
+ * \brief dst = src ^ ref, ref = dst
+ */
+static inline void pack_delta_decode(char *dst, char *ref, const char *src, size_t size)
+{
+	u_int64_t s, r;
+	size_t i = 0;
+
+	for (; i + sizeof(u_int64_t) <= size; i += sizeof(u_int64_t)) {
+		memcpy(&s, &src[i], sizeof(u_int64_t));
+		memcpy(&r, &ref[i], sizeof(u_int64_t));
+		r ^= s;
+		memcpy(&dst[i], &r, sizeof(u_int64_t));
+		memcpy(&ref[i], &r, sizeof(u_int64_t));
+	}
+
+	for (; i < size; i++) {
+		dst[i] = src[i] ^ ref[i];
+		ref[i] = dst[i];
+	}
+}
+
+int pack_delta(pack_t pack, glc_thread_state_t *state)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	glc_video_frame_header_t *pic_header = (glc_video_frame_header_t *) state->read_data;
+	char *pic = &state->read_data[sizeof(glc_video_frame_header_t)];
+	size_t size = state->read_size - sizeof(glc_video_frame_header_t);
+	struct pack_delta_stream_s *stream;
+	glc_video_delta_header_t *delta_header;
+	int ret;
+
+	/*
+	 read callbacks are called in stream order, one at a time,
+	 so references need no locking. Output goes to per-thread
+	 scratch buffer which then replaces read data.
+	*/
+	if ((ret = pack_scratch(&thread->scratch, &thread->scratch_size,
+				sizeof(glc_video_delta_header_t) + size)))
+		return ret;
+	delta_header = (glc_video_delta_header_t *) thread->scratch;
+
+	stream = pack_delta_get_stream(&pack->delta_stream, pic_header->id);
+	delta_header->id = pic_header->id;
+	delta_header->time = pic_header->time;
+	delta_header->flags = 0;
+
+	if ((stream->size != size) || (stream->frames >= pack->delta_interval)) {
+		if (stream->size != size) {
+			if (stream->ref)
+				free(stream->ref);
+			if (!(stream->ref = (char *) malloc(size))) {
+				stream->size = 0;
+				return ENOMEM;
+			}
+			stream->size = size;
+		}
+
+		memcpy(stream->ref, pic, size);
+		memcpy(&thread->scratch[sizeof(glc_video_delta_header_t)], pic, size);
+		delta_header->flags |= GLC_VIDEO_DELTA_KEY;
+		stream->frames = 0;
+	} else
+		pack_delta_encode(&thread->scratch[sizeof(glc_video_delta_header_t)],
+				  stream->ref, pic, size);
+	stream->frames++;
+
+	/* key frames get their own type, visible in codec headers */
+	if (delta_header->flags & GLC_VIDEO_DELTA_KEY)
+		state->header.type = GLC_MESSAGE_VIDEO_DELTA_KEY;
+	else
+		state->header.type = GLC_MESSAGE_VIDEO_DELTA;
+	state->read_data = thread->scratch;
+	state->read_size = state->write_size = sizeof(glc_video_delta_header_t) + size;
+	return 0;
+}
+
+int pack_layout_format(pack_t pack, glc_thread_state_t *state)
+{
+	glc_video_format_message_t *format_message =
+		(glc_video_format_message_t *) state->read_data;
+	struct pack_layout_stream_s *stream = pack->layout_stream;
+
+	while (stream != NULL) {
+		if (stream->id == format_message->id)
+			break;
+		stream = stream->next;
+	}
+
+	if (stream == NULL) {
+		if (!(stream = (struct pack_layout_stream_s *)
+			       malloc(sizeof(struct pack_layout_stream_s))))
+			return ENOMEM;
+		memset(stream, 0, sizeof(struct pack_layout_stream_s));
+		stream->id = format_message->id;
+		stream->next = pack->layout_stream;
+		pack->layout_stream = stream;
+	}
+
+	stream->format = format_message->format;
+	stream->width = format_message->width;
+	stream->height = format_message->height;
+	return 0;
+}
+
+int pack_layout_select(pack_t pack, glc_thread_state_t *state)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	glc_video_layout_header_t *layout_header = &thread->layout_header;
+	struct pack_layout_stream_s *stream = pack->layout_stream;
+	size_t prefix, bpp;
+
+	/* delta header starts with stream id as well */
+	if ((state->header.type == GLC_MESSAGE_VIDEO_DELTA) |
+	    (state->header.type == GLC_MESSAGE_VIDEO_DELTA_KEY))
+		prefix = sizeof(glc_video_delta_header_t);
+	else
+		prefix = sizeof(glc_video_frame_header_t);
+
+	while (stream != NULL) {
+		if (stream->id == ((glc_video_frame_header_t *) state->read_data)->id)
+			break;
+		stream = stream->next;
+	}
+
+	if (stream == NULL)
+		return 0;
+
+	if (stream->format == GLC_VIDEO_BGRA)
+		bpp = 4;
+	else if ((stream->format == GLC_VIDEO_BGR) || (stream->format == GLC_VIDEO_RGB))
+		bpp = 3;
+	else
+		return 0; /* YCbCr is planar already */
+
+	/* row size, padding included, is what frame size says it is */
+	if ((!stream->width) || (!stream->height) ||
+	    (state->read_size < prefix) ||
+	    ((state->read_size - prefix) % stream->height) ||
+	    ((state->read_size - prefix) / stream->height < stream->width * bpp))
+		return 0;
+
+	layout_header->size = state->read_size;
+	layout_header->header = state->header;
+	layout_header->flags = pack->ycocg ? GLC_VIDEO_LAYOUT_YCOCG : 0;
+	layout_header->prefix = prefix;
+	layout_header->width = stream->width;
+	layout_header->height = stream->height;
+	layout_header->row = (state->read_size - prefix) / stream->height;
+	layout_header->bpp = bpp;
+	layout_header->alpha = 0;
+
+	return 1;
+}
+
+/* bytewise arithmetic on 8 bytes at once */
+#define PACK_SWAR_HIGH 0x8080808080808080ULL
+#define PACK_SWAR_LOW  0x7f7f7f7f7f7f7f7fULL
+
+static inline u_int64_t pack_swar_add(u_int64_t a, u_int64_t b)
+{
+	return ((a & PACK_SWAR_LOW) + (b & PACK_SWAR_LOW)) ^ ((a ^ b) & PACK_SWAR_HIGH);
+}
+
+static inline u_int64_t pack_swar_sub(u_int64_t a, u_int64_t b)
+{
+	return ((a | PACK_SWAR_HIGH) - (b & PACK_SWAR_LOW)) ^ ((a ^ ~b) & PACK_SWAR_HIGH);
+}
+
+/* signed (arithmetic) shift right by one */
+static inline u_int64_t pack_swar_half(u_int64_t a)
+{
+	return ((a >> 1) & PACK_SWAR_LOW) | (a & PACK_SWAR_HIGH);
+}
+
+static inline unsigned char pack_half(unsigned char a)
+{
+	return (a >> 1) | (a & 0x80);
+}
+
+/**
+ * \brief forward YCoCg-R on B, G, R planes, in place
+ *
+ * Co = R - B, t = B + (Co >> 1), Cg = G - t, Y = t + (Cg >> 1),
+ * all modulo 256. Any function of the stored value is fine for
+ * a lifting step, so wrap-around keeps it reversible.
+ */
+static inline void pack_layout_ycocg(char *planes, size_t n)
+{
+	unsigned char *b = (unsigned char *) planes, *g = &b[n], *r = &g[n];
+	u_int64_t vb, vg, vr, t;
+	unsigned char tb;
+	size_t i = 0;
+
+	for (; i + sizeof(u_int64_t) <= n; i += sizeof(u_int64_t)) {
+		memcpy(&vb, &b[i], sizeof(u_int64_t));
+		memcpy(&vg, &g[i], sizeof(u_int64_t));
+		memcpy(&vr, &r[i], sizeof(u_int64_t));
+
+		vr = pack_swar_sub(vr, vb);                /* Co */
+		t = pack_swar_add(vb, pack_swar_half(vr));
+		vg = pack_swar_sub(vg, t);                 /* Cg */
+		vb = pack_swar_add(t, pack_swar_half(vg)); /* Y */
+
+		memcpy(&b[i], &vb, sizeof(u_int64_t));
+		memcpy(&g[i], &vg, sizeof(u_int64_t));
+		memcpy(&r[i], &vr, sizeof(u_int64_t));
+	}
+
+	for (; i < n; i++) {
+		r[i] -= b[i];
+		tb = b[i] + pack_half(r[i]);
+		g[i] -= tb;
+		b[i] = tb + pack_half(g[i]);
+	}
+}
+
+/**
+ * \brief inverse YCoCg-R on Y, Cg, Co planes, in place
+ */
+static inline void unpack_layout_ycocg(char *planes, size_t n)
+{
+	unsigned char *y = (unsigned char *) planes, *cg = &y[n], *co = &cg[n];
+	u_int64_t vy, vcg, vco, t;
+	unsigned char tb;
+	size_t i = 0;
+
+	for (; i + sizeof(u_int64_t) <= n; i += sizeof(u_int64_t)) {
+		memcpy(&vy, &y[i], sizeof(u_int64_t));
+		memcpy(&vcg, &cg[i], sizeof(u_int64_t));
+		memcpy(&vco, &co[i], sizeof(u_int64_t));
+
+		t = pack_swar_sub(vy, pack_swar_half(vcg));
+		vcg = pack_swar_add(vcg, t);                /* G */
+		vy = pack_swar_sub(t, pack_swar_half(vco)); /* B */
+		vco = pack_swar_add(vy, vco);               /* R */
+
+		memcpy(&y[i], &vy, sizeof(u_int64_t));
+		memcpy(&cg[i], &vcg, sizeof(u_int64_t));
+		memcpy(&co[i], &vco, sizeof(u_int64_t));
+	}
+
+	for (; i < n; i++) {
+		tb = y[i] - pack_half(cg[i]);
+		cg[i] += tb;
+		y[i] = tb - pack_half(co[i]);
+		co[i] += y[i];
+	}
+}
+
+/**
+ * \brief split interleaved rows into planes
+ *
+ * Alpha is always written after padding, caller drops it
+ * when it turns out to be constant.
+ * \return non-zero if alpha is not constant
+ */
+static inline int pack_layout_split(char *dst, const char *src,
+				    glc_video_layout_header_t *layout_header)
+{
+	size_t width = layout_header->width, height = layout_header->height;
+	size_t row = layout_header->row, bpp = layout_header->bpp;
+	size_t pad = row - width * bpp;
+	size_t n = width * height;
+	unsigned char *c0 = (unsigned char *) dst, *c1 = &c0[n], *c2 = &c1[n];
+	unsigned char *p = &c2[n], *a;
+	const unsigned char *line;
+	unsigned char alpha, alpha_diff = 0;
+	size_t x, y;
+
+	a = &p[(layout_header->flags & GLC_VIDEO_LAYOUT_PADDING) ? height * pad : 0];
+	alpha = bpp == 4 ? (unsigned char) src[3] : 0;
+
+	for (y = 0; y < height; y++) {
+		line = (const unsigned char *) &src[y * row];
+
+		if (bpp == 4) {
+			for (x = 0; x < width; x++) {
+				c0[x] = line[x * 4 + 0];
+				c1[x] = line[x * 4 + 1];
+				c2[x] = line[x * 4 + 2];
+				a[x] = line[x * 4 + 3];
+				alpha_diff |= a[x] ^ alpha;
+			}
+			a = &a[width];
+		} else {
+			for (x = 0; x < width; x++) {
+				c0[x] = line[x * 3 + 0];
+				c1[x] = line[x * 3 + 1];
+				c2[x] = line[x * 3 + 2];
+			}
+		}
+
+		if (layout_header->flags & GLC_VIDEO_LAYOUT_PADDING) {
+			memcpy(p, &line[width * bpp], pad);
+			p = &p[pad];
+		}
+
+		c0 = &c0[width];
+		c1 = &c1[width];
+		c2 = &c2[width];
+	}
+
+	layout_header->alpha = alpha;
+	return alpha_diff != 0;
+}
+
+/**
+ * \brief merge planes back into interleaved rows
+ */
+static inline void unpack_layout_merge(char *dst, const char *src,
+				       glc_video_layout_header_t *layout_header)
+{
+	size_t width = layout_header->width, height = layout_header->height;
+	size_t row = layout_header->row, bpp = layout_header->bpp;
+	size_t pad = row - width * bpp;
+	size_t n = width * height;
+	const unsigned char *c0 = (const unsigned char *) src, *c1 = &c0[n], *c2 = &c1[n];
+	const unsigned char *p = &c2[n], *a;
+	unsigned char *line;
+	size_t x, y;
+
+	a = &p[(layout_header->flags & GLC_VIDEO_LAYOUT_PADDING) ? height * pad : 0];
+
+	for (y = 0; y < height; y++) {
+		line = (unsigned char *) &dst[y * row];
+
+		if ((bpp == 4) && (layout_header->flags & GLC_VIDEO_LAYOUT_ALPHA)) {
+			for (x = 0; x < width; x++) {
+				line[x * 4 + 0] = c0[x];
+				line[x * 4 + 1] = c1[x];
+				line[x * 4 + 2] = c2[x];
+				line[x * 4 + 3] = a[x];
+			}
+			a = &a[width];
+		} else if (bpp == 4) {
+			for (x = 0; x < width; x++) {
+				line[x * 4 + 0] = c0[x];
+				line[x * 4 + 1] = c1[x];
+				line[x * 4 + 2] = c2[x];
+				line[x * 4 + 3] = layout_header->alpha;
+			}
+		} else {
+			for (x = 0; x < width; x++) {
+				line[x * 3 + 0] = c0[x];
+				line[x * 3 + 1] = c1[x];
+				line[x * 3 + 2] = c2[x];
+			}
+		}
+
+		if (layout_header->flags & GLC_VIDEO_LAYOUT_PADDING) {
+			memcpy(&line[width * bpp], p, pad);
+			p = &p[pad];
+		} else if (pad)
+			memset(&line[width * bpp], 0, pad);
+
+		c0 = &c0[width];
+		c1 = &c1[width];
+		c2 = &c2[width];
+	}
+}
+
+int pack_layout(pack_t pack, glc_thread_state_t *state)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	glc_video_layout_header_t *layout_header = &thread->layout_header;
+	const char *pic = &state->read_data[layout_header->prefix];
+	size_t width = layout_header->width, height = layout_header->height;
+	size_t pad = layout_header->row - width * layout_header->bpp;
+	size_t size, x, y;
+	int ret;
+
+	if ((ret = pack_scratch(&thread->planes, &thread->planes_size, state->read_size)))
+		return ret;
+
+	/* padding is dropped only if it is all zeros */
+	for (y = 0; (y < height) && (pad); y++) {
+		for (x = width * layout_header->bpp; x < layout_header->row; x++) {
+			if (pic[y * layout_header->row + x]) {
+				layout_header->flags |= GLC_VIDEO_LAYOUT_PADDING;
+				break;
+			}
+		}
+		if (layout_header->flags & GLC_VIDEO_LAYOUT_PADDING)
+			break;
+	}
+
+	memcpy(thread->planes, state->read_data, layout_header->prefix);
+	if (pack_layout_split(&thread->planes[layout_header->prefix], pic, layout_header))
+		layout_header->flags |= GLC_VIDEO_LAYOUT_ALPHA;
+	if (layout_header->flags & GLC_VIDEO_LAYOUT_YCOCG)
+		pack_layout_ycocg(&thread->planes[layout_header->prefix], width * height);
+
+	size = layout_header->prefix + 3 * width * height;
+	if (layout_header->flags & GLC_VIDEO_LAYOUT_PADDING)
+		size += height * pad;
+	if (layout_header->flags & GLC_VIDEO_LAYOUT_ALPHA)
+		size += width * height;
+
+	state->read_data = thread->planes;
+	state->read_size = size;
+	return 0;
+}
+
+int pack_audio_format(pack_t pack, glc_thread_state_t *state)
+{
+	glc_audio_format_message_t *format_message =
+		(glc_audio_format_message_t *) state->read_data;
+	struct pack_audio_stream_s *stream = pack->audio_stream;
+
+	while (stream != NULL) {
+		if (stream->id == format_message->id)
+			break;
+		stream = stream->next;
+	}
+
+	if (stream == NULL) {
+		if (!(stream = (struct pack_audio_stream_s *)
+			       malloc(sizeof(struct pack_audio_stream_s))))
+			return ENOMEM;
+		memset(stream, 0, sizeof(struct pack_audio_stream_s));
+		stream->id = format_message->id;
+		stream->next = pack->audio_stream;
+		pack->audio_stream = stream;
+	}
+
+	stream->format = format_message->format;
+	stream->flags = format_message->flags;
+	stream->channels = format_message->channels;
+	return 0;
+}
+
+size_t pack_audio_sample_size(glc_audio_format_t format)
+{
+	if (format == GLC_AUDIO_S16_LE)
+		return 2;
+	else if (format == GLC_AUDIO_S24_LE)
+		return 3;
+	else if (format == GLC_AUDIO_S32_LE)
+		return 4;
+	return 0;
+}
+
+int pack_audio_select(pack_t pack, glc_thread_state_t *state)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	glc_audio_data_header_t *audio_header = (glc_audio_data_header_t *) state->read_data;
+	glc_audio_lpc_header_t *lpc_header = &thread->audio_header;
+	struct pack_audio_stream_s *stream = pack->audio_stream;
+	size_t sample_size;
+
+	while (stream != NULL) {
+		if (stream->id == audio_header->id)
+			break;
+		stream = stream->next;
+	}
+
+	if (stream == NULL)
+		return 0;
+
+	if ((!(sample_size = pack_audio_sample_size(stream->format))) ||
+	    (!stream->channels) ||
+	    (audio_header->size != state->read_size - sizeof(glc_audio_data_header_t)) ||
+	    (audio_header->size % (sample_size * stream->channels)))
+		return 0;
+
+	lpc_header->size = state->read_size;
+	lpc_header->header = state->header;
+	lpc_header->format = stream->format;
+	lpc_header->flags = stream->flags;
+	lpc_header->channels = stream->channels;
+	lpc_header->frames = audio_header->size / (sample_size * stream->channels);
+
+	/* every channel falls back to plain samples if coding doesn't pay off */
+	state->write_size = sizeof(glc_container_message_header_t)
+			    + sizeof(glc_audio_lpc_header_t)
+			    + sizeof(glc_audio_data_header_t)
+			    + stream->channels * sizeof(glc_audio_lpc_channel_header_t)
+			    + audio_header->size;
+	return 1;
+}
+
+static inline int32_t pack_audio_load(const unsigned char *p, size_t sample_size)
+{
+	if (sample_size == 2)
+		return (int16_t) (p[0] | (p[1] << 8));
+	else if (sample_size == 3)
+		return ((int32_t) ((p[0] << 8) | (p[1] << 16) | ((u_int32_t) p[2] << 24))) >> 8;
+	return (int32_t) (p[0] | (p[1] << 8) | (p[2] << 16) | ((u_int32_t) p[3] << 24));
+}
+
+static inline void unpack_audio_store(unsigned char *p, int32_t value, size_t sample_size)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	if (sample_size > 2)
+		p[2] = value >> 16;
+	if (sample_size > 3)
+		p[3] = value >> 24;
+}
+
+/* fixed polynomial predictors, as in FLAC */
+static inline int64_t pack_audio_predict(const int32_t *x, size_t i, unsigned int order)
+{
+	switch (order) {
+	case 1:
+		return x[i - 1];
+	case 2:
+		return 2 * (int64_t) x[i - 1] - x[i - 2];
+	case 3:
+		return 3 * (int64_t) x[i - 1] - 3 * (int64_t) x[i - 2] + x[i - 3];
+	case 4:
+		return 4 * (int64_t) x[i - 1] - 6 * (int64_t) x[i - 2]
+		       + 4 * (int64_t) x[i - 3] - x[i - 4];
+	}
+	return 0;
+}
+
+static inline void pack_bits_put(struct pack_bits_s *bits, u_int64_t value, unsigned int n)
+{
+	bits->acc = (bits->acc << n) | (value & ((1ULL << n) - 1));
+	bits->count += n;
+
+	while (bits->count >= 8) {
+		bits->count -= 8;
+		if (bits->pos < bits->size)
+			bits->data[bits->pos++] = bits->acc >> bits->count;
+		else
+			bits->overflow = 1;
+	}
+	bits->acc &= (1ULL << bits->count) - 1;
+}
+
+static inline void pack_bits_put_long(struct pack_bits_s *bits, u_int64_t value,
+				      unsigned int n)
+{
+	if (n > 32) {
+		pack_bits_put(bits, value >> 32, n - 32);
+		n = 32;
+	}
+	pack_bits_put(bits, value, n);
+}
+
+/**
+ * \brief code one channel
+ * \return coded size, 0 if it doesn't fit in [size] bytes
+ */
+size_t pack_audio_code(const int32_t *x, size_t frames, size_t sample_size,
+		       unsigned char *dst, size_t size, unsigned int *order)
+{
+	unsigned int sample_bits = sample_size * 8, escape_bits = sample_bits + 5;
+	unsigned int o, best, k;
+	u_int64_t error[5], sum, u, q;
+	size_t i, start, end, count;
+	struct pack_bits_s bits;
+	int64_t residual;
+
+	/* pick predictor with smallest total residual */
+	memset(error, 0, sizeof(error));
+	for (i = 4; i < frames; i++) {
+		for (o = 0; o < 5; o++) {
+			residual = x[i] - pack_audio_predict(x, i, o);
+			error[o] += residual < 0 ? -residual : residual;
+		}
+	}
+
+	best = 0;
+	for (o = 1; o < 5; o++) {
+		if (error[o] < error[best])
+			best = o;
+	}
+	if (best > frames)
+		best = frames;
+	*order = best;
+
+	memset(&bits, 0, sizeof(struct pack_bits_s));
+	bits.data = dst;
+	bits.size = size;
+
+	for (i = 0; i < best; i++)
+		pack_bits_put_long(&bits, (u_int32_t) x[i], sample_bits);
+
+	for (start = best; (start < frames) && (!bits.overflow); start = end) {
+		end = start + GLC_AUDIO_LPC_PARTITION;
+		if (end > frames)
+			end = frames;
+		count = end - start;
+
+		sum = 0;
+		for (i = start; i < end; i++) {
+			residual = x[i] - pack_audio_predict(x, i, best);
+			sum += ((u_int64_t) residual << 1) ^ (residual >> 63);
+		}
+
+		/* 2^k close to mean value */
+		for (k = 0; (k < escape_bits) && ((u_int64_t) count << (k + 1) < sum); k++);
+		pack_bits_put(&bits, k, 6);
+
+		for (i = start; i < end; i++) {
+			residual = x[i] - pack_audio_predict(x, i, best);
+			u = ((u_int64_t) residual << 1) ^ (residual >> 63);
+			q = u >> k;
+
+			if (q < 32) {
+				pack_bits_put(&bits, ((1ULL << q) - 1) << 1, q + 1);
+				pack_bits_put_long(&bits, u, k);
+			} else {
+				pack_bits_put(&bits, 0xffffffff, 32);
+				pack_bits_put_long(&bits, u, escape_bits);
+			}
+		}
+	}
+
+	if (bits.count)
+		pack_bits_put(&bits, 0, 8 - bits.count);
+
+	if (bits.overflow)
+		return 0;
+	return bits.pos;
+}
+
+int pack_audio_write(pack_t pack, glc_thread_state_t *state)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	glc_audio_lpc_header_t *lpc_header = &thread->audio_header;
+	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
+	glc_audio_lpc_channel_header_t channel_header;
+	const unsigned char *data = (const unsigned char *)
+				    &state->read_data[sizeof(glc_audio_data_header_t)];
+	size_t sample_size = pack_audio_sample_size(lpc_header->format);
+	size_t channel_size = lpc_header->frames * sample_size;
+	size_t frames = lpc_header->frames, channels = lpc_header->channels;
+	size_t i, c, pos, stride, offset;
+	unsigned int order;
+	int32_t *x;
+	int ret;
+
+	if ((ret = pack_scratch(&thread->samples, &thread->samples_size,
+				frames * sizeof(int32_t))))
+		return ret;
+	x = (int32_t *) thread->samples;
+
+	if (lpc_header->flags & GLC_AUDIO_INTERLEAVED)
+		stride = channels * sample_size;
+	else
+		stride = sample_size;
+
+	pos = sizeof(glc_container_message_header_t);
+	memcpy(&state->write_data[pos], lpc_header, sizeof(glc_audio_lpc_header_t));
+	pos += sizeof(glc_audio_lpc_header_t);
+	memcpy(&state->write_data[pos], state->read_data, sizeof(glc_audio_data_header_t));
+	pos += sizeof(glc_audio_data_header_t);
+
+	for (c = 0; c < channels; c++) {
+		if (lpc_header->flags & GLC_AUDIO_INTERLEAVED)
+			offset = c * sample_size;
+		else
+			offset = c * channel_size;
+
+		for (i = 0; i < frames; i++)
+			x[i] = pack_audio_load(&data[offset + i * stride], sample_size);
+
+		channel_header.size = pack_audio_code(x, frames, sample_size,
+			(unsigned char *) &state->write_data[pos + sizeof(glc_audio_lpc_channel_header_t)],
+			channel_size, &order);
+		channel_header.order = order;
+
+		if ((!channel_header.size) || (channel_header.size >= channel_size)) {
+			channel_header.order = GLC_AUDIO_LPC_VERBATIM;
+			channel_header.size = channel_size;
+			for (i = 0; i < frames; i++)
+				memcpy(&state->write_data[pos + sizeof(glc_audio_lpc_channel_header_t) +
+							  i * sample_size],
+				       &data[offset + i * stride], sample_size);
+		}
+
+		memcpy(&state->write_data[pos], &channel_header,
+		       sizeof(glc_audio_lpc_channel_header_t));
+		pos += sizeof(glc_audio_lpc_channel_header_t) + channel_header.size;
+	}
+
+	container->size = pos - sizeof(glc_container_message_header_t);
+	container->header.type = GLC_MESSAGE_AUDIO_LPC;
+
+	state->header.type = GLC_MESSAGE_CONTAINER;
+
+	return 0;
+}
+
+int pack_read_callback(glc_thread_state_t *state)
+{
+	pack_t pack = (pack_t) state->ptr;
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	size_t count, worstcase;
+	int ret;
+
+	thread->blocks = 0;
+	thread->layout = 0;
+	thread->audio = 0;
+	thread->probe_stream = NULL;
+
+	/* callback may continue stream in a new file, which can't refer to old frames */
+	if ((pack->delta_interval) && (state->header.type == GLC_CALLBACK_REQUEST))
+		pack_delta_reset(pack);
+
+	if ((pack->lpc) && (state->header.type == GLC_MESSAGE_AUDIO_FORMAT)) {
+		if ((ret = pack_audio_format(pack, state)))
+			return ret;
+	}
+
+	if (((pack->layout) || (pack->ycocg)) &&
+	    (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)) {
+		if ((ret = pack_layout_format(pack, state)))
+			return ret;
+	}
+
+	if ((pack->delta_interval) &&
+	    (state->header.type == GLC_MESSAGE_VIDEO_FRAME)) {
+		if ((ret = pack_delta(pack, state)))
+			return ret;
+	}
+
+	/* compress only audio and pictures */
+	if ((state->read_size > pack->compress_min) &&
+	    ((state->header.type == GLC_MESSAGE_VIDEO_FRAME) |
+	     (state->header.type == GLC_MESSAGE_VIDEO_DELTA) |
+	     (state->header.type == GLC_MESSAGE_VIDEO_DELTA_KEY) |
+	     (state->header.type == GLC_MESSAGE_AUDIO_DATA))) {
+		/* audio coder takes precedence over general purpose codecs */
+		if ((pack->lpc) && (state->header.type == GLC_MESSAGE_AUDIO_DATA) &&
+		    ((thread->audio = pack_audio_select(pack, state))))
+			return 0;
+
+		thread->codec = pack->compression;
+		if (pack->compression == PACK_ADAPTIVE) {
+			if (!(thread->codec = pack_adaptive_select(pack, state)))
+				goto copy;
+		}
+
+		/*
+		 Probe itself runs in process callback, only stream is
+		 looked up here. Read callbacks are serialized, so the
+		 stream list only grows here.
+		*/
+		if ((pack->probe) &&
+		    (state->read_size >= PACK_PROBE_CHUNKS * PACK_PROBE_CHUNK_SIZE * 2)) {
+			pthread_mutex_lock(&pack->stream_mutex);
+			thread->probe_stream = pack_get_stream(pack, state->header.type,
+							       *((glc_stream_id_t *) state->read_data));
+			pthread_mutex_unlock(&pack->stream_mutex);
+		}
+
+		/* layout never grows data, so sizes below hold */
+		if (((pack->layout) || (pack->ycocg)) &&
+		    (state->header.type != GLC_MESSAGE_AUDIO_DATA))
+			thread->layout = pack_layout_select(pack, state);
+
+		if ((pack->block_size) && (state->read_size > pack->block_size)) {
+			/* zero if codec isn't supported */
+			if (!(worstcase = pack_codec_worstcase(thread->codec, pack->block_size)))
+				goto copy;
+			count = (state->read_size + pack->block_size - 1) / pack->block_size;
+			state->write_size = sizeof(glc_container_message_header_t)
+					    + sizeof(glc_blocks_header_t)
+					    + count * sizeof(u_int32_t)
+					    + count * worstcase;
+			thread->blocks = 1;
+		} else {
+			/* zero if codec can't handle packet this big */
+			if (!(worstcase = pack_codec_worstcase(thread->codec, state->read_size)))
+				goto copy;
+			state->write_size = sizeof(glc_container_message_header_t)
+					    + pack_codec_header_size(thread->codec)
+					    + worstcase;
+		}
+
+		if (thread->layout)
+			state->write_size += sizeof(glc_video_layout_header_t);
+
+		return 0;
+	}
+copy:
+	state->flags |= GLC_THREAD_COPY;
+	return 0;
+}
+
+int pack_process_callback(glc_thread_state_t *state)
+{
+	pack_t pack = (pack_t) state->ptr;
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	glc_container_message_header_t *container;
+	glc_size_t size;
+	int ret;
+
+	if (state->flags & GLC_THREAD_COPY)
+		return 0;
+
+	if ((thread->probe_stream) && (pack_probe(pack, state))) {
+		state->write_size = state->read_size;
+		state->flags |= GLC_THREAD_COPY;
+		return 0;
+	}
+
+	if (thread->layout) {
+		if ((ret = pack_layout(pack, state)))
+			return ret;
+	}
+
+	/*
+	 Compress into thread's own buffer first, so only the real
+	 compressed size has to be reserved from the output buffer.
+	*/
+	if ((ret = pack_scratch(&thread->out, &thread->out_size, state->write_size)))
+		return ret;
+	state->write_data = thread->out;
+	if (thread->layout)
+		state->write_data = &thread->out[sizeof(glc_video_layout_header_t)];
+
+	if ((ret = pack_write_callback(state)))
+		return ret;
+
+	container = (glc_container_message_header_t *) thread->out;
+
+	if (thread->layout) {
+		/*
+		 Compressed message was written after room for layout
+		 header, its container header is replaced by outer
+		 container and layout header.
+		*/
+		container = (glc_container_message_header_t *) state->write_data;
+		thread->layout_header.compression = container->header.type;
+		size = container->size;
+
+		container = (glc_container_message_header_t *) thread->out;
+		container->size = size + sizeof(glc_video_layout_header_t);
+		container->header.type = GLC_MESSAGE_VIDEO_LAYOUT;
+		memcpy(&thread->out[sizeof(glc_container_message_header_t)],
+		       &thread->layout_header, sizeof(glc_video_layout_header_t));
+	}
+	state->read_data = thread->out;
+	state->write_size = sizeof(glc_container_message_header_t) + container->size;
+	state->flags |= GLC_THREAD_COPY;
+
+	return 0;
+}
+
+int pack_codec_write(glc_thread_state_t *state, int compression)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
+	/* all codec headers have same layout */
+	glc_lz4_header_t *codec_header =
+		(glc_lz4_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
+	size_t header_size = pack_codec_header_size(compression);
+	size_t compressed_size;
+	int ret;
+
+	if ((ret = pack_codec_compress(compression, thread->wrk,
+				       state->read_data, state->read_size,
+				       &state->write_data[sizeof(glc_container_message_header_t) +
+							  header_size],
+				       &compressed_size)))
+		return ret;
+
+	codec_header->size = (glc_size_t) state->read_size;
+	memcpy(&codec_header->header, &state->header, sizeof(glc_message_header_t));
+
+	container->size = compressed_size + header_size;
+	container->header.type = pack_codec_message(compression);
+
+	state->header.type = GLC_MESSAGE_CONTAINER;
+
+	return 0;
+}
+
+int pack_write_callback(glc_thread_state_t *state)
+{
+	pack_t pack = (pack_t) state->ptr;
+
+	if (((struct pack_thread_s *) state->threadptr)->audio)
+		return pack_audio_write(pack, state);
+	if (pack->compression == PACK_ADAPTIVE)
+		return pack_adaptive_write(pack, state);
+	if (((struct pack_thread_s *) state->threadptr)->blocks)
+		return pack_blocks_write(pack, state);
+	return pack_codec_write(state, ((struct pack_thread_s *) state->threadptr)->codec);
+}
+
+struct pack_stream_s *pack_get_stream(pack_t pack, glc_message_type_t type,
+				      glc_stream_id_t id)
+{
+	struct pack_stream_s *stream = pack->stream;
+
+	/* delta coded frames share state with plain frames */
+	if ((type == GLC_MESSAGE_VIDEO_DELTA) | (type == GLC_MESSAGE_VIDEO_DELTA_KEY))
+		type = GLC_MESSAGE_VIDEO_FRAME;
+
+	while (stream != NULL) {
+		if ((stream->type == type) && (stream->id == id))
+			return stream;
+		stream = stream->next;
+	}
+
+	stream = (struct pack_stream_s *) malloc(sizeof(struct pack_stream_s));
+	memset(stream, 0, sizeof(struct pack_stream_s));
+	stream->type = type;
+	stream->id = id;
+	stream->next = pack->stream;
+	pack->stream = stream;
+	return stream;
+}
+
+int pack_adaptive_select(pack_t pack, glc_thread_state_t *state)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	struct pack_stream_s *stream;
+	struct pack_codec_stats_s *stats;
+	int codec, best, fastest, supported[PACK_CODECS], count;
+	double best_ratio, fastest_speed;
+
+	/* video frame, delta and audio data headers all start with id */
+	pthread_mutex_lock(&pack->stream_mutex);
+	stream = pack_get_stream(pack, state->header.type,
+					  *((glc_stream_id_t *) state->read_data));
+	thread->stream = stream;
+	stream->packets++;
+
+	count = 0;
+	for (codec = 1; codec < PACK_CODECS; codec++) {
+		if (pack_codec_worstcase(codec, 1))
+			supported[count++] = codec;
+	}
+
+	/* measure every codec at least once, then one codec every now and then */
+	best = 0;
+	for (codec = 0; codec < count; codec++) {
+		if (!stream->codec[supported[codec]].samples) {
+			best = supported[codec];
+			goto finish;
+		}
+	}
+
+	if (!(stream->packets % PACK_ADAPTIVE_EXPLORE)) {
+		best = supported[(stream->packets / PACK_ADAPTIVE_EXPLORE) % count];
+		goto finish;
+	}
+
+	/* best ratio among codecs fast enough, fastest if none is */
+	best_ratio = PACK_ADAPTIVE_MAX_RATIO;
+	fastest = 0;
+	fastest_speed = 0;
+	for (codec = 0; codec < count; codec++) {
+		stats = &stream->codec[supported[codec]];
+		if (stats->ratio >= PACK_ADAPTIVE_MAX_RATIO)
+			continue;
+
+		if ((stats->speed >= pack->adaptive_target) && (stats->ratio < best_ratio)) {
+			best = supported[codec];
+			best_ratio = stats->ratio;
+		}
+
+		if (stats->speed > fastest_speed) {
+			fastest = supported[codec];
+			fastest_speed = stats->speed;
+		}
+	}
+
+	if (!best)
+		best = fastest;
+finish:
+	stream->codec[best].packets++;
+	if (!best) {
+		stream->codec[0].in += state->read_size;
+		stream->codec[0].out += state->read_size;
+	}
+	pthread_mutex_unlock(&pack->stream_mutex);
+
+	return best;
+}
+
+int pack_adaptive_write(pack_t pack, glc_thread_state_t *state)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
+	struct pack_codec_stats_s *stats;
+	glc_message_header_t header = state->header;
+	struct timeval start, end;
+	double ratio, speed, elapsed;
+	size_t compressed_size;
+	int ret;
+
+	gettimeofday(&start, NULL);
+
+	if (thread->blocks)
+		ret = pack_blocks_write(pack, state);
+	else
+		ret = pack_codec_write(state, thread->codec);
+
+	if (ret)
+		return ret;
+
+	gettimeofday(&end, NULL);
+	compressed_size = container->size;
+
+	/*
+	 Didn't compress, store raw data in plain container instead.
+	 On disk this is the same as the original message.
+	*/
+	if (compressed_size >= state->read_size) {
+		memcpy(&state->write_data[sizeof(glc_container_message_header_t)],
+		       state->read_data, state->read_size);
+		container->size = state->read_size;
+		container->header = header;
+	}
+
+	elapsed = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec);
+	if (elapsed < 1)
+		elapsed = 1;
+	ratio = (double) compressed_size / (double) state->read_size;
+	/* bytes per usec to MiB/s */
+	speed = (double) state->read_size / elapsed * 1000000.0 / (1024.0 * 1024.0);
+
+	pthread_mutex_lock(&pack->stream_mutex);
+	stats = &thread->stream->codec[thread->codec];
+	if (stats->samples) {
+		stats->ratio += (ratio - stats->ratio) * 0.25;
+		stats->speed += (speed - stats->speed) * 0.25;
+	} else {
+		stats->ratio = ratio;
+		stats->speed = speed;
+	}
+	stats->samples++;
+	stats->in += state->read_size;
+	stats->out += container->size;
+	if (compressed_size >= state->read_size)
+		thread->stream->raw++;
+	pthread_mutex_unlock(&pack->stream_mutex);
+
+	return 0;
+}
+
+int pack_probe(pack_t pack, glc_thread_state_t *state)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	struct pack_stream_s *stream = thread->probe_stream;
+	size_t sample_size, compressed_size, chunk_compressed_size, step, c;
+	double ratio;
+	int ret, skip;
+
+	if ((ret = pack_scratch(&thread->probe, &thread->probe_size,
+				pack_codec_worstcase(thread->codec, PACK_PROBE_CHUNK_SIZE))))
+		return 0;
+
+	step = state->read_size / PACK_PROBE_CHUNKS;
+	sample_size = compressed_size = 0;
+	for (c = 0; c < PACK_PROBE_CHUNKS; c++) {
+		if (pack_codec_compress(thread->codec, thread->wrk,
+					&state->read_data[c * step], PACK_PROBE_CHUNK_SIZE,
+					thread->probe, &chunk_compressed_size))
+			return 0;
+		sample_size += PACK_PROBE_CHUNK_SIZE;
+		compressed_size += chunk_compressed_size;
+	}
+
+	ratio = (double) compressed_size / (double) sample_size;
+
+	/* probes of one stream can finish in any order, hysteresis copes with that */
+	pthread_mutex_lock(&pack->stream_mutex);
+	stream->probed++;
+
+	if (((!stream->skip) && (ratio > PACK_PROBE_SKIP_RATIO)) ||
+	    ((stream->skip) && (ratio < PACK_PROBE_RESUME_RATIO))) {
+		if (++stream->probe_hits >= PACK_PROBE_HYSTERESIS) {
+			stream->skip = !stream->skip;
+			stream->probe_hits = 0;
+
+			glc_log(pack->glc, GLC_DEBUG, "pack", "%s %d: %s compression (probe ratio %.3f)",
+				 stream->type == GLC_MESSAGE_AUDIO_DATA ? "audio" : "video",
+				 stream->id, stream->skip ? "skipping" : "resuming", ratio);
+		}
+	} else
+		stream->probe_hits = 0;
+
+	if ((skip = stream->skip))
+		stream->skipped++;
+	pthread_mutex_unlock(&pack->stream_mutex);
+
+	return skip;
+}
+
+void pack_report(pack_t pack)
+{
+	struct pack_stream_s *stream = pack->stream;
+
+	if (pack->compression == PACK_ADAPTIVE)
+		pack_adaptive_report(pack);
+
+	if (!pack->probe)
+		return;
+
+	while (stream != NULL) {
+		if (stream->probed)
+			glc_log(pack->glc, GLC_PERFORMANCE, "pack",
+				 "%s %d: %lu of %lu probed packets stored uncompressed",
+				 stream->type == GLC_MESSAGE_AUDIO_DATA ? "audio" : "video",
+				 stream->id, stream->skipped, stream->probed);
+		stream = stream->next;
+	}
+}
+
+void pack_adaptive_report(pack_t pack)
+{
+	struct pack_stream_s *stream = pack->stream;
+	struct pack_codec_stats_s *stats;
+	int codec;
+
+	while (stream != NULL) {
+		if (!stream->packets) {
+			stream = stream->next;
+			continue;
+		}
+
+		glc_log(pack->glc, GLC_PERFORMANCE, "pack",
+			 "%s %d: %lu packets, %lu stored raw after compression",
+			 stream->type == GLC_MESSAGE_AUDIO_DATA ? "audio" : "video",
+			 stream->id, stream->packets, stream->raw);
+
+		for (codec = 0; codec < PACK_CODECS; codec++) {
+			stats = &stream->codec[codec];
+			if (!stats->packets)
+				continue;
+
+			if (codec)
+				glc_log(pack->glc, GLC_PERFORMANCE, "pack",
+					 "  %-8s %5.1f%% of packets, ratio %.3f (last %.3f), %.1f MiB/s",
+					 pack_codec_name(codec),
+					 100.0 * stats->packets / stream->packets,
+					 stats->in ? (double) stats->out / stats->in : 0.0,
+					 stats->ratio, stats->speed);
+			else
+				glc_log(pack->glc, GLC_PERFORMANCE, "pack",
+					 "  %-8s %5.1f%% of packets",
+					 pack_codec_name(codec),
+					 100.0 * stats->packets / stream->packets);
+		}
+
+		stream = stream->next;
+	}
+}
+
+int pack_blocks_write(pack_t pack, glc_thread_state_t *state)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
+	glc_blocks_header_t *blocks_header =
+		(glc_blocks_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
+	char *table = &state->write_data[sizeof(glc_container_message_header_t) +
+					 sizeof(glc_blocks_header_t)];
+	struct pack_blocks_s blocks;
+	struct pack_batch_s batch;
+	size_t compressed_size, i;
+	u_int32_t block_compressed_size;
+	char *data;
+	int ret;
+
+	batch.count = (state->read_size + pack->block_size - 1) / pack->block_size;
+	batch.func = &pack_blocks_compress;
+	batch.arg = &blocks;
+
+	if (thread->block_sizes_count < batch.count) {
+		if (thread->block_sizes)
+			free(thread->block_sizes);
+		if (!(thread->block_sizes = (size_t *) malloc(sizeof(size_t) * batch.count))) {
+			thread->block_sizes_count = 0;
+			return ENOMEM;
+		}
+		thread->block_sizes_count = batch.count;
+	}
+
+	/* each block gets worst case space, gaps are closed afterwards */
+	data = &table[batch.count * sizeof(u_int32_t)];
+	blocks.pack = pack;
+	blocks.compression = thread->codec;
+	blocks.src = state->read_data;
+	blocks.dst = data;
+	blocks.size = state->read_size;
+	blocks.block_size = pack->block_size;
+	blocks.block_worstcase = pack_codec_worstcase(thread->codec, pack->block_size);
+	blocks.sizes = thread->block_sizes;
+
+	if ((ret = pack_pool_run(pack->pool, &batch, thread)))
+		return ret;
+
+	compressed_size = 0;
+	for (i = 0; i < batch.count; i++) {
+		if (compressed_size != i * blocks.block_worstcase)
+			memmove(&data[compressed_size], &data[i * blocks.block_worstcase],
+				blocks.sizes[i]);
+		block_compressed_size = blocks.sizes[i];
+		memcpy(&table[i * sizeof(u_int32_t)], &block_compressed_size, sizeof(u_int32_t));
+		compressed_size += blocks.sizes[i];
+	}
+
+	blocks_header->size = (glc_size_t) state->read_size;
+	memcpy(&blocks_header->header, &state->header, sizeof(glc_message_header_t));
+	blocks_header->compression = pack_codec_message(thread->codec);
+	blocks_header->block_size = pack->block_size;
+	blocks_header->count = batch.count;
+
+	container->size = sizeof(glc_blocks_header_t) + batch.count * sizeof(u_int32_t) +
+			  compressed_size;
+	container->header.type = GLC_MESSAGE_BLOCKS;
+
+	state->header.type = GLC_MESSAGE_CONTAINER;
+
+	return 0;
+}
+
+int pack_blocks_compress(struct pack_batch_s *batch, unsigned int index, void *threadptr)
+{
+	struct pack_blocks_s *blocks = (struct pack_blocks_s *) batch->arg;
+	size_t offset = index * blocks->block_size;
+	size_t size = blocks->size - offset;
+
+	if (size > blocks->block_size)
+		size = blocks->block_size;
+
+	return pack_codec_compress(blocks->compression,
+				   ((struct pack_thread_s *) threadptr)->wrk,
+				   &blocks->src[offset], size,
+				   &blocks->dst[index * blocks->block_worstcase],
+				   &blocks->sizes[index]);
+}
+
+int unpack_init(unpack_t *unpack, glc_t *glc)
+{
+	*unpack = (unpack_t) malloc(sizeof(struct unpack_s));
+	memset(*unpack, 0, sizeof(struct unpack_s));
+
+	(*unpack)->glc = glc;
+	pthread_mutex_init(&(*unpack)->pool_mutex, NULL);
+	pthread_mutex_init(&(*unpack)->delta_mutex, NULL);
+	pthread_cond_init(&(*unpack)->delta_cond, NULL);
+
+	(*unpack)->thread.flags = GLC_THREAD_WRITE | GLC_THREAD_READ;
+	(*unpack)->thread.ptr = *unpack;
+	(*unpack)->thread.thread_create_callback = &unpack_thread_create_callback;
+	(*unpack)->thread.thread_finish_callback = &unpack_thread_finish_callback;
+	(*unpack)->thread.read_callback = &unpack_read_callback;
+	(*unpack)->thread.write_callback = &unpack_write_callback;
+	(*unpack)->thread.finish_callback = &unpack_finish_callback;
+	(*unpack)->thread.threads = glc_threads_hint(glc);
 
 #ifdef __LZO
 	lzo_init();
@@ -391,11 +2361,20 @@ int unpack_process_wait(unpack_t unpack)
 	glc_thread_wait(&unpack->thread);
 	unpack->running = 0;
 
+	if (unpack->pool) {
+		pack_pool_destroy(unpack->pool);
+		unpack->pool = NULL;
+	}
+
 	return 0;
 }
 
 int unpack_destroy(unpack_t unpack)
 {
+	pack_delta_free_streams(unpack->delta_stream);
+	pthread_mutex_destroy(&unpack->pool_mutex);
+	pthread_mutex_destroy(&unpack->delta_mutex);
+	pthread_cond_destroy(&unpack->delta_cond);
 	free(unpack);
 	return 0;
 }
@@ -408,51 +2387,144 @@ void unpack_finish_callback(void *ptr, int err)
 		glc_log(unpack->glc, GLC_ERROR, "unpack", "%s (%d)", strerror(err), err);
 }
 
+int unpack_thread_create_callback(void *ptr, void **threadptr)
+{
+	*threadptr = malloc(sizeof(struct unpack_thread_s));
+	memset(*threadptr, 0, sizeof(struct unpack_thread_s));
+	return 0;
+}
+
+void unpack_thread_finish_callback(void *ptr, void *threadptr, int err)
+{
+	struct unpack_thread_s *thread = (struct unpack_thread_s *) threadptr;
+
+	if (!thread)
+		return;
+
+	if (thread->scratch)
+		free(thread->scratch);
+	if (thread->block_offsets)
+		free(thread->block_offsets);
+	if (thread->planes)
+		free(thread->planes);
+	if (thread->samples)
+		free(thread->samples);
+	free(thread);
+}
+
 int unpack_read_callback(glc_thread_state_t *state)
 {
+	unpack_t unpack = (unpack_t) state->ptr;
+	struct unpack_thread_s *thread = (struct unpack_thread_s *) state->threadptr;
+	glc_message_header_t *header;
+
+	thread->delta = 0;
+
 	if (state->header.type == GLC_MESSAGE_LZO) {
 #ifdef __LZO
 		state->write_size = ((glc_lzo_header_t *) state->read_data)->size;
-		return 0;
+		header = &((glc_lzo_header_t *) state->read_data)->header;
 #else
-		glc_log(((unpack_t) state->ptr)->glc,
-			 GLC_ERROR, "unpack", "LZO not supported");
+		glc_log(unpack->glc, GLC_ERROR, "unpack", "LZO not supported");
 		return ENOTSUP;
 #endif
 	} else if (state->header.type == GLC_MESSAGE_QUICKLZ) {
 #ifdef __QUICKLZ
 		state->write_size = ((glc_quicklz_header_t *) state->read_data)->size;
-		return 0;
+		header = &((glc_quicklz_header_t *) state->read_data)->header;
 #else
-		glc_log(((unpack_t) state->ptr)->glc,
-			 GLC_ERROR, "unpack", "QuickLZ not supported");
+		glc_log(unpack->glc, GLC_ERROR, "unpack", "QuickLZ not supported");
 		return ENOTSUP;
 #endif
 	} else if (state->header.type == GLC_MESSAGE_LZJB) {
 #ifdef __LZJB
 		state->write_size = ((glc_lzjb_header_t *) state->read_data)->size;
-		return 0;
+		header = &((glc_lzjb_header_t *) state->read_data)->header;
 #else
-		glc_log(((unpack_t) state->ptr)->glc,
-			GLC_ERROR, "unpack", "LZJB not supported");
+		glc_log(unpack->glc, GLC_ERROR, "unpack", "LZJB not supported");
 		return ENOTSUP;
 #endif
+	} else if (state->header.type == GLC_MESSAGE_LZ4) {
+#ifdef __LZ4
+		state->write_size = ((glc_lz4_header_t *) state->read_data)->size;
+		header = &((glc_lz4_header_t *) state->read_data)->header;
+#else
+		glc_log(unpack->glc, GLC_ERROR, "unpack", "LZ4 not supported");
+		return ENOTSUP;
+#endif
+	} else if (state->header.type == GLC_MESSAGE_BLOCKS) {
+		state->write_size = ((glc_blocks_header_t *) state->read_data)->size;
+		header = &((glc_blocks_header_t *) state->read_data)->header;
+	} else if (state->header.type == GLC_MESSAGE_VIDEO_LAYOUT) {
+		state->write_size = ((glc_video_layout_header_t *) state->read_data)->size;
+		header = &((glc_video_layout_header_t *) state->read_data)->header;
+	} else if (state->header.type == GLC_MESSAGE_AUDIO_LPC) {
+		state->write_size = ((glc_audio_lpc_header_t *) state->read_data)->size;
+		header = &((glc_audio_lpc_header_t *) state->read_data)->header;
+	} else if ((state->header.type == GLC_MESSAGE_VIDEO_DELTA) |
+		   (state->header.type == GLC_MESSAGE_VIDEO_DELTA_KEY))
+		header = &state->header;
+	else {
+		state->flags |= GLC_THREAD_COPY;
+		return 0;
+	}
+
+	if ((header->type == GLC_MESSAGE_VIDEO_DELTA) |
+	    (header->type == GLC_MESSAGE_VIDEO_DELTA_KEY)) {
+		/* read callbacks are serialized, so this is stream order */
+		thread->delta = 1;
+		thread->delta_seq = unpack->delta_next++;
+		state->write_size -= sizeof(glc_video_delta_header_t) -
+				     sizeof(glc_video_frame_header_t);
+		/* frame may have to be replaced with a drop marker */
+		state->flags |= GLC_THREAD_STATE_UNKNOWN_FINAL_SIZE;
 	}
 
-	state->flags |= GLC_THREAD_COPY;
 	return 0;
 }
 
 int unpack_write_callback(glc_thread_state_t *state)
 {
-	if (state->header.type == GLC_MESSAGE_LZO) {
+	unpack_t unpack = (unpack_t) state->ptr;
+	struct unpack_thread_s *thread = (struct unpack_thread_s *) state->threadptr;
+	size_t size;
+	int ret;
+
+	if (!thread->delta)
+		return unpack_decompress(state, state->write_data, state->write_size);
+
+	if ((state->header.type == GLC_MESSAGE_VIDEO_DELTA) |
+	    (state->header.type == GLC_MESSAGE_VIDEO_DELTA_KEY))
+		return unpack_delta(unpack, thread, state, state->read_data, state->read_size);
+
+	size = state->write_size + sizeof(glc_video_delta_header_t) -
+	       sizeof(glc_video_frame_header_t);
+	if ((ret = pack_scratch(&thread->scratch, &thread->scratch_size, size)))
+		return ret;
+	if ((ret = unpack_decompress(state, thread->scratch, size)))
+		return ret;
+
+	return unpack_delta(unpack, thread, state, thread->scratch, size);
+}
+
+int unpack_decompress(glc_thread_state_t *state, char *dest, size_t size)
+{
+	if (state->header.type == GLC_MESSAGE_VIDEO_LAYOUT)
+		return unpack_layout(state, dest, size);
+	else if (state->header.type == GLC_MESSAGE_AUDIO_LPC)
+		return unpack_audio(state, dest, size);
+	else if (state->header.type == GLC_MESSAGE_BLOCKS) {
+		memcpy(&state->header, &((glc_blocks_header_t *) state->read_data)->header,
+		       sizeof(glc_message_header_t));
+		return unpack_blocks((unpack_t) state->ptr, state, dest, size);
+	} else if (state->header.type == GLC_MESSAGE_LZO) {
 #ifdef __LZO
 		memcpy(&state->header, &((glc_lzo_header_t *) state->read_data)->header,
 		       sizeof(glc_message_header_t));
 		__lzo_decompress((unsigned char *) &state->read_data[sizeof(glc_lzo_header_t)],
 				state->read_size - sizeof(glc_lzo_header_t),
-				(unsigned char *) state->write_data,
-				(lzo_uintp) &state->write_size,
+				(unsigned char *) dest,
+				(lzo_uintp) &size,
 				NULL);
 #else
 		return ENOTSUP;
@@ -462,8 +2534,8 @@ int unpack_write_callback(glc_thread_state_t *state)
 		memcpy(&state->header, &((glc_quicklz_header_t *) state->read_data)->header,
 		       sizeof(glc_message_header_t));
 		quicklz_decompress((const unsigned char *) &state->read_data[sizeof(glc_quicklz_header_t)],
-				   (unsigned char *) state->write_data,
-				   state->write_size);
+				   (unsigned char *) dest,
+				   size);
 #else
 		return ENOTSUP;
 #endif
@@ -472,9 +2544,24 @@ int unpack_write_callback(glc_thread_state_t *state)
 		memcpy(&state->header, &((glc_quicklz_header_t *) state->read_data)->header,
 		       sizeof(glc_message_header_t));
 		lzjb_decompress(&state->read_data[sizeof(glc_lzjb_header_t)],
-				state->write_data,
+				dest,
 				state->read_size - sizeof(glc_lzjb_header_t),
-				state->write_size);
+				size);
+#else
+		return ENOTSUP;
+#endif
+	} else if (state->header.type == GLC_MESSAGE_LZ4) {
+#ifdef __LZ4
+		memcpy(&state->header, &((glc_lz4_header_t *) state->read_data)->header,
+		       sizeof(glc_message_header_t));
+		if (LZ4_decompress_safe(&state->read_data[sizeof(glc_lz4_header_t)],
+					dest,
+					state->read_size - sizeof(glc_lz4_header_t),
+					size) != (int) size) {
+			glc_log(((unpack_t) state->ptr)->glc,
+				 GLC_ERROR, "unpack", "corrupted LZ4 packet");
+			return EINVAL;
+		}
 #else
 		return ENOTSUP;
 #endif
@@ -484,4 +2571,405 @@ int unpack_write_callback(glc_thread_state_t *state)
 	return 0;
 }
 
+int unpack_blocks(unpack_t unpack, glc_thread_state_t *state, char *dest, size_t size)
+{
+	struct unpack_thread_s *thread = (struct unpack_thread_s *) state->threadptr;
+	glc_blocks_header_t *blocks_header = (glc_blocks_header_t *) state->read_data;
+	char *table = &state->read_data[sizeof(glc_blocks_header_t)];
+	struct unpack_blocks_s blocks;
+	struct pack_batch_s batch;
+	u_int32_t block_compressed_size;
+	size_t offset, i;
+	int ret;
+
+	if ((!blocks_header->block_size) || (!blocks_header->count) ||
+	    ((size + blocks_header->block_size - 1) / blocks_header->block_size !=
+	     blocks_header->count) ||
+	    (sizeof(glc_blocks_header_t) + blocks_header->count * sizeof(u_int32_t) >
+	     state->read_size)) {
+		glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted block table");
+		return EINVAL;
+	}
+
+	/* worker pool is created when first needed */
+	pthread_mutex_lock(&unpack->pool_mutex);
+	if (!unpack->pool)
+		ret = pack_pool_create(&unpack->pool, unpack->glc, glc_threads_hint(unpack->glc),
+				       NULL, NULL, unpack);
+	else
+		ret = 0;
+	pthread_mutex_unlock(&unpack->pool_mutex);
+	if (ret)
+		return ret;
+
+	if (thread->block_offsets_count < blocks_header->count + 1) {
+		if (thread->block_offsets)
+			free(thread->block_offsets);
+		thread->block_offsets = (size_t *) malloc(sizeof(size_t) *
+							  (blocks_header->count + 1));
+		thread->block_offsets_count = blocks_header->count + 1;
+	}
+
+	offset = sizeof(glc_blocks_header_t) + blocks_header->count * sizeof(u_int32_t);
+	for (i = 0; i < blocks_header->count; i++) {
+		thread->block_offsets[i] = offset;
+		memcpy(&block_compressed_size, &table[i * sizeof(u_int32_t)], sizeof(u_int32_t));
+		offset += block_compressed_size;
+	}
+	thread->block_offsets[i] = offset;
+
+	if (offset > state->read_size) {
+		glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted block table");
+		return EINVAL;
+	}
+
+	blocks.unpack = unpack;
+	blocks.compression = blocks_header->compression;
+	blocks.src = state->read_data;
+	blocks.dst = dest;
+	blocks.size = size;
+	blocks.block_size = blocks_header->block_size;
+	blocks.offsets = thread->block_offsets;
+
+	batch.func = &unpack_blocks_decompress;
+	batch.arg = &blocks;
+	batch.count = blocks_header->count;
+
+	if ((ret = pack_pool_run(unpack->pool, &batch, NULL))) {
+		glc_log(unpack->glc, GLC_ERROR, "unpack",
+			 "can't decompress blocks: %s (%d)", strerror(ret), ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int unpack_blocks_decompress(struct pack_batch_s *batch, unsigned int index, void *threadptr)
+{
+	struct unpack_blocks_s *blocks = (struct unpack_blocks_s *) batch->arg;
+	size_t offset = index * blocks->block_size;
+	size_t size = blocks->size - offset;
+
+	if (size > blocks->block_size)
+		size = blocks->block_size;
+
+	return unpack_codec_decompress(blocks->compression,
+				       &blocks->src[blocks->offsets[index]],
+				       blocks->offsets[index + 1] - blocks->offsets[index],
+				       &blocks->dst[offset], size);
+}
+
+int unpack_delta(unpack_t unpack, struct unpack_thread_s *thread,
+		 glc_thread_state_t *state, char *src, size_t size)
+{
+	glc_video_delta_header_t *delta_header = (glc_video_delta_header_t *) src;
+	glc_video_frame_header_t *pic_header = (glc_video_frame_header_t *) state->write_data;
+	char *pic = &state->write_data[sizeof(glc_video_frame_header_t)];
+	glc_frame_drop_message_t *drop_msg;
+	struct pack_delta_stream_s *stream;
+	struct timeval now;
+	struct timespec timeout;
+	int ret = 0;
+
+	src = &src[sizeof(glc_video_delta_header_t)];
+	size -= sizeof(glc_video_delta_header_t);
+
+	/* wait until previous delta coded frame is restored */
+	pthread_mutex_lock(&unpack->delta_mutex);
+	while (unpack->delta_done != thread->delta_seq) {
+		if (glc_state_test(unpack->glc, GLC_STATE_CANCEL)) {
+			pthread_mutex_unlock(&unpack->delta_mutex);
+			return EINTR;
+		}
+
+		gettimeofday(&now, NULL);
+		timeout.tv_sec = now.tv_sec + 1;
+		timeout.tv_nsec = now.tv_usec * 1000;
+		pthread_cond_timedwait(&unpack->delta_cond, &unpack->delta_mutex, &timeout);
+	}
+	pthread_mutex_unlock(&unpack->delta_mutex);
+
+	stream = pack_delta_get_stream(&unpack->delta_stream, delta_header->id);
+	pic_header->id = delta_header->id;
+	pic_header->time = delta_header->time;
+
+	if (delta_header->flags & GLC_VIDEO_DELTA_KEY) {
+		if (stream->size != size) {
+			if (stream->ref)
+				free(stream->ref);
+			if (!(stream->ref = (char *) malloc(size))) {
+				stream->size = 0;
+				ret = ENOMEM;
+				goto finish;
+			}
+			stream->size = size;
+		}
+
+		memcpy(stream->ref, src, size);
+		memcpy(pic, src, size);
+	} else if (!stream->size) {
+		/* reading started between key frames, f.ex. after seeking */
+		drop_msg = (glc_frame_drop_message_t *) state->write_data;
+		drop_msg->id = delta_header->id;
+		drop_msg->time = delta_header->time;
+		drop_msg->reason = GLC_FRAME_DROP_NO_KEY_FRAME;
+
+		state->header.type = GLC_MESSAGE_FRAME_DROP;
+		state->write_size = sizeof(glc_frame_drop_message_t);
+		goto finish;
+	} else if (stream->size != size) {
+		glc_log(unpack->glc, GLC_ERROR, "unpack",
+			 "video %d: delta frame without matching key frame", delta_header->id);
+		ret = EINVAL;
+		goto finish;
+	} else
+		pack_delta_decode(pic, stream->ref, src, size);
+
+	state->header.type = GLC_MESSAGE_VIDEO_FRAME;
+
+finish:
+	pthread_mutex_lock(&unpack->delta_mutex);
+	unpack->delta_done++;
+	pthread_cond_broadcast(&unpack->delta_cond);
+	pthread_mutex_unlock(&unpack->delta_mutex);
+
+	return ret;
+}
+
+int unpack_layout(glc_thread_state_t *state, char *dest, size_t size)
+{
+	unpack_t unpack = (unpack_t) state->ptr;
+	struct unpack_thread_s *thread = (struct unpack_thread_s *) state->threadptr;
+	glc_video_layout_header_t layout_header;
+	char *planes, *read_data = state->read_data;
+	size_t planes_size, expected, read_size = state->read_size;
+	size_t width, height, row, bpp;
+	int ret;
+
+	if (state->read_size < sizeof(glc_video_layout_header_t)) {
+		glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted video layout");
+		return EINVAL;
+	}
+
+	memcpy(&layout_header, state->read_data, sizeof(glc_video_layout_header_t));
+	planes = &state->read_data[sizeof(glc_video_layout_header_t)];
+	planes_size = state->read_size - sizeof(glc_video_layout_header_t);
+
+	if ((layout_header.compression == GLC_MESSAGE_QUICKLZ) ||
+	    (layout_header.compression == GLC_MESSAGE_LZO) ||
+	    (layout_header.compression == GLC_MESSAGE_LZJB) ||
+	    (layout_header.compression == GLC_MESSAGE_LZ4) ||
+	    (layout_header.compression == GLC_MESSAGE_BLOCKS)) {
+		/* all compressed message headers start with data size */
+		planes_size = ((glc_lzo_header_t *) planes)->size;
+		if ((ret = pack_scratch(&thread->planes, &thread->planes_size, planes_size)))
+			return ret;
+
+		state->header.type = layout_header.compression;
+		state->read_data = planes;
+		state->read_size = read_size - sizeof(glc_video_layout_header_t);
+		ret = unpack_decompress(state, thread->planes, planes_size);
+		state->read_data = read_data;
+		state->read_size = read_size;
+		if (ret)
+			return ret;
+
+		planes = thread->planes;
+	}
+
+	width = layout_header.width;
+	height = layout_header.height;
+	row = layout_header.row;
+	bpp = layout_header.bpp;
+
+	expected = 0;
+	if (((bpp == 3) || (bpp == 4)) && (row >= width * bpp)) {
+		expected = layout_header.prefix + 3 * width * height;
+		if (layout_header.flags & GLC_VIDEO_LAYOUT_PADDING)
+			expected += height * (row - width * bpp);
+		if (layout_header.flags & GLC_VIDEO_LAYOUT_ALPHA)
+			expected += width * height;
+	}
+
+	if ((!expected) || (planes_size != expected) || (layout_header.size != size) ||
+	    (size != layout_header.prefix + row * height)) {
+		glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted video layout");
+		return EINVAL;
+	}
+
+	if (layout_header.flags & GLC_VIDEO_LAYOUT_YCOCG) {
+		/* transform is inverted in place, don't touch read buffer */
+		if (planes != thread->planes) {
+			if ((ret = pack_scratch(&thread->planes, &thread->planes_size, planes_size)))
+				return ret;
+			memcpy(thread->planes, planes, planes_size);
+			planes = thread->planes;
+		}
+		unpack_layout_ycocg(&planes[layout_header.prefix], width * height);
+	}
+
+	memcpy(dest, planes, layout_header.prefix);
+	unpack_layout_merge(&dest[layout_header.prefix], &planes[layout_header.prefix],
+			    &layout_header);
+
+	state->header = layout_header.header;
+	return 0;
+}
+
+static inline u_int64_t unpack_bits_get(struct unpack_bits_s *bits, unsigned int n)
+{
+	u_int64_t value;
+
+	while (bits->count < n) {
+		bits->acc <<= 8;
+		if (bits->pos < bits->size)
+			bits->acc |= bits->data[bits->pos++];
+		else
+			bits->underflow = 1;
+		bits->count += 8;
+	}
+
+	bits->count -= n;
+	value = (bits->acc >> bits->count) & ((1ULL << n) - 1);
+	bits->acc &= (1ULL << bits->count) - 1;
+	return value;
+}
+
+static inline u_int64_t unpack_bits_get_long(struct unpack_bits_s *bits, unsigned int n)
+{
+	u_int64_t value = 0;
+
+	if (n > 32) {
+		value = unpack_bits_get(bits, n - 32) << 32;
+		n = 32;
+	}
+	return value | unpack_bits_get(bits, n);
+}
+
+int unpack_audio_decode(int32_t *x, size_t frames, size_t sample_size,
+			const unsigned char *src, size_t size, unsigned int order)
+{
+	unsigned int sample_bits = sample_size * 8, escape_bits = sample_bits + 5;
+	struct unpack_bits_s bits;
+	size_t i, start, end;
+	unsigned int k, q;
+	u_int64_t u;
+
+	memset(&bits, 0, sizeof(struct unpack_bits_s));
+	bits.data = src;
+	bits.size = size;
+
+	if (order > frames)
+		return EINVAL;
+
+	/* sign extend warm-up samples */
+	for (i = 0; i < order; i++)
+		x[i] = (int32_t) (unpack_bits_get_long(&bits, sample_bits) << (32 - sample_bits))
+		       >> (32 - sample_bits);
+
+	for (start = order; (start < frames) && (!bits.underflow); start = end) {
+		end = start + GLC_AUDIO_LPC_PARTITION;
+		if (end > frames)
+			end = frames;
+
+		if ((k = unpack_bits_get(&bits, 6)) > escape_bits)
+			return EINVAL;
+
+		for (i = start; (i < end) && (!bits.underflow); i++) {
+			for (q = 0; (q < 32) && (unpack_bits_get(&bits, 1)); q++);
+
+			if (q < 32)
+				u = ((u_int64_t) q << k) | unpack_bits_get_long(&bits, k);
+			else
+				u = unpack_bits_get_long(&bits, escape_bits);
+
+			x[i] = pack_audio_predict(x, i, order) + (int64_t) ((u >> 1) ^ -(u & 1));
+		}
+	}
+
+	return bits.underflow ? EINVAL : 0;
+}
+
+int unpack_audio(glc_thread_state_t *state, char *dest, size_t size)
+{
+	unpack_t unpack = (unpack_t) state->ptr;
+	struct unpack_thread_s *thread = (struct unpack_thread_s *) state->threadptr;
+	glc_audio_lpc_header_t lpc_header;
+	glc_audio_lpc_channel_header_t channel_header;
+	unsigned char *data = (unsigned char *) &dest[sizeof(glc_audio_data_header_t)];
+	size_t sample_size, channel_size, frames, channels;
+	size_t i, c, pos, stride, offset;
+	int32_t *x;
+	int ret;
+
+	if (state->read_size < sizeof(glc_audio_lpc_header_t) + sizeof(glc_audio_data_header_t))
+		goto corrupted;
+	memcpy(&lpc_header, state->read_data, sizeof(glc_audio_lpc_header_t));
+
+	sample_size = pack_audio_sample_size(lpc_header.format);
+	frames = lpc_header.frames;
+	channels = lpc_header.channels;
+	channel_size = frames * sample_size;
+
+	if ((!sample_size) || (!channel_size) || (lpc_header.size != size) ||
+	    (size < sizeof(glc_audio_data_header_t)) ||
+	    ((size - sizeof(glc_audio_data_header_t)) % channel_size) ||
+	    ((size - sizeof(glc_audio_data_header_t)) / channel_size != channels))
+		goto corrupted;
+
+	if ((ret = pack_scratch(&thread->samples, &thread->samples_size,
+				frames * sizeof(int32_t))))
+		return ret;
+	x = (int32_t *) thread->samples;
+
+	if (lpc_header.flags & GLC_AUDIO_INTERLEAVED)
+		stride = channels * sample_size;
+	else
+		stride = sample_size;
+
+	pos = sizeof(glc_audio_lpc_header_t);
+	memcpy(dest, &state->read_data[pos], sizeof(glc_audio_data_header_t));
+	pos += sizeof(glc_audio_data_header_t);
+
+	for (c = 0; c < channels; c++) {
+		if (pos + sizeof(glc_audio_lpc_channel_header_t) > state->read_size)
+			goto corrupted;
+		memcpy(&channel_header, &state->read_data[pos],
+		       sizeof(glc_audio_lpc_channel_header_t));
+		pos += sizeof(glc_audio_lpc_channel_header_t);
+		if (channel_header.size > state->read_size - pos)
+			goto corrupted;
+
+		if (lpc_header.flags & GLC_AUDIO_INTERLEAVED)
+			offset = c * sample_size;
+		else
+			offset = c * channel_size;
+
+		if (channel_header.order == GLC_AUDIO_LPC_VERBATIM) {
+			if (channel_header.size != channel_size)
+				goto corrupted;
+			for (i = 0; i < frames; i++)
+				memcpy(&data[offset + i * stride],
+				       &state->read_data[pos + i * sample_size], sample_size);
+		} else {
+			if ((channel_header.order > 4) ||
+			    (unpack_audio_decode(x, frames, sample_size,
+						 (const unsigned char *) &state->read_data[pos],
+						 channel_header.size, channel_header.order)))
+				goto corrupted;
+			for (i = 0; i < frames; i++)
+				unpack_audio_store(&data[offset + i * stride], x[i], sample_size);
+		}
+
+		pos += channel_header.size;
+	}
+
+	state->header = lpc_header.header;
+	return 0;
+
+corrupted:
+	glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted audio packet");
+	return EINVAL;
+}
+
 /**  \} */
@@ -34,6 +34,10 @@ typedef struct pack_s* pack_t;
 #define PACK_LZO           0x2
 /** LZJB compression */
 #define PACK_LZJB          0x3
+/** LZ4 compression */
+#define PACK_LZ4           0x4
+/** select compression per packet */
+#define PACK_ADAPTIVE     0x10
 
 /**
  * \brief unpack object
@@ -51,9 +55,17 @@ __PUBLIC int pack_init(pack_t *pack, glc_t *glc);
 /**
  * \brief set compression
  *
- * QuickLZ (PACK_QUICKLZ) and LZO (PACK_LZO) are currently supported.
- * Both are fast enough for stream compression.
- * LZO compresses marginally better but is slower. QuickLZ is default.
+ * QuickLZ (PACK_QUICKLZ), LZO (PACK_LZO), LZJB (PACK_LZJB) and
+ * LZ4 (PACK_LZ4) are currently supported. All are fast enough for
+ * stream compression. LZO compresses marginally better but is slower.
+ * LZ4 decompresses fastest. QuickLZ is default.
+ *
+ * PACK_ADAPTIVE measures compression ratio and speed of every
+ * supported algorithm per stream and picks the one with best ratio
+ * among those that reach target throughput (see
+ * pack_set_adaptive_target()) for each packet. Packets that don't
+ * compress are stored uncompressed. Statistics are logged with
+ * GLC_PERFORMANCE level when processing stops.
  * \param pack pack object
  * \param compression compression algorithm
  * \return 0 on success otherwise an error code
@@ -71,6 +83,98 @@ __PUBLIC int pack_set_compression(pack_t pack, int compression);
  */
 __PUBLIC int pack_set_minimum_size(pack_t pack, size_t min_size);
 
+/**
+ * \brief set adaptive compression throughput target
+ *
+ * Used only with PACK_ADAPTIVE. Default is 200 MiB/s.
+ * \param pack pack object
+ * \param throughput target per-thread throughput in MiB/s
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_adaptive_target(pack_t pack, unsigned int throughput);
+
+/**
+ * \brief skip compression of incompressible streams
+ *
+ * A few small chunks of each packet are compressed first. When
+ * that consistently doesn't pay off, packets of that stream are
+ * stored uncompressed until probes show gain again. This saves
+ * CPU on noise-like video and most audio.
+ * \param pack pack object
+ * \param probe 1 enables probing, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_probe(pack_t pack, int probe);
+
+/**
+ * \brief set inter-frame delta coding
+ *
+ * When enabled, every video frame is XORed with previous frame
+ * of the same stream before compression. Unchanged areas turn
+ * into zero runs which compress far better. Every [interval]th
+ * frame is written as a key frame, so a damaged stream recovers
+ * at next key frame. Key frame is also forced when frame size
+ * changes and after a callback request, since callback may
+ * start a new stream file (eg. reload in hook).
+ * \param pack pack object
+ * \param interval key frame interval in frames, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_delta(pack_t pack, unsigned int interval);
+
+/**
+ * \brief store BGR and BGRA video in planar layout
+ *
+ * Before compression each picture is split into one plane
+ * per colour channel. Constant alpha and all-zero row padding
+ * are dropped. Codecs find far more matches in planes than in
+ * interleaved pixels. unpack restores original data exactly.
+ * \param pack pack object
+ * \param layout 1 enables, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_layout(pack_t pack, int layout);
+
+/**
+ * \brief apply YCoCg-R colour transform to planar video
+ *
+ * Implies planar layout (see pack_set_layout()). Colour planes
+ * are replaced by luma and two chroma differences using integer
+ * lifting steps, so inter-channel correlation turns into small
+ * values that compress better. Transform is exactly reversible
+ * and unpack inverts it.
+ * \param pack pack object
+ * \param ycocg 1 enables, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_ycocg(pack_t pack, int ycocg);
+
+/**
+ * \brief code audio losslessly
+ *
+ * Audio data is coded per channel with a fixed polynomial
+ * predictor and Rice coded residuals, like FLAC does, instead
+ * of general purpose compression. PCM compresses several times
+ * better this way. Channels that don't gain are stored as is.
+ * \param pack pack object
+ * \param lpc 1 enables, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_lpc(pack_t pack, int lpc);
+
+/**
+ * \brief compress large packets in parallel blocks
+ *
+ * Packets larger than [block_size] are split into independent
+ * blocks which are compressed concurrently by a pool of worker
+ * threads. unpack decompresses the blocks in parallel as well.
+ * Blocks compress slightly worse than the whole packet would.
+ * \param pack pack object
+ * \param block_size block size in bytes, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_block_size(pack_t pack, size_t block_size);
+
 /**
  * \brief start processing threads
  *
@@ -110,7 +214,9 @@ __PUBLIC int unpack_init(unpack_t *unpack, glc_t *glc);
 /**
  * \brief start processing threads
  *
- * unpack decompresses all supported compressed messages.
+ * unpack decompresses all supported compressed messages and
+ * restores delta coded and planar video frames and losslessly
+ * coded audio.
  * \param unpack unpack object
  * \param from source buffer
  * \param to target buffer
@@ -19,6 +19,10 @@
 #include <pthread.h>
 #include <errno.h>
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
 #include <glc/common/log.h>
@@ -45,6 +49,7 @@ struct scale_video_stream_s {
 	unsigned int w, h, sw, sh, bpp;
 	unsigned int row;
 	double scale;
+	int sized;
 	int created;
 
 	unsigned int rw, rh, rx, ry;
@@ -64,6 +69,7 @@ struct scale_s {
 	struct scale_video_stream_s *video;
 	glc_thread_t thread;
 
+	pthread_mutex_t scale_mutex;
 	double scale;
 	unsigned int width, height;
 };
@@ -80,6 +86,8 @@ int scale_generate_ycbcr_map(scale_t scale, struct scale_video_stream_s *video);
 
 void scale_rgb_convert(scale_t scale, struct scale_video_stream_s *video,
 		       unsigned char *from, unsigned char *to);
+void scale_rgb_unpad(scale_t scale, struct scale_video_stream_s *video,
+		     unsigned char *from, unsigned char *to);
 void scale_rgb_half(scale_t scale, struct scale_video_stream_s *video,
 		    unsigned char *from, unsigned char *to);
 void scale_rgb_scale(scale_t scale, struct scale_video_stream_s *video,
@@ -104,12 +112,14 @@ int scale_init(scale_t *scale, glc_t *glc)
 	(*scale)->thread.ptr = *scale;
 	(*scale)->thread.threads = glc_threads_hint(glc);
 	(*scale)->scale = 1.0;
+	pthread_mutex_init(&(*scale)->scale_mutex, NULL);
 
 	return 0;
 }
 
 int scale_destroy(scale_t scale)
 {
+	pthread_mutex_destroy(&scale->scale_mutex);
 	free(scale);
 	return 0;
 }
@@ -119,8 +129,11 @@ int scale_set_scale(scale_t scale, double factor)
 	if (factor <= 0)
 		return EINVAL;
 
+	/* scale can be changed while capturing, eg. by gl_capture governor */
+	pthread_mutex_lock(&scale->scale_mutex);
 	scale->scale = factor;
 	scale->flags &= ~SCALE_SIZE;
+	pthread_mutex_unlock(&scale->scale_mutex);
 	return 0;
 }
 
@@ -129,9 +142,11 @@ int scale_set_size(scale_t scale, unsigned int width, unsigned int height)
 	if ((!width) | (!height))
 		return EINVAL;
 
+	pthread_mutex_lock(&scale->scale_mutex);
 	scale->width = width;
 	scale->height = height;
 	scale->flags |= SCALE_SIZE;
+	pthread_mutex_unlock(&scale->scale_mutex);
 	return 0;
 }
 
@@ -271,6 +286,28 @@ void scale_rgb_convert(scale_t scale, struct scale_video_stream_s *video,
 	}
 }
 
+void scale_rgb_unpad(scale_t scale, struct scale_video_stream_s *video,
+		     unsigned char *from, unsigned char *to)
+{
+	unsigned int y, x = 0;
+	unsigned int len = video->w * video->bpp;
+
+	for (y = 0; y < video->h; y++) {
+#ifdef __SSE2__
+		/* rows are cache-line aligned when frame itself is */
+		if (!((size_t) from % 16)) {
+			for (x = 0; x + 16 <= len; x += 16)
+				_mm_storeu_si128((__m128i *) &to[x],
+						 _mm_load_si128((__m128i *) &from[x]));
+		}
+#endif
+		memcpy(&to[x], &from[x], len - x);
+		from += video->row;
+		to += len;
+		x = 0;
+	}
+}
+
 void scale_rgb_half(scale_t scale, struct scale_video_stream_s *video,
 		    unsigned char *from, unsigned char *to)
 {
@@ -305,7 +342,7 @@ void scale_rgb_scale(scale_t scale, struct scale_video_stream_s *video,
 {
 	unsigned int x, y, tp, sp;
 
-	if (scale->flags & SCALE_SIZE)
+	if (video->sized)
 		memset(to, 0, video->size);
 
 	for (y = 0; y < video->sh; y++) {
@@ -406,7 +443,7 @@ void scale_ycbcr_scale(scale_t scale, struct scale_video_stream_s *video,
 	Cb_to = &to[video->rw * video->rh];
 	Cr_to = &Cb_to[(video->rw / 2) * (video->rh / 2)];
 
-	if (scale->flags & SCALE_SIZE) {
+	if (video->sized) {
 		memset(Y_to, 0, video->rw * video->rh);
 		memset(Cb_to, 128, (video->rw / 2) * (video->rh / 2));
 		memset(Cr_to, 128, (video->rw / 2) * (video->rh / 2));
@@ -459,9 +496,14 @@ int scale_video_format_message(scale_t scale,
 	video->w = format_message->width;
 	video->h = format_message->height;
 
-	if (scale->flags & SCALE_SIZE) {
-		video->rw = scale->width;
-		video->rh = scale->height;
+	pthread_mutex_lock(&scale->scale_mutex);
+	video->sized = (scale->flags & SCALE_SIZE) ? 1 : 0;
+	video->scale = scale->scale;
+	video->rw = scale->width;
+	video->rh = scale->height;
+	pthread_mutex_unlock(&scale->scale_mutex);
+
+	if (video->sized) {
 
 		if ((float) video->rw / (float) video->w < (float) video->rh / (float) video->h)
 			video->scale = (float) video->rw / (float) video->w;
@@ -476,7 +518,6 @@ int scale_video_format_message(scale_t scale,
 			 "real size is %ux%u, scaled picture starts at %ux%u",
 			 video->rw, video->rh, video->rx, video->ry);
 	} else {
-		video->scale = scale->scale;
 		video->sw = video->scale * video->w;
 		video->sh = video->scale * video->h;
 
@@ -497,6 +538,9 @@ int scale_video_format_message(scale_t scale,
 		if (format_message->flags & GLC_VIDEO_DWORD_ALIGNED) {
 			if (video->row % 8 != 0)
 				video->row += 8 - video->row % 8;
+		} else if (format_message->flags & GLC_VIDEO_CACHELINE_ALIGNED) {
+			if (video->row % GLC_VIDEO_CACHELINE != 0)
+				video->row += GLC_VIDEO_CACHELINE - video->row % GLC_VIDEO_CACHELINE;
 		}
 	}
 
@@ -504,7 +548,7 @@ int scale_video_format_message(scale_t scale,
 
 	if ((video->format == GLC_VIDEO_BGR) |
 	    (video->format == GLC_VIDEO_BGRA)) {
-		if ((video->scale == 0.5) && !(scale->flags & SCALE_SIZE)) {
+		if ((video->scale == 0.5) && !(video->sized)) {
 			glc_log(scale->glc, GLC_DEBUG, "scale",
 				 "scaling RGB data to half-size (from %ux%u to %ux%u)",
 				 video->w, video->h, video->sw, video->sh);
@@ -514,6 +558,12 @@ int scale_video_format_message(scale_t scale,
 			   (video->format == GLC_VIDEO_BGRA)) {
 			glc_log(scale->glc, GLC_DEBUG, "scale", "converting BGRA to BGR");
 			video->proc = scale_rgb_convert;
+		} else if ((video->rw == video->w) &&
+			   (video->rh == video->h) &&
+			   (format_message->flags & GLC_VIDEO_CACHELINE_ALIGNED)) {
+			/* cache-line padding is only useful before compression */
+			glc_log(scale->glc, GLC_DEBUG, "scale", "stripping row padding");
+			video->proc = scale_rgb_unpad;
 		} else if ((video->rw != video->w) | (video->rh != video->h)) {
 			glc_log(scale->glc, GLC_DEBUG, "scale",
 				 "scaling RGB data with factor %f (from %ux%u to %ux%u)",
@@ -524,14 +574,14 @@ int scale_video_format_message(scale_t scale,
 
 		format_message->format = GLC_VIDEO_BGR; /* after scaling data is in BGR */
 
-		if (video->proc) /* dword alignment is lost if something is done to the data */
-			format_message->flags &= ~GLC_VIDEO_DWORD_ALIGNED;
+		if (video->proc) /* alignment is lost if something is done to the data */
+			format_message->flags &= ~(GLC_VIDEO_DWORD_ALIGNED | GLC_VIDEO_CACHELINE_ALIGNED);
 
 		format_message->width = video->rw;
 		format_message->height = video->rh;
 		video->size = video->rw * video->rh * 3;
 
-		if ((scale->flags & SCALE_SIZE) && (video->created) &&
+		if ((video->sized) && (video->created) &&
 		    (format_message->flags == old_flags))
 			state->flags |= GLC_THREAD_STATE_SKIP_WRITE;
 		video->created = 1;
@@ -544,7 +594,7 @@ int scale_video_format_message(scale_t scale,
 		format_message->height = video->rh;
 		video->size = video->rw * video->rh + 2 * ((video->rw / 2) * (video->rh / 2));
 
-		if ((video->scale == 0.5) && !(scale->flags & SCALE_SIZE)) {
+		if ((video->scale == 0.5) && !(video->sized)) {
 			glc_log(scale->glc, GLC_DEBUG, "scale",
 				 "scaling Y'CbCr data to half-size (from %ux%u to %ux%u)",
 				 video->w, video->h, video->sw, video->sh);
@@ -557,7 +607,7 @@ int scale_video_format_message(scale_t scale,
 			scale_generate_ycbcr_map(scale, video);
 		}
 
-		if ((scale->flags & SCALE_SIZE) && (video->created) &&
+		if ((video->sized) && (video->created) &&
 		    (format_message->flags == old_flags))
 			state->flags |= GLC_THREAD_STATE_SKIP_WRITE;
 		video->created = 1;
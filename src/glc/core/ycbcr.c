@@ -84,6 +84,7 @@ struct ycbcr_s {
 	glc_t *glc;
 	glc_thread_t thread;
 	int running;
+	pthread_mutex_t scale_mutex;
 	double scale;
 
 	struct ycbcr_video_stream_s *video;
@@ -119,12 +120,14 @@ int ycbcr_init(ycbcr_t *ycbcr, glc_t *glc)
 	(*ycbcr)->thread.ptr = *ycbcr;
 	(*ycbcr)->thread.threads = glc_threads_hint(glc);
 	(*ycbcr)->scale = 1.0;
+	pthread_mutex_init(&(*ycbcr)->scale_mutex, NULL);
 
 	return 0;
 }
 
 int ycbcr_destroy(ycbcr_t ycbcr)
 {
+	pthread_mutex_destroy(&ycbcr->scale_mutex);
 	free(ycbcr);
 	return 0;
 }
@@ -134,7 +137,10 @@ int ycbcr_set_scale(ycbcr_t ycbcr, double scale)
 	if (scale <= 0)
 		return EINVAL;
 
+	/* scale can be changed while capturing, eg. by gl_capture governor */
+	pthread_mutex_lock(&ycbcr->scale_mutex);
 	ycbcr->scale = scale;
+	pthread_mutex_unlock(&ycbcr->scale_mutex);
 	return 0;
 }
 
@@ -440,9 +446,14 @@ int ycbcr_video_format_message(ycbcr_t ycbcr, glc_video_format_message_t *video_
 	if (video_format->flags & GLC_VIDEO_DWORD_ALIGNED) {
 		if (video->row % 8 != 0)
 			video->row += 8 - video->row % 8;
+	} else if (video_format->flags & GLC_VIDEO_CACHELINE_ALIGNED) {
+		if (video->row % GLC_VIDEO_CACHELINE != 0)
+			video->row += GLC_VIDEO_CACHELINE - video->row % GLC_VIDEO_CACHELINE;
 	}
 
+	pthread_mutex_lock(&ycbcr->scale_mutex);
 	video->scale = ycbcr->scale;
+	pthread_mutex_unlock(&ycbcr->scale_mutex);
 	video->yw = video->w * video->scale;
 	video->yh = video->h * video->scale;
 	video->yw -= video->yw % 2; /* safer and faster             */
@@ -452,7 +463,7 @@ int ycbcr_video_format_message(ycbcr_t ycbcr, glc_video_format_message_t *video_
 	video->ch = video->yh / 2;
 
 	/* nuke old flags */
-	video_format->flags &= ~GLC_VIDEO_DWORD_ALIGNED;
+	video_format->flags &= ~(GLC_VIDEO_DWORD_ALIGNED | GLC_VIDEO_CACHELINE_ALIGNED);
 	video_format->format = GLC_VIDEO_YCBCR_420JPEG;
 	video_format->width = video->yw;
 	video_format->height = video->yh;
@@ -50,7 +50,7 @@ struct img_s {
 	unsigned int w, h;
 	unsigned int row;
 	unsigned char *prev_video_frame_message;
-	glc_utime_t time;
+	glc_utime_t time, start_time;
 	int i;
 
 	img_write_proc write_proc;
@@ -62,6 +62,8 @@ int img_read_callback(glc_thread_state_t *state);
 int img_video_format_message(img_t img, glc_video_format_message_t *video_format);
 int img_video_frame_message(img_t img, glc_video_frame_header_t *pic_hdr,
 	    const unsigned char *pic, size_t pic_size);
+int img_frame_drop_message(img_t img, glc_frame_drop_message_t *drop_msg);
+int img_write_at(img_t img, glc_utime_t time, const unsigned char *pic);
 
 int img_write_bmp(img_t img, const unsigned char *pic,
 		  unsigned int w, unsigned int h,
@@ -128,6 +130,12 @@ int img_set_fps(img_t img, double fps)
 	return 0;
 }
 
+int img_set_start_time(img_t img, glc_utime_t time)
+{
+	img->start_time = img->time = time;
+	return 0;
+}
+
 int img_set_filename(img_t img, const char *filename)
 {
 	img->filename_format = filename;
@@ -170,7 +178,7 @@ void img_finish_callback(void *ptr, int err)
 	}
 
 	img->i = 0;
-	img->time = 0;
+	img->time = img->start_time;
 }
 
 int img_read_callback(glc_thread_state_t *state)
@@ -184,7 +192,8 @@ int img_read_callback(glc_thread_state_t *state)
 		ret = img_video_frame_message(img, (glc_video_frame_header_t *) state->read_data,
 			      (const unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
 			      state->read_size);
-	}
+	} else if (state->header.type == GLC_MESSAGE_FRAME_DROP)
+		ret = img_frame_drop_message(img, (glc_frame_drop_message_t *) state->read_data);
 
 	return ret;
 }
@@ -207,6 +216,9 @@ int img_video_format_message(img_t img, glc_video_format_message_t *video_format
 	if (video_format->flags & GLC_VIDEO_DWORD_ALIGNED) {
 		if (img->row % 8 != 0)
 			img->row += 8 - img->row % 8;
+	} else if (video_format->flags & GLC_VIDEO_CACHELINE_ALIGNED) {
+		if (img->row % GLC_VIDEO_CACHELINE != 0)
+			img->row += GLC_VIDEO_CACHELINE - img->row % GLC_VIDEO_CACHELINE;
 	}
 
 	if (img->prev_video_frame_message)
@@ -222,14 +234,33 @@ int img_video_frame_message(img_t img, glc_video_frame_header_t *pic_hdr,
 	    const unsigned char *pic, size_t pic_size)
 {
 	int ret = 0;
-	char filename[1024];
 
 	if (pic_hdr->id != img->id)
 		return 0;
 
-	if (img->time < pic_hdr->time) {
+	ret = img_write_at(img, pic_hdr->time, pic);
+	memcpy(img->prev_video_frame_message, pic, pic_size);
+
+	return ret;
+}
+
+int img_frame_drop_message(img_t img, glc_frame_drop_message_t *drop_msg)
+{
+	if ((drop_msg->id != img->id) || (!img->prev_video_frame_message))
+		return 0;
+
+	/* dropped frame occupies its slot, fill it with previous frame */
+	return img_write_at(img, drop_msg->time, img->prev_video_frame_message);
+}
+
+int img_write_at(img_t img, glc_utime_t time, const unsigned char *pic)
+{
+	int ret = 0;
+	char filename[1024];
+
+	if (img->time < time) {
 		/* write previous pic until we are 'fps' away from current time */
-		while (img->time + img->fps_usec < pic_hdr->time) {
+		while (img->time + img->fps_usec < time) {
 			img->time += img->fps_usec;
 
 			snprintf(filename, sizeof(filename) - 1, img->filename_format, img->i++);
@@ -242,8 +273,6 @@ int img_video_frame_message(img_t img, glc_video_frame_header_t *pic_hdr,
 		ret = img->write_proc(img, pic, img->w, img->h, filename);
 	}
 
-	memcpy(img->prev_video_frame_message, pic, pic_size);
-
 	return ret;
 }
 
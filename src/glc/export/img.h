@@ -81,6 +81,16 @@ __PUBLIC int img_set_stream_id(img_t img, glc_stream_id_t id);
  */
 __PUBLIC int img_set_fps(img_t img, double fps);
 
+/**
+ * \brief set start time
+ *
+ * Frames before [time] are not written. Default is 0.
+ * \param img img object
+ * \param time stream time in microseconds
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int img_set_start_time(img_t img, glc_utime_t time);
+
 /**
  * \brief set format
  *
@@ -66,7 +66,7 @@ struct wav_s {
 
 	FILE *to;
 	
-	glc_utime_t time;
+	glc_utime_t time, start_time;
 	unsigned int rate, channels, interleaved;
 	size_t bps;
 	size_t sample_size;
@@ -154,6 +154,12 @@ int wav_set_stream_id(wav_t wav, glc_stream_id_t id)
 	return 0;
 }
 
+int wav_set_start_time(wav_t wav, glc_utime_t time)
+{
+	wav->start_time = wav->time = time;
+	return 0;
+}
+
 int wav_set_silence_threshold(wav_t wav, glc_utime_t silence_threshold)
 {
 	wav->silence_threshold = silence_threshold;
@@ -256,7 +262,7 @@ int wav_write_audio(wav_t wav, glc_audio_data_header_t *audio_hdr, char *data)
 	unsigned int c;
 	size_t samples, s;
 
-	if (audio_hdr->id != wav->id)
+	if ((audio_hdr->id != wav->id) || (audio_hdr->time < wav->start_time))
 		return 0;
 	
 	glc_utime_t duration = ((glc_utime_t) audio_hdr->size * (glc_utime_t) 1000000) / (glc_utime_t) wav->bps;
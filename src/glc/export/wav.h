@@ -92,6 +92,16 @@ __PUBLIC int wav_set_interpolation(wav_t wav, int interpolate);
  */
 __PUBLIC int wav_set_silence_threshold(wav_t wav, glc_utime_t silence_threshold);
 
+/**
+ * \brief set start time
+ *
+ * Audio data before [time] is not written. Default is 0.
+ * \param wav wav object
+ * \param time stream time in microseconds
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int wav_set_start_time(wav_t wav, glc_utime_t time);
+
 /**
  * \brief start wav process
  *
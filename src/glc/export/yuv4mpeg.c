@@ -37,7 +37,7 @@ struct yuv4mpeg_s {
 	unsigned int file_count;
 	FILE *to;
 
-	glc_utime_t time;
+	glc_utime_t time, start_time;
 	glc_utime_t fps_usec;
 	double fps;
 
@@ -54,6 +54,8 @@ void yuv4mpeg_finish_callback(void *priv, int err);
 
 int yuv4mpeg_handle_hdr(yuv4mpeg_t yuv4mpeg, glc_video_format_message_t *video_format);
 int yuv4mpeg_handle_video_frame_message(yuv4mpeg_t yuv4mpeg, glc_video_frame_header_t *pic_header, char *data);
+int yuv4mpeg_handle_frame_drop_message(yuv4mpeg_t yuv4mpeg, glc_frame_drop_message_t *drop_msg);
+int yuv4mpeg_write_at(yuv4mpeg_t yuv4mpeg, glc_utime_t time, char *pic);
 int yuv4mpeg_write_video_frame_message(yuv4mpeg_t yuv4mpeg, char *pic);
 
 int yuv4mpeg_init(yuv4mpeg_t *yuv4mpeg, glc_t *glc)
@@ -102,6 +104,12 @@ int yuv4mpeg_set_fps(yuv4mpeg_t yuv4mpeg, double fps)
 	return 0;
 }
 
+int yuv4mpeg_set_start_time(yuv4mpeg_t yuv4mpeg, glc_utime_t time)
+{
+	yuv4mpeg->start_time = yuv4mpeg->time = time;
+	return 0;
+}
+
 int yuv4mpeg_set_interpolation(yuv4mpeg_t yuv4mpeg, int interpolate)
 {
 	yuv4mpeg->interpolate = interpolate;
@@ -150,7 +158,7 @@ void yuv4mpeg_finish_callback(void *priv, int err)
 	}
 
 	yuv4mpeg->file_count = 0;
-	yuv4mpeg->time = 0;
+	yuv4mpeg->time = yuv4mpeg->start_time;
 }
 
 int yuv4mpeg_read_callback(glc_thread_state_t *state)
@@ -161,6 +169,8 @@ int yuv4mpeg_read_callback(glc_thread_state_t *state)
 		return yuv4mpeg_handle_hdr(yuv4mpeg, (glc_video_format_message_t *) state->read_data);
 	else if (state->header.type == GLC_MESSAGE_VIDEO_FRAME)
 		return yuv4mpeg_handle_video_frame_message(yuv4mpeg, (glc_video_frame_header_t *) state->read_data, &state->read_data[sizeof(glc_video_frame_header_t)]);
+	else if (state->header.type == GLC_MESSAGE_FRAME_DROP)
+		return yuv4mpeg_handle_frame_drop_message(yuv4mpeg, (glc_frame_drop_message_t *) state->read_data);
 
 	return 0;
 }
@@ -196,18 +206,17 @@ int yuv4mpeg_handle_hdr(yuv4mpeg_t yuv4mpeg, glc_video_format_message_t *video_f
 	yuv4mpeg->size = video_format->width * video_format->height +
 			 (video_format->width * video_format->height) / 2;
 
-	if (yuv4mpeg->interpolate) {
-		if (yuv4mpeg->prev_video_frame_message)
-			yuv4mpeg->prev_video_frame_message = (char *) realloc(yuv4mpeg->prev_video_frame_message, yuv4mpeg->size);
-		else
-			yuv4mpeg->prev_video_frame_message = (char *) malloc(yuv4mpeg->size);
-
-		/* Set Y' 0 */
-		memset(yuv4mpeg->prev_video_frame_message, 0, video_format->width * video_format->height);
-		/* Set CbCr 128 */
-		memset(&yuv4mpeg->prev_video_frame_message[video_format->width * video_format->height],
-		       128, (video_format->width * video_format->height) / 2);
-	}
+	/* previous frame is needed for dropped frames even without interpolation */
+	if (yuv4mpeg->prev_video_frame_message)
+		yuv4mpeg->prev_video_frame_message = (char *) realloc(yuv4mpeg->prev_video_frame_message, yuv4mpeg->size);
+	else
+		yuv4mpeg->prev_video_frame_message = (char *) malloc(yuv4mpeg->size);
+
+	/* Set Y' 0 */
+	memset(yuv4mpeg->prev_video_frame_message, 0, video_format->width * video_format->height);
+	/* Set CbCr 128 */
+	memset(&yuv4mpeg->prev_video_frame_message[video_format->width * video_format->height],
+	       128, (video_format->width * video_format->height) / 2);
 
 	/* calculate fps in p/q */
 	/** \todo something more intelligent perhaps... */
@@ -228,19 +237,33 @@ int yuv4mpeg_handle_video_frame_message(yuv4mpeg_t yuv4mpeg, glc_video_frame_hea
 	if (pic_hdr->id != yuv4mpeg->id)
 		return 0;
 
-	if (yuv4mpeg->time < pic_hdr->time) {
-		while (yuv4mpeg->time + yuv4mpeg->fps_usec < pic_hdr->time) {
+	yuv4mpeg_write_at(yuv4mpeg, pic_hdr->time, data);
+	memcpy(yuv4mpeg->prev_video_frame_message, data, yuv4mpeg->size);
+
+	return 0;
+}
+
+int yuv4mpeg_handle_frame_drop_message(yuv4mpeg_t yuv4mpeg, glc_frame_drop_message_t *drop_msg)
+{
+	if ((drop_msg->id != yuv4mpeg->id) || (!yuv4mpeg->to))
+		return 0;
+
+	/* dropped frame occupies its slot, fill it with previous frame */
+	return yuv4mpeg_write_at(yuv4mpeg, drop_msg->time, yuv4mpeg->prev_video_frame_message);
+}
+
+int yuv4mpeg_write_at(yuv4mpeg_t yuv4mpeg, glc_utime_t time, char *pic)
+{
+	if (yuv4mpeg->time < time) {
+		while (yuv4mpeg->time + yuv4mpeg->fps_usec < time) {
 			if (yuv4mpeg->interpolate)
 				yuv4mpeg_write_video_frame_message(yuv4mpeg, yuv4mpeg->prev_video_frame_message);
 			yuv4mpeg->time += yuv4mpeg->fps_usec;
 		}
-		yuv4mpeg_write_video_frame_message(yuv4mpeg, data);
+		yuv4mpeg_write_video_frame_message(yuv4mpeg, pic);
 		yuv4mpeg->time += yuv4mpeg->fps_usec;
 	}
 
-	if (yuv4mpeg->interpolate)
-		memcpy(yuv4mpeg->prev_video_frame_message, data, yuv4mpeg->size);
-
 	return 0;
 }
 
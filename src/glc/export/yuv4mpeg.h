@@ -78,6 +78,16 @@ __PUBLIC int yuv4mpeg_set_stream_id(yuv4mpeg_t yuv4mpeg, glc_stream_id_t id);
  */
 __PUBLIC int yuv4mpeg_set_fps(yuv4mpeg_t yuv4mpeg, double fps);
 
+/**
+ * \brief set start time
+ *
+ * Frames before [time] are not written. Default is 0.
+ * \param yuv4mpeg yuv4mpeg object
+ * \param time stream time in microseconds
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int yuv4mpeg_set_start_time(yuv4mpeg_t yuv4mpeg, glc_utime_t time);
+
 /**
  * \brief set interpolation
  *
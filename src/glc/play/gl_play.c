@@ -207,7 +207,7 @@ int gl_play_draw_video_frame_messageture(gl_play_t gl_play, char *from)
 
 	glEnable(GL_TEXTURE_2D);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, gl_play->pack_alignment);
-	glPixelStorei(GL_UNPACK_ROW_LENGTH, gl_play->w);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, gl_play->row / gl_play->bpp);
 
 	height_r = gl_play->h;
 	while (height_r > 0) {
@@ -620,6 +620,11 @@ int gl_play_read_callback(glc_thread_state_t *state)
 			gl_play->pack_alignment = 8;
 			if (gl_play->row % 8 != 0)
 				gl_play->row += 8 - gl_play->row % 8;
+		} else if (format_msg->flags & GLC_VIDEO_CACHELINE_ALIGNED) {
+			/* padded using GL_UNPACK_ROW_LENGTH */
+			gl_play->pack_alignment = 8;
+			if (gl_play->row % GLC_VIDEO_CACHELINE != 0)
+				gl_play->row += GLC_VIDEO_CACHELINE - gl_play->row % GLC_VIDEO_CACHELINE;
 		} else
 			gl_play->pack_alignment = 1;
 
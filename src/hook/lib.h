@@ -77,6 +77,7 @@ __PRIVATE int alsa_unhook_so(const char *soname);
  */
 __PRIVATE int opengl_init(glc_t *glc);
 __PRIVATE int opengl_start(ps_buffer_t *buffer);
+__PRIVATE int opengl_governor_buffer(ps_buffer_t *buffer, size_t size);
 __PRIVATE int opengl_capture_start();
 __PRIVATE int opengl_capture_stop();
 __PRIVATE int opengl_refresh_color_correction();
@@ -40,6 +40,9 @@
 #define MAIN_SYNC                 0x20
 #define MAIN_COMPRESS_LZJB        0x40
 #define MAIN_START                0x80
+#define MAIN_COMPRESS_LZ4        0x100
+#define MAIN_COMPRESS_ADAPTIVE   0x200
+#define MAIN_DIRECT              0x400
 
 struct main_private_s {
 	glc_t glc;
@@ -53,6 +56,19 @@ struct main_private_s {
 	pack_t pack;
 
 	unsigned int capture;
+	unsigned int delta;
+	unsigned int compress_target;
+	int compress_probe;
+	int compress_layout;
+	int compress_ycocg;
+	int compress_lpc;
+	size_t block_size;
+	size_t sync_size;
+	unsigned int sync_interval;
+	size_t resync_size;
+	u_int64_t segment_size;
+	glc_utime_t segment_time;
+	size_t prealloc_size;
 	const char *stream_file_fmt;
 	char *stream_file;
 
@@ -81,6 +97,7 @@ __PRIVATE int load_environ();
 __PRIVATE void signal_handler(int signum);
 __PRIVATE void get_real_libc_dlsym();
 __PRIVATE void reload_stream_callback(void *arg);
+__PRIVATE char *next_segment_name(void *arg, unsigned int segment);
 
 void init_glc()
 {
@@ -191,6 +208,17 @@ int open_stream()
 
 	if ((ret = file_set_sync(mpriv.file, (mpriv.flags & MAIN_SYNC) ? 1 : 0)))
 		return ret;
+	if ((ret = file_set_direct(mpriv.file, (mpriv.flags & MAIN_DIRECT) ? 1 : 0)))
+		return ret;
+	if ((ret = file_set_group_commit(mpriv.file, mpriv.sync_size, mpriv.sync_interval)))
+		return ret;
+	if ((ret = file_set_prealloc(mpriv.file, mpriv.prealloc_size)))
+		return ret;
+	if ((ret = file_set_resync(mpriv.file, mpriv.resync_size)))
+		return ret;
+	if ((ret = file_set_segment(mpriv.file, mpriv.segment_size, mpriv.segment_time,
+				    &next_segment_name, mpriv.stream_file)))
+		return ret;
 	if ((ret = file_open_target(mpriv.file, mpriv.stream_file)))
 		return ret;
 	if ((ret = file_write_info(mpriv.file, stream_info,
@@ -207,14 +235,15 @@ int close_stream()
 {
 	int ret;
 
+	/* segment names are made from stream file name */
+	if ((ret = file_close_target(mpriv.file)))
+		return ret;
+
 	if (mpriv.stream_file != NULL) {
 		free(mpriv.stream_file);
 		mpriv.stream_file = NULL;
 	}
 
-	if ((ret = file_close_target(mpriv.file)))
-		return ret;
-
 	return 0;
 }
 
@@ -240,6 +269,29 @@ err:
 		"can't reload stream: %s (%d)\n", strerror(ret), ret);
 }
 
+char *next_segment_name(void *arg, unsigned int segment)
+{
+	/*
+	 This is called from segment thread of file object, so only
+	 stream file name passed in arg is used. Segments of
+	 app-1-0.glc are app-1-0-1.glc, app-1-0-2.glc and so on.
+	*/
+	const char *stream_file = (const char *) arg;
+	const char *ext = strrchr(stream_file, '.');
+	size_t base, size;
+	char *filename;
+
+	if ((!ext) || (strchr(ext, '/')))
+		ext = &stream_file[strlen(stream_file)];
+	base = ext - stream_file;
+
+	size = strlen(stream_file) + 12;
+	if (!(filename = (char *) malloc(size)))
+		return NULL;
+	snprintf(filename, size, "%.*s-%u%s", (int) base, stream_file, segment, ext);
+	return filename;
+}
+
 int reload_stream()
 {
 	glc_message_header_t hdr;
@@ -341,6 +393,19 @@ int start_glc()
 			pack_set_compression(mpriv.pack, PACK_LZO);
 		else if (mpriv.flags & MAIN_COMPRESS_LZJB)
 			pack_set_compression(mpriv.pack, PACK_LZJB);
+		else if (mpriv.flags & MAIN_COMPRESS_LZ4)
+			pack_set_compression(mpriv.pack, PACK_LZ4);
+		else if (mpriv.flags & MAIN_COMPRESS_ADAPTIVE) {
+			if (mpriv.compress_target)
+				pack_set_adaptive_target(mpriv.pack, mpriv.compress_target);
+			pack_set_compression(mpriv.pack, PACK_ADAPTIVE);
+		}
+		pack_set_probe(mpriv.pack, mpriv.compress_probe);
+		pack_set_layout(mpriv.pack, mpriv.compress_layout);
+		pack_set_ycocg(mpriv.pack, mpriv.compress_ycocg);
+		pack_set_lpc(mpriv.pack, mpriv.compress_lpc);
+		pack_set_delta(mpriv.pack, mpriv.delta);
+		pack_set_block_size(mpriv.pack, mpriv.block_size);
 
 		if ((ret = pack_process_start(mpriv.pack, mpriv.uncompressed, mpriv.compressed)))
 			return ret;
@@ -352,6 +417,11 @@ int start_glc()
 
 	if ((ret = alsa_start(mpriv.uncompressed)))
 		return ret;
+	if ((ret = opengl_governor_buffer(mpriv.uncompressed, mpriv.uncompressed_size)))
+		return ret;
+	if ((mpriv.compressed) &&
+	    (ret = opengl_governor_buffer(mpriv.compressed, mpriv.compressed_size)))
+		return ret;
 	if ((ret = opengl_start(mpriv.uncompressed)))
 		return ret;
 
@@ -472,6 +542,35 @@ int load_environ()
 			mpriv.flags |= MAIN_SYNC;
 	}
 
+	mpriv.sync_size = 0;
+	if (getenv("GLC_SYNC_SIZE"))
+		mpriv.sync_size = atoi(getenv("GLC_SYNC_SIZE")) * 1024 * 1024;
+
+	mpriv.sync_interval = 0;
+	if (getenv("GLC_SYNC_INTERVAL"))
+		mpriv.sync_interval = atoi(getenv("GLC_SYNC_INTERVAL"));
+
+	mpriv.resync_size = 0;
+	if (getenv("GLC_RESYNC"))
+		mpriv.resync_size = atoi(getenv("GLC_RESYNC")) * 1024;
+
+	mpriv.segment_size = 0;
+	if (getenv("GLC_SEGMENT_SIZE"))
+		mpriv.segment_size = (u_int64_t) atoi(getenv("GLC_SEGMENT_SIZE")) * 1024 * 1024;
+
+	mpriv.segment_time = 0;
+	if (getenv("GLC_SEGMENT_TIME"))
+		mpriv.segment_time = (glc_utime_t) atoi(getenv("GLC_SEGMENT_TIME")) * 1000000;
+
+	mpriv.prealloc_size = 0;
+	if (getenv("GLC_PREALLOC_MB"))
+		mpriv.prealloc_size = atoi(getenv("GLC_PREALLOC_MB")) * 1024 * 1024;
+
+	if (getenv("GLC_DIRECT_IO")) {
+		if (atoi(getenv("GLC_DIRECT_IO")))
+			mpriv.flags |= MAIN_DIRECT;
+	}
+
 	mpriv.uncompressed_size = 1024 * 1024 * 25;
 	if (getenv("GLC_UNCOMPRESSED_BUFFER_SIZE"))
 		mpriv.uncompressed_size = atoi(getenv("GLC_UNCOMPRESSED_BUFFER_SIZE")) * 1024 * 1024;
@@ -480,6 +579,34 @@ int load_environ()
 	if (getenv("GLC_COMPRESSED_BUFFER_SIZE"))
 		mpriv.compressed_size = atoi(getenv("GLC_COMPRESSED_BUFFER_SIZE")) * 1024 * 1024;
 
+	mpriv.block_size = 0;
+	if (getenv("GLC_COMPRESS_BLOCK"))
+		mpriv.block_size = atoi(getenv("GLC_COMPRESS_BLOCK")) * 1024;
+
+	mpriv.compress_target = 0;
+	if (getenv("GLC_COMPRESS_TARGET"))
+		mpriv.compress_target = atoi(getenv("GLC_COMPRESS_TARGET"));
+
+	mpriv.compress_probe = 0;
+	if (getenv("GLC_COMPRESS_PROBE"))
+		mpriv.compress_probe = atoi(getenv("GLC_COMPRESS_PROBE"));
+
+	mpriv.compress_layout = 0;
+	if (getenv("GLC_COMPRESS_LAYOUT"))
+		mpriv.compress_layout = atoi(getenv("GLC_COMPRESS_LAYOUT"));
+
+	mpriv.compress_ycocg = 0;
+	if (getenv("GLC_COMPRESS_YCOCG"))
+		mpriv.compress_ycocg = atoi(getenv("GLC_COMPRESS_YCOCG"));
+
+	mpriv.compress_lpc = 0;
+	if (getenv("GLC_COMPRESS_LPC"))
+		mpriv.compress_lpc = atoi(getenv("GLC_COMPRESS_LPC"));
+
+	mpriv.delta = 0;
+	if (getenv("GLC_DELTA"))
+		mpriv.delta = atoi(getenv("GLC_DELTA"));
+
 	if (getenv("GLC_COMPRESS")) {
 		if (!strcmp(getenv("GLC_COMPRESS"), "lzo"))
 			mpriv.flags |= MAIN_COMPRESS_LZO;
@@ -487,6 +614,10 @@ int load_environ()
 			mpriv.flags |= MAIN_COMPRESS_QUICKLZ;
 		else if (!strcmp(getenv("GLC_COMPRESS"), "lzjb"))
 			mpriv.flags |= MAIN_COMPRESS_LZJB;
+		else if (!strcmp(getenv("GLC_COMPRESS"), "lz4"))
+			mpriv.flags |= MAIN_COMPRESS_LZ4;
+		else if (!strcmp(getenv("GLC_COMPRESS"), "adaptive"))
+			mpriv.flags |= MAIN_COMPRESS_ADAPTIVE;
 		else
 			mpriv.flags |= MAIN_COMPRESS_NONE;
 	}
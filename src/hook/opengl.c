@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dlfcn.h>
+#include <signal.h>
 
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
@@ -45,12 +46,17 @@ struct opengl_private_s {
 
 	int capture_glfinish;
 	int convert_ycbcr_420jpeg;
+	int cacheline_aligned;
 	double scale_factor;
 	GLenum read_buffer;
 	double fps;
 
 	int started;
 	int capturing;
+
+	int profile;
+	volatile sig_atomic_t profile_report;
+	void (*sigusr1_handler)(int);
 };
 
 __PRIVATE struct opengl_private_s opengl;
@@ -58,6 +64,8 @@ __PRIVATE struct opengl_private_s opengl;
 __PRIVATE void get_real_opengl();
 __PRIVATE void opengl_capture_current();
 __PRIVATE void opengl_draw_indicator();
+__PRIVATE void opengl_profile_signal(int signum);
+__PRIVATE int opengl_governor_scale(void *arg, double factor);
 
 int opengl_init(glc_t *glc)
 {
@@ -66,10 +74,14 @@ int opengl_init(glc_t *glc)
 	opengl.started = 0;
 	opengl.scale_factor = 1.0;
 	opengl.capture_glfinish = 0;
+	opengl.cacheline_aligned = 0;
 	opengl.read_buffer = GL_FRONT;
 	opengl.capturing = 0;
+	opengl.profile = 0;
+	opengl.profile_report = 0;
 	int ret = 0;
 	unsigned int x, y, w, h;
+	struct sigaction new_sighandler, old_sighandler;
 
 	glc_log(opengl.glc, GLC_DEBUG, "opengl", "initializing");
 
@@ -126,6 +138,12 @@ int opengl_init(glc_t *glc)
 			gl_capture_set_pack_alignment(opengl.gl_capture, 1);
 	}
 
+	if (getenv("GLC_CAPTURE_CACHELINE_ALIGNED")) {
+		opengl.cacheline_aligned = atoi(getenv("GLC_CAPTURE_CACHELINE_ALIGNED"));
+		if (opengl.cacheline_aligned)
+			gl_capture_set_pack_alignment(opengl.gl_capture, GLC_VIDEO_CACHELINE);
+	}
+
 	if (getenv("GLC_CROP")) {
 		w = h = x = y = 0;
 
@@ -143,10 +161,53 @@ int opengl_init(glc_t *glc)
 	if (getenv("GLC_LOCK_FPS"))
 		gl_capture_lock_fps(opengl.gl_capture, atoi(getenv("GLC_LOCK_FPS")));
 
+	if (getenv("GLC_FRAME_TIMES"))
+		gl_capture_set_frame_times(opengl.gl_capture, atoi(getenv("GLC_FRAME_TIMES")));
+
+	if (getenv("GLC_GOVERNOR"))
+		gl_capture_set_governor(opengl.gl_capture, atoi(getenv("GLC_GOVERNOR")));
+
+	if (getenv("GLC_PROFILE"))
+		opengl.profile = atoi(getenv("GLC_PROFILE"));
+
+	if (opengl.profile) {
+		gl_capture_set_profile(opengl.gl_capture, 1);
+
+		/* report is written from next swap, not from signal handler */
+		new_sighandler.sa_handler = opengl_profile_signal;
+		sigemptyset(&new_sighandler.sa_mask);
+		new_sighandler.sa_flags = SA_RESTART;
+
+		sigaction(SIGUSR1, &new_sighandler, &old_sighandler);
+		opengl.sigusr1_handler = old_sighandler.sa_handler;
+	}
+
 	get_real_opengl();
 	return 0;
 }
 
+void opengl_profile_signal(int signum)
+{
+	opengl.profile_report = 1;
+
+	if ((opengl.sigusr1_handler != SIG_DFL) &&
+	    (opengl.sigusr1_handler != SIG_IGN) &&
+	    (opengl.sigusr1_handler != NULL))
+		opengl.sigusr1_handler(signum);
+}
+
+int opengl_governor_scale(void *arg, double factor)
+{
+	if (opengl.convert_ycbcr_420jpeg)
+		return ycbcr_set_scale(opengl.ycbcr, opengl.scale_factor * factor);
+	return scale_set_scale(opengl.scale, opengl.scale_factor * factor);
+}
+
+int opengl_governor_buffer(ps_buffer_t *buffer, size_t size)
+{
+	return gl_capture_add_governor_buffer(opengl.gl_capture, buffer, size);
+}
+
 int opengl_start(ps_buffer_t *buffer)
 {
 	if (opengl.started)
@@ -154,10 +215,21 @@ int opengl_start(ps_buffer_t *buffer)
 
 	opengl.buffer = buffer;
 
-	/* init unscaled buffer if it is needed */
-	if ((opengl.scale_factor != 1.0) | opengl.convert_ycbcr_420jpeg) {
-		/* if scaling is enabled, it is faster to capture as GL_BGRA */
-		gl_capture_set_pixel_format(opengl.gl_capture, GL_BGRA);
+	/*
+	 init unscaled buffer if it is needed, cache-line aligned
+	 frames always pass through scale or ycbcr which strip
+	 the row padding before compression
+	*/
+	if ((opengl.scale_factor != 1.0) | opengl.convert_ycbcr_420jpeg |
+	    opengl.cacheline_aligned) {
+		/*
+		 if scaling is enabled, it is faster to capture as GL_BGRA,
+		 padded GL_BGR rows are only stripped by scale
+		*/
+		if ((opengl.scale_factor != 1.0) | opengl.convert_ycbcr_420jpeg)
+			gl_capture_set_pixel_format(opengl.gl_capture, GL_BGRA);
+		else
+			gl_capture_set_pixel_format(opengl.gl_capture, GL_BGR);
 
 		ps_bufferattr_t attr;
 		ps_bufferattr_init(&attr);
@@ -176,6 +248,12 @@ int opengl_start(ps_buffer_t *buffer)
 		}
 
 		gl_capture_set_buffer(opengl.gl_capture, opengl.unscaled);
+		gl_capture_add_governor_buffer(opengl.gl_capture, opengl.unscaled,
+					       opengl.unscaled_size);
+
+		/* governor can only scale when frames pass through scale or ycbcr */
+		gl_capture_set_governor_scale_callback(opengl.gl_capture,
+						       opengl_governor_scale, NULL);
 	} else {
 		gl_capture_set_pixel_format(opengl.gl_capture, GL_BGR);
 		gl_capture_set_buffer(opengl.gl_capture, opengl.buffer);
@@ -195,6 +273,7 @@ int opengl_close()
 
 	if (opengl.capturing)
 		gl_capture_stop(opengl.gl_capture);
+	gl_capture_profile_report(opengl.gl_capture);
 	gl_capture_destroy(opengl.gl_capture);
 
 	if (opengl.unscaled) {
@@ -347,6 +426,12 @@ void __opengl_glXSwapBuffers(Display *dpy, GLXDrawable drawable)
 {
 	INIT_GLC
 
+	gl_capture_profile_swap(opengl.gl_capture);
+	if (opengl.profile_report) {
+		opengl.profile_report = 0;
+		gl_capture_profile_report(opengl.gl_capture);
+	}
+
 	/* both flags shouldn't be defined */
 	if (opengl.read_buffer == GL_FRONT)
 		opengl.glXSwapBuffers(dpy, drawable);
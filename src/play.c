@@ -7,6 +7,7 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <semaphore.h>
 #include <getopt.h>
@@ -24,6 +25,7 @@
 #include <glc/core/rgb.h>
 #include <glc/core/color.h>
 #include <glc/core/info.h>
+#include <glc/core/bench.h>
 #include <glc/core/ycbcr.h>
 #include <glc/core/scale.h>
 
@@ -33,7 +35,8 @@
 
 #include <glc/play/demux.h>
 
-enum play_action {action_play, action_info, action_img, action_yuv4mpeg, action_wav, action_val};
+enum play_action {action_play, action_info, action_img, action_yuv4mpeg, action_wav, action_val,
+		  action_bench, action_repair};
 
 struct play_s {
 	glc_t glc;
@@ -44,6 +47,7 @@ struct play_s {
 
 	file_t file;
 	const char *stream_file;
+	glc_utime_t seek_time;
 
 	double scale_factor;
 	unsigned int scale_width, scale_height;
@@ -55,6 +59,8 @@ struct play_s {
 	float red_gamma, green_gamma, blue_gamma;
 
 	int info_level;
+	const char *frame_times_file;
+	size_t bench_sample_size;
 	int interpolate;
 	double fps;
 
@@ -70,9 +76,13 @@ struct play_s {
 };
 
 int show_info_value(struct play_s *play, const char *value);
+int show_summary_value(struct play_s *play, const char *value);
+int read_stream(struct play_s *play, ps_buffer_t *to);
 
 int play_stream(struct play_s *play);
 int stream_info(struct play_s *play);
+int codec_bench(struct play_s *play);
+int repair_stream(struct play_s *play);
 int export_img(struct play_s *play);
 int export_yuv4mpeg(struct play_s *play);
 int export_wav(struct play_s *play);
@@ -82,10 +92,13 @@ int main(int argc, char *argv[])
 	struct play_s play;
 	play.action = action_play;
 	const char *val_str = NULL;
+	unsigned long bench_mib;
+	char *endptr;
 	int opt, option_index;
 
 	struct option long_options[] = {
 		{"info",		1, NULL, 'i'},
+		{"frame-times",		1, NULL, 'F'},
 		{"wav",			1, NULL, 'a'},
 		{"bmp",			1, NULL, 'b'},
 		{"png",			1, NULL, 'p'},
@@ -100,6 +113,9 @@ int main(int argc, char *argv[])
 		{"compressed",		1, NULL, 'c'},
 		{"uncompressed",	1, NULL, 'u'},
 		{"show",		1, NULL, 's'},
+		{"seek",		1, NULL, 'S'},
+		{"codec-bench",		2, NULL, 'B'},
+		{"repair",		0, NULL, 'R'},
 		{"verbosity",		1, NULL, 'v'},
 		{"help",		0, NULL, 'h'},
 		{"version",		0, NULL, 'V'},
@@ -108,6 +124,7 @@ int main(int argc, char *argv[])
 	option_index = 0;
 
 	play.fps = 0;
+	play.seek_time = 0;
 
 	play.silence_threshold = 200000; /* 0.2 sec accuracy */
 	play.alsa_playback_device = "default";
@@ -123,6 +140,8 @@ int main(int argc, char *argv[])
 	/* log to stderr */
 	play.log_level = 0;
 	play.info_level = 1;
+	play.frame_times_file = NULL;
+	play.bench_sample_size = 64 * 1024 * 1024;
 
 	/* default export settings */
 	play.interpolate = 1;
@@ -136,7 +155,7 @@ int main(int argc, char *argv[])
 	play.green_gamma = 1.0;
 	play.blue_gamma = 1.0;
 
-	while ((opt = getopt_long(argc, argv, "i:a:b:p:y:o:f:r:g:l:td:c:u:s:v:hV",
+	while ((opt = getopt_long(argc, argv, "i:F:a:b:p:y:o:f:r:g:l:td:c:u:s:S:B::Rv:hV",
 				  long_options, &optind)) != -1) {
 		switch (opt) {
 		case 'i':
@@ -145,6 +164,9 @@ int main(int argc, char *argv[])
 				goto usage;
 			play.action = action_info;
 			break;
+		case 'F':
+			play.frame_times_file = optarg;
+			break;
 		case 'a':
 			play.export_audio_id = atoi(optarg);
 			if (play.export_audio_id < 1)
@@ -216,6 +238,25 @@ int main(int argc, char *argv[])
 			val_str = optarg;
 			play.action = action_val;
 			break;
+		case 'S':
+			if (atof(optarg) < 0)
+				goto usage;
+			play.seek_time = atof(optarg) * 1000000;
+			break;
+		case 'B':
+			if (optarg) {
+				errno = 0;
+				bench_mib = strtoul(optarg, &endptr, 10);
+				if ((errno) || (*endptr != '\0') || (!bench_mib) ||
+				    (bench_mib > SIZE_MAX / (1024 * 1024)))
+					goto usage;
+				play.bench_sample_size = bench_mib * 1024 * 1024;
+			}
+			play.action = action_bench;
+			break;
+		case 'R':
+			play.action = action_repair;
+			break;
 		case 'v':
 			play.log_level = atoi(optarg);
 			if (play.log_level < 0)
@@ -238,10 +279,15 @@ int main(int argc, char *argv[])
 	/* same goes to output file */
 	if (((play.action == action_img) |
 	     (play.action == action_wav) |
-	     (play.action == action_yuv4mpeg)) &&
+	     (play.action == action_yuv4mpeg) |
+	     (play.action == action_repair)) &&
 	    (play.export_filename_format == NULL))
 		goto usage;
 
+	/* frame times are collected by info */
+	if ((play.frame_times_file) && (play.action != action_info))
+		goto usage;
+
 	/* we do global initialization */
 	glc_init(&play.glc);
 	glc_log_set_level(&play.glc, play.log_level);
@@ -290,6 +336,14 @@ int main(int argc, char *argv[])
 		if (show_info_value(&play, val_str))
 			return EXIT_FAILURE;
 		break;
+	case action_bench:
+		if (codec_bench(&play))
+			return EXIT_FAILURE;
+		break;
+	case action_repair:
+		if (repair_stream(&play))
+			return EXIT_FAILURE;
+		break;
 	}
 
 	/* our cleanup */
@@ -308,6 +362,8 @@ usage:
 	printf("%s [file] [option]...\n", argv[0]);
 	printf("  -i, --info=LEVEL         show stream information, LEVEL must be\n"
 	       "                             greater than 0\n"
+	       "  -F, --frame-times=FILE   with -i, write recorded frame timing to FILE\n"
+	       "                             as CSV\n"
 	       "  -a, --wav=NUM            save audio stream NUM in wav format\n"
 	       "  -b, --bmp=NUM            save frames from stream NUM as bmp files\n"
 	       "                             (use -o pic-%%010d.bmp f.ex.)\n"
@@ -329,7 +385,13 @@ usage:
 	       "                             default is 10 MiB\n"
 	       "  -s, --show=VAL           show stream summary value, possible values are:\n"
 	       "                             all, signature, version, flags, fps,\n"
-	       "                             pid, name, date\n"
+	       "                             pid, name, date, streams, frames,\n"
+	       "                             drops, duration\n"
+	       "  -S, --seek=SECONDS       start from SECONDS, stream must have an index\n"
+	       "  -B, --codec-bench[=SIZE] benchmark compiled codecs and transforms\n"
+	       "                             on SIZE MiB of stream, default is 64 MiB\n"
+	       "  -R, --repair             copy intact packets to new stream file,\n"
+	       "                             use with -o\n"
 	       "  -v, --verbosity=LEVEL    verbosity level\n"
 	       "  -h, --help               show help\n");
 
@@ -346,6 +408,7 @@ int show_info_value(struct play_s *play, const char *value)
 		printf("  pid         = %d\n", play->stream_info.pid);
 		printf("  name        = %s\n", play->info_name);
 		printf("  date        = %s\n", play->info_date);
+		return show_summary_value(play, value);
 	} else if (!strcmp("signature", value))
 		printf("0x%08x\n", play->stream_info.signature);
 	else if (!strcmp("version", value))
@@ -361,10 +424,99 @@ int show_info_value(struct play_s *play, const char *value)
 	else if (!strcmp("date", value))
 		printf("%s\n", play->info_date);
 	else
+		return show_summary_value(play, value);
+	return 0;
+}
+
+int show_summary_value(struct play_s *play, const char *value)
+{
+	glc_stream_summary_t *summary;
+	unsigned int count, i;
+	glc_utime_t first = 0, last = 0;
+	u_int64_t frames = 0, drops = 0;
+	int all = !strcmp("all", value);
+	int ret;
+
+	if ((!all) && (strcmp("streams", value)) && (strcmp("frames", value)) &&
+	    (strcmp("drops", value)) && (strcmp("duration", value)))
 		return ENOTSUP;
+
+	/* writer stores summary with index, no need to read the stream */
+	if ((ret = file_read_summary(play->file, &summary, &count))) {
+		if (all)
+			return 0;
+		fprintf(stderr, "stream has no summary, use -i instead\n");
+		return ret;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (summary[i].type == GLC_MESSAGE_VIDEO_FORMAT) {
+			frames += summary[i].frames;
+			drops += summary[i].drops;
+		}
+
+		/* packets of unknown stream may have no times */
+		if ((summary[i].frames) &&
+		    ((summary[i].id != GLC_SUMMARY_UNKNOWN_STREAM) || (summary[i].last))) {
+			if ((!first) || (summary[i].first < first))
+				first = summary[i].first;
+			if (summary[i].last > last)
+				last = summary[i].last;
+		}
+
+		if ((!all) && (strcmp("streams", value)))
+			continue;
+
+		printf("%s%s ", all ? "  " : "",
+		       summary[i].type == GLC_MESSAGE_VIDEO_FORMAT ? "video" : "audio");
+		if (summary[i].id == GLC_SUMMARY_UNKNOWN_STREAM)
+			printf("?      ");
+		else
+			printf("%-6d ", summary[i].id);
+		printf("= %llu %s, ", (unsigned long long) summary[i].frames,
+		       summary[i].type == GLC_MESSAGE_VIDEO_FORMAT ? "frames" : "packets");
+		if (summary[i].id == GLC_SUMMARY_UNKNOWN_STREAM)
+			printf("unknown stream, ");
+		else if (summary[i].type == GLC_MESSAGE_VIDEO_FORMAT)
+			printf("%ux%u, %u drops, ", summary[i].width, summary[i].height,
+			       summary[i].drops);
+		else
+			printf("%u Hz, %u channels, ", summary[i].width, summary[i].height);
+		printf("%u changes, %f - %f s, %llu B\n", summary[i].changes,
+		       (double) summary[i].first / 1000000.0,
+		       (double) summary[i].last / 1000000.0,
+		       (unsigned long long) summary[i].bytes);
+	}
+
+	if (!strcmp("frames", value))
+		printf("%llu\n", (unsigned long long) frames);
+	else if (!strcmp("drops", value))
+		printf("%llu\n", (unsigned long long) drops);
+	else if (!strcmp("duration", value))
+		printf("%f\n", (double) (last - first) / 1000000.0);
+
+	free(summary);
 	return 0;
 }
 
+int read_stream(struct play_s *play, ps_buffer_t *to)
+{
+	int ret;
+
+	if (play->seek_time) {
+		if ((ret = file_seek(play->file, to, play->seek_time))) {
+			ps_buffer_cancel(to);
+			return ret;
+		}
+
+		/* playback clock starts from seek time */
+		glc_state_time_add_diff(&play->glc, (glc_stime_t) glc_state_time(&play->glc) -
+						    (glc_stime_t) play->seek_time);
+	}
+
+	return file_read(play->file, to);
+}
+
 int play_stream(struct play_s *play)
 {
 	/*
@@ -455,7 +607,7 @@ int play_stream(struct play_s *play)
 		goto err;
 
 	/* the pipeline is ready - lets give it some data */
-	if ((ret = file_read(play->file, &compressed_buffer)))
+	if ((ret = read_stream(play, &compressed_buffer)))
 		goto err;
 
 	/* we've done our part - just wait for the threads */
@@ -508,6 +660,7 @@ int stream_info(struct play_s *play)
 	ps_buffer_t uncompressed_buffer, compressed_buffer;
 	info_t info;
 	unpack_t unpack;
+	FILE *frame_times = NULL;
 	int ret = 0;
 
 	if ((ret = ps_bufferattr_init(&attr)))
@@ -533,13 +686,24 @@ int stream_info(struct play_s *play)
 	if ((ret = info_init(&info, &play->glc)))
 		goto err;
 	info_set_level(info, play->info_level);
+	if (play->frame_times_file) {
+		if (!(frame_times = fopen(play->frame_times_file, "w"))) {
+			ret = errno;
+			goto err;
+		}
+		info_set_frame_times_stream(info, frame_times);
+	}
+
+	/* info looks only at message headers, picture and audio data can be skipped */
+	if ((ret = file_set_scan(play->file, 1)))
+		goto err;
 
 	/* run it */
 	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
 		goto err;
 	if ((ret = info_process_start(info, &uncompressed_buffer)))
 		goto err;
-	if ((ret = file_read(play->file, &compressed_buffer)))
+	if ((ret = read_stream(play, &compressed_buffer)))
 		goto err;
 
 	/* wait for threads and do cleanup */
@@ -551,15 +715,169 @@ int stream_info(struct play_s *play)
 	unpack_destroy(unpack);
 	info_destroy(info);
 
+	if (frame_times)
+		fclose(frame_times);
+
 	ps_buffer_destroy(&compressed_buffer);
 	ps_buffer_destroy(&uncompressed_buffer);
 
 	return 0;
 err:
+	if (frame_times)
+		fclose(frame_times);
 	fprintf(stderr, "extracting stream information failed: %s (%d)\n", strerror(ret), ret);
 	return ret;
 }
 
+int repair_stream(struct play_s *play)
+{
+	/*
+	 Repair uses following pipeline:
+
+	 file -(compressed_buffer)->       reads intact packets from stream file
+	 file                       writes new stream file with fresh index
+
+	 Damaged blocks between sync markers are skipped by reader,
+	 tail that no marker covers is dropped. Stream without markers
+	 is copied up to durable size recorded by group commit.
+	*/
+
+	ps_bufferattr_t attr;
+	ps_buffer_t compressed_buffer;
+	file_t out;
+	int ret = 0;
+
+	if ((ret = ps_bufferattr_init(&attr)))
+		goto err;
+
+	if ((ret = ps_bufferattr_setsize(&attr, play->compressed_size)))
+		goto err;
+	if ((ret = ps_buffer_init(&compressed_buffer, &attr)))
+		goto err;
+
+	if ((ret = ps_bufferattr_destroy(&attr)))
+		goto err;
+
+	if ((ret = file_init(&out, &play->glc)))
+		goto err;
+
+	/* only checked blocks, or durable part of stream without markers, are read */
+	if ((ret = file_set_durable_only(play->file, 1)))
+		goto err;
+
+	/*
+	 Packets are copied, not captured, so times must come from packets.
+	 QuickLZ and LZO packets are safe to decode only when markers were
+	 checked, others are counted without times.
+	*/
+	file_set_writer_clock(out, 0);
+	if (play->stream_info.flags & GLC_STREAM_SYNC_MARKERS) {
+		file_set_decode(out, 1);
+		file_set_resync(out, 1024 * 1024);
+	}
+
+	/* nothing of new file is on disk yet */
+	play->stream_info.durable_size = 0;
+
+	if ((ret = file_open_target(out, play->export_filename_format)))
+		goto err;
+	if ((ret = file_write_info(out, &play->stream_info,
+				   play->info_name, play->info_date)))
+		goto err;
+
+	/* run it */
+	if ((ret = file_write_process_start(out, &compressed_buffer)))
+		goto err;
+	if ((ret = read_stream(play, &compressed_buffer)))
+		goto err;
+
+	/* wait for threads and do cleanup */
+	if ((ret = file_write_process_wait(out)))
+		goto err;
+	if ((ret = file_close_target(out)))
+		goto err;
+
+	file_destroy(out);
+	ps_buffer_destroy(&compressed_buffer);
+
+	return 0;
+err:
+	fprintf(stderr, "repairing stream failed: %s (%d)\n", strerror(ret), ret);
+	return ret;
+}
+
+int codec_bench(struct play_s *play)
+{
+	/*
+	 Codec benchmark uses following pipeline:
+
+	 file -(uncompressed_buffer)->     reads data from stream file
+	 unpack -(uncompressed_buffer)->   decompresses lzo/quicklz packets
+	 bench                      collects sample
+
+	 and then runs pack and unpack over the sample
+	*/
+
+	ps_bufferattr_t attr;
+	ps_buffer_t uncompressed_buffer, compressed_buffer;
+	bench_t bench;
+	unpack_t unpack;
+	int ret = 0;
+
+	if ((ret = ps_bufferattr_init(&attr)))
+		goto err;
+
+	/* initialize buffers */
+	if ((ret = ps_bufferattr_setsize(&attr, play->compressed_size)))
+		goto err;
+	if ((ret = ps_buffer_init(&compressed_buffer, &attr)))
+		goto err;
+
+	if ((ret = ps_bufferattr_setsize(&attr, play->uncompressed_size)))
+		goto err;
+	if ((ret = ps_buffer_init(&uncompressed_buffer, &attr)))
+		goto err;
+
+	if ((ret = ps_bufferattr_destroy(&attr)))
+		goto err;
+
+	/* and filters */
+	if ((ret = unpack_init(&unpack, &play->glc)))
+		goto err;
+	if ((ret = bench_init(&bench, &play->glc)))
+		goto err;
+	if ((ret = bench_set_sample_size(bench, play->bench_sample_size)))
+		goto err;
+
+	/* collect sample */
+	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
+		goto err;
+	if ((ret = bench_process_start(bench, &uncompressed_buffer)))
+		goto err;
+	if ((ret = read_stream(play, &compressed_buffer)))
+		goto err;
+
+	if ((ret = bench_process_wait(bench)))
+		goto err;
+	if ((ret = unpack_process_wait(unpack)))
+		goto err;
+
+	unpack_destroy(unpack);
+	ps_buffer_destroy(&compressed_buffer);
+	ps_buffer_destroy(&uncompressed_buffer);
+
+	/* and measure */
+	if ((ret = bench_run(bench)))
+		goto err;
+
+	bench_destroy(bench);
+
+	return 0;
+err:
+	fprintf(stderr, "codec benchmark failed: %s (%d)\n", strerror(ret), ret);
+	return ret;
+}
+
 int export_img(struct play_s *play)
 {
 	/*
@@ -628,6 +946,7 @@ int export_img(struct play_s *play)
 	img_set_stream_id(img, play->export_video_id);
 	img_set_format(img, play->img_format);
 	img_set_fps(img, play->fps);
+	img_set_start_time(img, play->seek_time);
 
 	/* pipeline... */
 	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
@@ -642,7 +961,7 @@ int export_img(struct play_s *play)
 		goto err;
 
 	/* ok, read the file */
-	if ((ret = file_read(play->file, &compressed_buffer)))
+	if ((ret = read_stream(play, &compressed_buffer)))
 		goto err;
 
 	/* wait 'till its done and clean up the mess... */
@@ -740,6 +1059,7 @@ int export_yuv4mpeg(struct play_s *play)
 	if ((ret = yuv4mpeg_init(&yuv4mpeg, &play->glc)))
 		goto err;
 	yuv4mpeg_set_fps(yuv4mpeg, play->fps);
+	yuv4mpeg_set_start_time(yuv4mpeg, play->seek_time);
 	yuv4mpeg_set_stream_id(yuv4mpeg, play->export_video_id);
 	yuv4mpeg_set_interpolation(yuv4mpeg, play->interpolate);
 	yuv4mpeg_set_filename(yuv4mpeg, play->export_filename_format);
@@ -757,7 +1077,7 @@ int export_yuv4mpeg(struct play_s *play)
 		goto err;
 
 	/* feed it with data */
-	if ((ret = file_read(play->file, &compressed_buffer)))
+	if ((ret = read_stream(play, &compressed_buffer)))
 		goto err;
 
 	/* threads will do the dirty work... */
@@ -832,13 +1152,14 @@ int export_wav(struct play_s *play)
 	wav_set_filename(wav, play->export_filename_format);
 	wav_set_stream_id(wav, play->export_audio_id);
 	wav_set_silence_threshold(wav, play->silence_threshold);
+	wav_set_start_time(wav, play->seek_time);
 
 	/* start the threads */
 	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
 		goto err;
 	if ((ret = wav_process_start(wav, &uncompressed_buffer)))
 		goto err;
-	if ((ret = file_read(play->file, &compressed_buffer)))
+	if ((ret = read_stream(play, &compressed_buffer)))
 		goto err;
 
 	/* wait and clean up */